@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#define LOG_TAG "AddressSorter"
+#define DBG 0
+
+#include <cutils/log.h>
+
+#include "AddressSorter.h"
+
+/* RFC 6724 section 3.1 scope values */
+#define SCOPE_NODELOCAL   0x1
+#define SCOPE_LINKLOCAL   0x2
+#define SCOPE_SITELOCAL   0x5
+#define SCOPE_GLOBAL      0xe
+
+/* Destinations are cached per /64 for IPv6 and per /24 for IPv4 */
+#define PREFIX_LEN_INET6  64
+#define PREFIX_LEN_INET   24
+
+struct PolicyEntry {
+    unsigned char prefix[16];
+    int           prefixLen;
+    int           precedence;
+    int           label;
+};
+
+/* RFC 6724 section 2.1 default policy table, longest prefixes first */
+static const PolicyEntry POLICY_TABLE[] = {
+    { { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },            128, 50,  0 },
+    { { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0, 0, 0, 0 },      96, 35,  4 },
+    { { 0 },                                                           96,  1,  3 },
+    { { 0x20, 0x01, 0, 0 },                                            32,  5,  5 },
+    { { 0x20, 0x02 },                                                  16, 30,  2 },
+    { { 0x3f, 0xfe },                                                  16,  1, 12 },
+    { { 0xfe, 0xc0 },                                                  10,  1, 11 },
+    { { 0xfc },                                                         7,  3, 13 },
+    { { 0 },                                                            0, 40,  1 },
+};
+
+static bool prefixMatches(const struct in6_addr *addr, const unsigned char *prefix, int len) {
+    int bytes = len / 8;
+    int bits = len % 8;
+
+    if (memcmp(addr->s6_addr, prefix, bytes))
+        return false;
+    if (bits) {
+        unsigned char mask = (unsigned char) (0xff << (8 - bits));
+        if ((addr->s6_addr[bytes] & mask) != (prefix[bytes] & mask))
+            return false;
+    }
+    return true;
+}
+
+static const PolicyEntry *lookupPolicy(const struct in6_addr *addr) {
+    unsigned int i;
+
+    for (i = 0; i < sizeof(POLICY_TABLE) / sizeof(POLICY_TABLE[0]) - 1; i++) {
+        if (prefixMatches(addr, POLICY_TABLE[i].prefix, POLICY_TABLE[i].prefixLen))
+            return &POLICY_TABLE[i];
+    }
+    return &POLICY_TABLE[i];
+}
+
+static int getScope(const struct in6_addr *addr) {
+    if (IN6_IS_ADDR_MULTICAST(addr))
+        return addr->s6_addr[1] & 0x0f;
+    if (IN6_IS_ADDR_LOOPBACK(addr) || IN6_IS_ADDR_LINKLOCAL(addr))
+        return SCOPE_LINKLOCAL;
+    if (IN6_IS_ADDR_SITELOCAL(addr))
+        return SCOPE_SITELOCAL;
+    if (IN6_IS_ADDR_V4MAPPED(addr)) {
+        // 127.0.0.0/8 and 169.254.0.0/16 are link-local (RFC 6724 section 3.2)
+        if (addr->s6_addr[12] == 127 ||
+            (addr->s6_addr[12] == 169 && addr->s6_addr[13] == 254))
+            return SCOPE_LINKLOCAL;
+    }
+    return SCOPE_GLOBAL;
+}
+
+static void toMapped(const struct sockaddr *sa, struct in6_addr *out, uint32_t *scopeId) {
+    if (sa->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) sa;
+        *out = sin6->sin6_addr;
+        if (scopeId)
+            *scopeId = sin6->sin6_scope_id;
+    } else {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *) sa;
+        memset(out, 0, sizeof(*out));
+        out->s6_addr[10] = 0xff;
+        out->s6_addr[11] = 0xff;
+        memcpy(&out->s6_addr[12], &sin->sin_addr, 4);
+        if (scopeId)
+            *scopeId = 0;
+    }
+}
+
+static int commonPrefixLen(const struct in6_addr *a, const struct in6_addr *b) {
+    int i, len = 0;
+
+    for (i = 0; i < 16; i++) {
+        unsigned char x = a->s6_addr[i] ^ b->s6_addr[i];
+        if (!x) {
+            len += 8;
+            continue;
+        }
+        while (!(x & 0x80)) {
+            x <<= 1;
+            len++;
+        }
+        break;
+    }
+    // Only compare up to the length of the source prefix (RFC 6724 rule 9)
+    return (len > 64 ? 64 : len);
+}
+
+AddressSorter *AddressSorter::sInstance = NULL;
+
+AddressSorter *AddressSorter::Instance() {
+    if (!sInstance)
+        sInstance = new AddressSorter();
+    return sInstance;
+}
+
+AddressSorter::AddressSorter() {
+    pthread_mutex_init(&mLock, NULL);
+    memset(mIface, 0, sizeof(mIface));
+    mCount = 0;
+    mNext = 0;
+    mGeneration = 0;
+}
+
+AddressSorter::~AddressSorter() {
+    pthread_mutex_destroy(&mLock);
+}
+
+void AddressSorter::setDefaultInterface(const char *iface) {
+    pthread_mutex_lock(&mLock);
+    strncpy(mIface, iface ? iface : "", sizeof(mIface) - 1);
+    pthread_mutex_unlock(&mLock);
+}
+
+void AddressSorter::invalidate() {
+    pthread_mutex_lock(&mLock);
+    if (DBG) {
+        LOGD("Invalidating %d cached source selections", mCount);
+    }
+    mCount = 0;
+    mNext = 0;
+    mGeneration++;
+    pthread_mutex_unlock(&mLock);
+}
+
+void AddressSorter::probeSource(const struct sockaddr *dst, SourceInfo *src) {
+    struct sockaddr_storage ss;
+    socklen_t len;
+    int s;
+
+    memset(src, 0, sizeof(*src));
+    src->usable = false;
+
+    s = socket(dst->sa_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (s < 0) {
+        return;
+    }
+
+    len = (dst->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) :
+                                         sizeof(struct sockaddr_in);
+    if (connect(s, dst, len)) {
+        // No route to this destination; it is unusable (RFC 6724 rule 1)
+        close(s);
+        return;
+    }
+
+    len = sizeof(ss);
+    if (getsockname(s, (struct sockaddr *) &ss, &len)) {
+        LOGW("getsockname failed (%s)", strerror(errno));
+        close(s);
+        return;
+    }
+    close(s);
+
+    const PolicyEntry *policy;
+
+    src->usable = true;
+    src->family = ss.ss_family;
+    toMapped((struct sockaddr *) &ss, &src->addr, NULL);
+    src->scope = getScope(&src->addr);
+    policy = lookupPolicy(&src->addr);
+    src->label = policy->label;
+    src->precedence = policy->precedence;
+}
+
+void AddressSorter::lookupSource(const struct sockaddr *dst, SourceInfo *src) {
+    struct in6_addr prefix;
+    uint32_t scopeId;
+    unsigned int generation;
+    int prefixLen;
+    int i;
+
+    toMapped(dst, &prefix, &scopeId);
+    prefixLen = (dst->sa_family == AF_INET6) ? PREFIX_LEN_INET6 : 96 + PREFIX_LEN_INET;
+    memset(&prefix.s6_addr[prefixLen / 8], 0, 16 - prefixLen / 8);
+
+    pthread_mutex_lock(&mLock);
+    for (i = 0; i < mCount; i++) {
+        CacheEntry *e = &mCache[i];
+        if (e->family == dst->sa_family && e->scopeId == scopeId &&
+            !memcmp(&e->prefix, &prefix, sizeof(prefix)) &&
+            !strcmp(e->iface, mIface)) {
+            *src = e->src;
+            pthread_mutex_unlock(&mLock);
+            return;
+        }
+    }
+    generation = mGeneration;
+    pthread_mutex_unlock(&mLock);
+
+    /*
+     * Probe without holding the lock; a concurrent lookup for the same
+     * prefix may probe as well and the later insert simply wins.
+     */
+    probeSource(dst, src);
+
+    pthread_mutex_lock(&mLock);
+    if (generation != mGeneration) {
+        // Invalidated while probing; the result may already be stale
+        pthread_mutex_unlock(&mLock);
+        return;
+    }
+    CacheEntry *e = &mCache[mNext];
+    strncpy(e->iface, mIface, sizeof(e->iface));
+    e->family = dst->sa_family;
+    e->prefix = prefix;
+    e->scopeId = scopeId;
+    e->src = *src;
+    mNext = (mNext + 1) % CACHE_SIZE;
+    if (mCount < CACHE_SIZE)
+        mCount++;
+    pthread_mutex_unlock(&mLock);
+}
+
+struct SortElement {
+    struct addrinfo           *ai;
+    int                       order;
+    struct in6_addr           dst;
+    int                       dstScope;
+    int                       dstLabel;
+    int                       dstPrecedence;
+    AddressSorter::SourceInfo src;
+};
+
+/*
+ * RFC 6724 section 6. Rules 3, 4 and 7 need information about
+ * deprecated, home and native-transport addresses that we don't have.
+ */
+static int compareElements(const void *p1, const void *p2) {
+    const SortElement *a = (const SortElement *) p1;
+    const SortElement *b = (const SortElement *) p2;
+
+    // Rule 1: Avoid unusable destinations
+    if (a->src.usable != b->src.usable)
+        return a->src.usable ? -1 : 1;
+
+    // Rule 2: Prefer matching scope
+    bool aMatch = a->src.usable && a->dstScope == a->src.scope;
+    bool bMatch = b->src.usable && b->dstScope == b->src.scope;
+    if (aMatch != bMatch)
+        return aMatch ? -1 : 1;
+
+    // Rule 5: Prefer matching label
+    aMatch = a->src.usable && a->dstLabel == a->src.label;
+    bMatch = b->src.usable && b->dstLabel == b->src.label;
+    if (aMatch != bMatch)
+        return aMatch ? -1 : 1;
+
+    // Rule 6: Prefer higher precedence
+    if (a->dstPrecedence != b->dstPrecedence)
+        return b->dstPrecedence - a->dstPrecedence;
+
+    // Rule 8: Prefer smaller scope
+    if (a->dstScope != b->dstScope)
+        return a->dstScope - b->dstScope;
+
+    // Rule 9: Use longest matching prefix (IPv6 only)
+    if (a->src.usable && b->src.usable &&
+        a->ai->ai_family == AF_INET6 && b->ai->ai_family == AF_INET6) {
+        int aLen = commonPrefixLen(&a->dst, &a->src.addr);
+        int bLen = commonPrefixLen(&b->dst, &b->src.addr);
+        if (aLen != bLen)
+            return bLen - aLen;
+    }
+
+    // Rule 10: Otherwise, leave the order unchanged
+    return a->order - b->order;
+}
+
+void AddressSorter::sort(struct addrinfo **res) {
+    struct addrinfo *ai;
+    int count = 0;
+    int i;
+
+    for (ai = *res; ai; ai = ai->ai_next) {
+        if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
+            return;
+        count++;
+    }
+    if (count < 2)
+        return;
+
+    SortElement *elems = (SortElement *) calloc(count, sizeof(SortElement));
+    if (!elems) {
+        LOGE("Failed to allocate sort elements");
+        return;
+    }
+
+    for (ai = *res, i = 0; ai; ai = ai->ai_next, i++) {
+        const PolicyEntry *policy;
+
+        elems[i].ai = ai;
+        elems[i].order = i;
+        toMapped(ai->ai_addr, &elems[i].dst, NULL);
+        elems[i].dstScope = getScope(&elems[i].dst);
+        policy = lookupPolicy(&elems[i].dst);
+        elems[i].dstLabel = policy->label;
+        elems[i].dstPrecedence = policy->precedence;
+        lookupSource(ai->ai_addr, &elems[i].src);
+    }
+
+    char *canonname = (*res)->ai_canonname;
+    (*res)->ai_canonname = NULL;
+
+    qsort(elems, count, sizeof(SortElement), compareElements);
+
+    // The canonical name belongs on the first entry of the list
+    elems[0].ai->ai_canonname = canonname;
+    for (i = 0; i < count - 1; i++) {
+        elems[i].ai->ai_next = elems[i + 1].ai;
+    }
+    elems[count - 1].ai->ai_next = NULL;
+    *res = elems[0].ai;
+
+    free(elems);
+}
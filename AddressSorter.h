@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _ADDRESS_SORTER_H
+#define _ADDRESS_SORTER_H
+
+#include <pthread.h>
+#include <netinet/in.h>
+#include <net/if.h>
+
+struct addrinfo;
+
+/*
+ * Orders getaddrinfo() results by the RFC 6724 destination address
+ * selection rules. The source address the kernel would pick for each
+ * destination is found by connecting a UDP socket; the outcome is cached
+ * per (default interface, destination prefix) until invalidate() is
+ * called on an address or route change.
+ */
+class AddressSorter {
+public:
+    /* Number of cached (interface, prefix) source selections */
+    static const int CACHE_SIZE = 64;
+
+    struct SourceInfo {
+        bool            usable;
+        int             family;
+        struct in6_addr addr;      // IPv4 sources are stored v4-mapped
+        int             scope;
+        int             label;
+        int             precedence;
+    };
+
+private:
+    static AddressSorter *sInstance;
+
+    struct CacheEntry {
+        char            iface[IFNAMSIZ];
+        int             family;
+        struct in6_addr prefix;
+        uint32_t        scopeId;
+        SourceInfo      src;
+    };
+
+    pthread_mutex_t mLock;
+    char            mIface[IFNAMSIZ];
+    CacheEntry      mCache[CACHE_SIZE];
+    int             mCount;
+    int             mNext;
+    unsigned int    mGeneration;
+
+public:
+    virtual ~AddressSorter();
+
+    static AddressSorter *Instance();
+
+    void setDefaultInterface(const char *iface);
+    void invalidate();
+    void sort(struct addrinfo **res);
+
+private:
+    AddressSorter();
+
+    void lookupSource(const struct sockaddr *dst, SourceInfo *src);
+    static void probeSource(const struct sockaddr *dst, SourceInfo *src);
+};
+
+#endif
@@ -38,18 +38,32 @@ endif
 
 LOCAL_SRC_FILES:=                                      \
                   main.cpp                             \
+                  AddressSorter.cpp                    \
                   CommandListener.cpp                  \
+                  CounterSampler.cpp                   \
                   DnsProxyListener.cpp                 \
+                  DnsQueryLog.cpp                      \
+                  EpollListener.cpp                    \
+                  EventLoop.cpp                        \
+                  ExecArgs.cpp                         \
+                  InterfaceController.cpp              \
+                  InterfaceTable.cpp                   \
                   NetdCommand.cpp                      \
                   NetlinkManager.cpp                   \
                   NetlinkHandler.cpp                   \
+                  NflogHandler.cpp                     \
+                  RouteNetlinkHandler.cpp              \
                   logwrapper.c                         \
                   TetherController.cpp                 \
                   NatController.cpp                    \
                   PppController.cpp                    \
                   PanController.cpp                    \
+                  QuotaController.cpp                  \
                   ThrottleController.cpp               \
-                  ResolverController.cpp
+                  TrafficController.cpp                \
+                  ResolverController.cpp               \
+                  ResponseBuilder.cpp                  \
+                  WorkQueue.cpp
 
 LOCAL_MODULE:= netd
 
@@ -123,4 +137,14 @@ LOCAL_SHARED_LIBRARIES := libcutils
 
 include $(BUILD_EXECUTABLE)
 
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES:=          \
+                  querylogdump.c \
+
+LOCAL_MODULE:= querylogdump
+
+LOCAL_CFLAGS :=
+
+include $(BUILD_HOST_EXECUTABLE)
+
 endif # ifeq ($(BUILD_NETD,true)
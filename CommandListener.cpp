@@ -15,6 +15,9 @@
  */
 
 #include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
@@ -32,15 +35,14 @@
 #include "CommandListener.h"
 #include "ResponseCode.h"
 #include "ThrottleController.h"
+#include "InterfaceTable.h"
+#include "InterfaceController.h"
+#include "CounterSampler.h"
+#include "QuotaController.h"
 
 
 extern "C" int ifc_init(void);
-extern "C" int ifc_get_hwaddr(const char *name, void *ptr);
 extern "C" int ifc_get_info(const char *name, in_addr_t *addr, in_addr_t *mask, unsigned *flags);
-extern "C" int ifc_set_addr(const char *name, in_addr_t addr);
-extern "C" int ifc_set_mask(const char *name, in_addr_t mask);
-extern "C" int ifc_up(const char *name);
-extern "C" int ifc_down(const char *name);
 
 TetherController *CommandListener::sTetherCtrl = NULL;
 NatController *CommandListener::sNatCtrl = NULL;
@@ -49,19 +51,46 @@ PanController *CommandListener::sPanCtrl = NULL;
 SoftapController *CommandListener::sSoftapCtrl = NULL;
 UsbController *CommandListener::sUsbCtrl = NULL;
 ResolverController *CommandListener::sResolverCtrl = NULL;
+TrafficController *CommandListener::sTrafficCtrl = NULL;
+DnsProxyListener *CommandListener::sDnsProxy = NULL;
+NetdCommandCollection *CommandListener::sCommands = NULL;
+BatchCollection *CommandListener::sBatches = NULL;
+pthread_mutex_t CommandListener::sBatchLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t CommandListener::sInterfaceLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t CommandListener::sThrottleLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t CommandListener::sTetherLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t CommandListener::sNatLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t CommandListener::sPppLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t CommandListener::sPanLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t CommandListener::sSoftapLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t CommandListener::sUsbLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t CommandListener::sTrafficLock = PTHREAD_MUTEX_INITIALIZER;
 
 CommandListener::CommandListener() :
-                 FrameworkListener("netd") {
-    registerCmd(new InterfaceCmd());
-    registerCmd(new IpFwdCmd());
-    registerCmd(new TetherCmd());
-    registerCmd(new NatCmd());
-    registerCmd(new ListTtysCmd());
-    registerCmd(new PppdCmd());
-    registerCmd(new PanCmd());
-    registerCmd(new SoftapCmd());
-    registerCmd(new UsbCmd());
-    registerCmd(new ResolverCmd());
+                 EpollListener("netd") {
+    sCommands = new NetdCommandCollection();
+    sBatches = new BatchCollection();
+    mQueue = new WorkQueue("netd", CMD_WORKER_THREADS, CMD_MAX_QUEUED, CMD_MAX_PER_CLIENT);
+    if (mQueue->start()) {
+        LOGE("Unable to start command workers; commands will run inline");
+        mQueue = NULL;
+    }
+
+    registerNetdCmd(new InterfaceCmd());
+    registerNetdCmd(new IpFwdCmd());
+    registerNetdCmd(new TetherCmd());
+    registerNetdCmd(new NatCmd());
+    registerNetdCmd(new ListTtysCmd());
+    registerNetdCmd(new PppdCmd());
+    registerNetdCmd(new PanCmd());
+    registerNetdCmd(new SoftapCmd());
+    registerNetdCmd(new UsbCmd());
+    registerNetdCmd(new ResolverCmd());
+    registerNetdCmd(new BatchCmd());
+    registerNetdCmd(new StatsCmd());
+    registerNetdCmd(new QuotaCmd());
+    registerNetdCmd(new TrafficCmd());
+    registerNetdCmd(new ClientCmd());
 
     if (!sTetherCtrl)
         sTetherCtrl = new TetherController();
@@ -77,710 +106,1558 @@ CommandListener::CommandListener() :
         sUsbCtrl = new UsbController();
     if (!sResolverCtrl)
         sResolverCtrl = new ResolverController();
+    if (!sTrafficCtrl)
+        sTrafficCtrl = new TrafficController();
 }
 
-CommandListener::InterfaceCmd::InterfaceCmd() :
-                 NetdCommand("interface") {
+void CommandListener::registerNetdCmd(NetdCommand *cmd) {
+    cmd->setWorkQueue(mQueue);
+    registerCmd(cmd);
+    sCommands->push_back(cmd);
 }
 
-int CommandListener::InterfaceCmd::runCommand(SocketClient *cli,
-                                                      int argc, char **argv) {
-    if (argc < 2) {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
-        return 0;
-    }
-
-    if (!strcmp(argv[1], "list")) {
-        DIR *d;
-        struct dirent *de;
+NetdCommand *CommandListener::findCommand(const char *name) {
+    NetdCommandCollection::iterator it;
 
-        if (!(d = opendir("/sys/class/net"))) {
-            cli->sendMsg(ResponseCode::OperationFailed, "Failed to open sysfs dir", true);
-            return 0;
+    for (it = sCommands->begin(); it != sCommands->end(); ++it) {
+        if (!strcmp((*it)->getCommand(), name)) {
+            return *it;
         }
+    }
+    return NULL;
+}
 
-        while((de = readdir(d))) {
-            if (de->d_name[0] == '.')
-                continue;
-            cli->sendMsg(ResponseCode::InterfaceListResult, de->d_name, false);
-        }
-        closedir(d);
-        cli->sendMsg(ResponseCode::CommandOkay, "Interface list completed", false);
-        return 0;
-    } else if (!strcmp(argv[1], "readrxcounter")) {
-        if (argc != 3) {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Usage: interface readrxcounter <interface>", false);
-            return 0;
-        }
-        unsigned long rx = 0, tx = 0;
-        if (readInterfaceCounters(argv[2], &rx, &tx)) {
-            cli->sendMsg(ResponseCode::OperationFailed, "Failed to read counters", true);
-            return 0;
-        }
+void CommandListener::onClientClosed(SocketClient *c) {
+    // An unfinished batch goes with the client
+    pthread_mutex_lock(&sBatchLock);
+    Batch *batch = findBatchLocked(c);
+    if (batch) {
+        LOGW("Client closed with %d batched steps uncommitted", batch->numSteps);
+        freeBatchLocked(batch);
+    }
+    pthread_mutex_unlock(&sBatchLock);
+    CounterSampler::Instance()->removeClient(c);
+    NetdCommand::removeClient(c);
+}
 
-        char *msg;
-        asprintf(&msg, "%lu", rx);
-        cli->sendMsg(ResponseCode::InterfaceRxCounterResult, msg, false);
-        free(msg);
+/*
+ * Dispatches commands itself rather than leaving it to EpollListener, so
+ * that a command may start with a numeric tag:
+ *
+ *   <tag> <command> [<args> ...]
+ *
+ * Replies to a tagged command carry the tag after the response code.
+ */
+void CommandListener::dispatchCommand(SocketClient *cli, char *data) {
+    char *argv[EpollListener::CMD_ARGS_MAX + 1];
+    int argc = parseArgs(cli, data, argv);
+    int tag = -1;
 
-        return 0;
-    } else if (!strcmp(argv[1], "readtxcounter")) {
-        if (argc != 3) {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Usage: interface readtxcounter <interface>", false);
-            return 0;
-        }
-        unsigned long rx = 0, tx = 0;
-        if (readInterfaceCounters(argv[2], &rx, &tx)) {
-            cli->sendMsg(ResponseCode::OperationFailed, "Failed to read counters", true);
-            return 0;
-        }
+    if (argc < 0) {
+        return;
+    }
 
-        char *msg = NULL;
-        asprintf(&msg, "%lu", tx);
-        cli->sendMsg(ResponseCode::InterfaceTxCounterResult, msg, false);
-        free(msg);
-        return 0;
-    } else if (!strcmp(argv[1], "getthrottle")) {
-        if (argc != 4 || (argc == 4 && (strcmp(argv[3], "rx") && (strcmp(argv[3], "tx"))))) {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Usage: interface getthrottle <interface> <rx|tx>", false);
-            return 0;
-        }
-        int val = 0;
-        int rc = 0;
-        int voldRc = ResponseCode::InterfaceRxThrottleResult;
+    // A leading number is the client's tag for the command
+    if (argc && isdigit((unsigned char) argv[0][0])) {
+        char *end;
+        unsigned long n = strtoul(argv[0], &end, 10);
 
-        if (!strcmp(argv[3], "rx")) {
-            rc = ThrottleController::getInterfaceRxThrottle(argv[2], &val);
-        } else {
-            rc = ThrottleController::getInterfaceTxThrottle(argv[2], &val);
-            voldRc = ResponseCode::InterfaceTxThrottleResult;
-        }
-        if (rc) {
-            cli->sendMsg(ResponseCode::OperationFailed, "Failed to get throttle", true);
-        } else {
-            char *msg = NULL;
-            asprintf(&msg, "%u", val);
-            cli->sendMsg(voldRc, msg, false);
-            free(msg);
-            return 0;
+        if (*end || n >= INT_MAX) {
+            NetdCommand::sendMsg(cli, ResponseCode::CommandSyntaxError, "Invalid tag", false);
+            goto out;
         }
-        return 0;
-    } else if (!strcmp(argv[1], "setthrottle")) {
-        if (argc != 5) {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Usage: interface setthrottle <interface> <rx_kbps> <tx_kbps>", false);
-            return 0;
-        }
-        if (ThrottleController::setInterfaceThrottle(argv[2], atoi(argv[3]), atoi(argv[4]))) {
-            cli->sendMsg(ResponseCode::OperationFailed, "Failed to set throttle", true);
-        } else {
-            cli->sendMsg(ResponseCode::CommandOkay, "Interface throttling set", false);
-        }
-        return 0;
+        tag = (int) n;
+        free(argv[0]);
+        memmove(argv, argv + 1, argc * sizeof(argv[0]));
+        argc--;
+    }
+
+    NetdCommand::setCurrentTag(tag);
+    if (!argc) {
+        NetdCommand::sendMsg(cli, ResponseCode::CommandSyntaxError, "Missing command", false);
     } else {
-        /*
-         * These commands take a minimum of 3 arguments
-         */
-        if (argc < 3) {
-            cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
-            return 0;
+        NetdCommand *cmd = findCommand(argv[0]);
+
+        if (!cmd) {
+            NetdCommand::sendMsg(cli, ResponseCode::CommandSyntaxError,
+                                 "Command not recognized", false);
+        } else if (cmd->hasSubCommands()) {
+            NetdCommand::setCurrentTag(-1);
+            cmd->dispatch(cli, tag, argc, argv);
+        } else {
+            NetdCommand::beginReply(cli);
+            if (cmd->runCommand(cli, argc, argv)) {
+                LOGW("Handler '%s' error (%s)", cmd->getCommand(), strerror(errno));
+            }
+            NetdCommand::endReply();
         }
-        if (!strcmp(argv[1], "getcfg")) {
-            struct in_addr addr, mask;
-            unsigned char hwaddr[6];
-            unsigned flags = 0;
+    }
+    NetdCommand::setCurrentTag(-1);
 
-            ifc_init();
-            memset(hwaddr, 0, sizeof(hwaddr));
+out:
+    for (int i = 0; i < argc; i++) {
+        free(argv[i]);
+    }
+}
 
-            if (ifc_get_info(argv[2], &addr.s_addr, &mask.s_addr, &flags)) {
-                cli->sendMsg(ResponseCode::OperationFailed, "Interface not found", true);
-                return 0;
-            }
+const SubCommand CommandListener::InterfaceCmd::sSubCmds[] = {
+    { "getcfg", NULL, 0, 3, -1, "s", getCfg,
+      "Usage: interface getcfg <interface|all> [<interface> ...]", NULL, NULL },
+    { "getthrottle", NULL, 0, 4, 4, "ss", getThrottle,
+      "Usage: interface getthrottle <interface> <rx|tx>", NULL, NULL },
+    { "list", NULL, 0, 2, 2, NULL, list,
+      "Usage: interface list", NULL, NULL },
+    { "rates", NULL, 0, 3, 4, "sd", rates,
+      "Usage: interface rates <interface> [<window_secs>]", NULL, NULL },
+    { "readcounters", NULL, 0, 3, 3, "s", readCounters,
+      "Usage: interface readcounters <interface>", NULL, NULL },
+    { "readrxcounter", NULL, 0, 3, 3, "s", readRxCounter,
+      "Usage: interface readrxcounter <interface>", NULL, NULL },
+    { "readtxcounter", NULL, 0, 3, 3, "s", readTxCounter,
+      "Usage: interface readtxcounter <interface>", NULL, NULL },
+    { "setcfg", NULL, 0, 5, -1, "siss", setCfg,
+      "Usage: interface setcfg <interface> <addr> <mask|prefixlen> [flags] [mtu <mtu>]",
+      "Interface configuration set", "Failed to set interface configuration",
+      saveCfg, undoSetCfg, 0, NULL, NULL, &sInterfaceLock },
+    { "setsampling", NULL, 0, 3, 3, "d", setSampling,
+      "Usage: interface setsampling <interval_ms>",
+      "Sampling interval set", "Failed to set sampling interval" },
+    { "setthrottle", NULL, 0, 5, 5, "sdd", setThrottle,
+      "Usage: interface setthrottle <interface> <rx_kbps> <tx_kbps>",
+      "Interface throttling set", "Failed to set throttle",
+      saveThrottle, undoSetThrottle, 0, NULL, NULL, &sThrottleLock },
+    { "subscribe", NULL, 0, 5, 9, "s", subscribe,
+      "Usage: interface subscribe <interface> (period <secs>|bytes <n>|rate <bytes_per_sec>) ...",
+      "Subscribed", "Failed to subscribe" },
+    { "unsubscribe", NULL, 0, 3, 3, "s", unsubscribe,
+      "Usage: interface unsubscribe <interface>",
+      "Unsubscribed", "Failed to unsubscribe" },
+};
 
-            if (ifc_get_hwaddr(argv[2], (void *) hwaddr)) {
-                LOGW("Failed to retrieve HW addr for %s (%s)", argv[2], strerror(errno));
-            }
+/*
+ * Only the subcommands that change an interface take a lock, each its own
+ * controller's. The rest are answered from InterfaceTable, CounterSampler
+ * or ThrottleController memory, under those classes' own locks, so they
+ * never wait behind a slow setcfg or setthrottle.
+ */
+CommandListener::InterfaceCmd::InterfaceCmd() :
+                 NetdCommand("interface", sSubCmds, ARRAY_SIZE(sSubCmds), NULL) {
+}
+
+int CommandListener::InterfaceCmd::list(SocketClient *cli, int argc, char **argv) {
+    InterfaceEntry *entries;
+    int n = InterfaceTable::Instance()->getAll(&entries);
+
+    if (n < 0) {
+        sendMsg(cli, ResponseCode::OperationFailed, "Failed to list interfaces", true);
+        return 0;
+    }
 
-            char *addr_s = strdup(inet_ntoa(addr));
-            char *mask_s = strdup(inet_ntoa(mask));
-            const char *updown, *brdcst, *loopbk, *ppp, *running, *multi;
+    for (int i = 0; i < n; i++) {
+        sendMsg(cli, ResponseCode::InterfaceListResult, entries[i].name, false);
+    }
+    free(entries);
+    sendMsg(cli, ResponseCode::CommandOkay, "Interface list completed", false);
+    return 0;
+}
 
-            updown =  (flags & IFF_UP)           ? "up" : "down";
-            brdcst =  (flags & IFF_BROADCAST)    ? " broadcast" : "";
-            loopbk =  (flags & IFF_LOOPBACK)     ? " loopback" : "";
-            ppp =     (flags & IFF_POINTOPOINT)  ? " point-to-point" : "";
-            running = (flags & IFF_RUNNING)      ? " running" : "";
-            multi =   (flags & IFF_MULTICAST)    ? " multicast" : "";
+int CommandListener::InterfaceCmd::readCounters(SocketClient *cli, int argc, char **argv) {
+    InterfaceStats stats;
 
-            char *flag_s;
+    if (InterfaceTable::Instance()->readStats(argv[2], &stats)) {
+        sendMsg(cli, ResponseCode::OperationFailed, "Failed to read counters", true);
+        return 0;
+    }
 
-            asprintf(&flag_s, "[%s%s%s%s%s%s]", updown, brdcst, loopbk, ppp, running, multi);
+    char *msg = NULL;
+    asprintf(&msg, "%llu %llu %llu %llu",
+             (unsigned long long) stats.rxBytes, (unsigned long long) stats.rxPackets,
+             (unsigned long long) stats.txBytes, (unsigned long long) stats.txPackets);
+    sendMsg(cli, ResponseCode::InterfaceCountersResult, msg, false);
+    free(msg);
+    return 0;
+}
 
-            char *msg = NULL;
-            asprintf(&msg, "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x %s %s %s",
-                     hwaddr[0], hwaddr[1], hwaddr[2], hwaddr[3], hwaddr[4], hwaddr[5],
-                     addr_s, mask_s, flag_s);
+int CommandListener::InterfaceCmd::rates(SocketClient *cli, int argc, char **argv) {
+    InterfaceRates r;
+    int windowSecs = SAMPLER_DEFAULT_WINDOW_SECS;
 
-            cli->sendMsg(ResponseCode::InterfaceGetCfgResult, msg, false);
+    if (argc > 3) {
+        char *end;
+        long val;
 
-            free(addr_s);
-            free(mask_s);
-            free(flag_s);
-            free(msg);
+        errno = 0;
+        val = strtol(argv[3], &end, 10);
+        if (*end != '\0' || val <= 0) {
+            sendMsg(cli, ResponseCode::CommandParameterError, "Invalid window", false);
             return 0;
-        } else if (!strcmp(argv[1], "setcfg")) {
-            // arglist: iface addr mask [flags]
-            if (argc < 5) {
-                cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
-                return 0;
-            }
-            LOGD("Setting iface cfg");
-
-            struct in_addr addr, mask;
-            unsigned flags = 0;
+        }
+        // getRates() cuts it down to the history; this only keeps it an int
+        windowSecs = (errno || val > INT_MAX / 1000) ? INT_MAX / 1000 : (int) val;
+    }
 
-            if (!inet_aton(argv[3], &addr)) {
-                cli->sendMsg(ResponseCode::CommandParameterError, "Invalid address", false);
-                return 0;
-            }
+    if (CounterSampler::Instance()->getRates(argv[2], windowSecs, &r)) {
+        sendMsg(cli, ResponseCode::OperationFailed, "Failed to get rates", true);
+        return 0;
+    }
 
-            if (!inet_aton(argv[4], &mask)) {
-                cli->sendMsg(ResponseCode::CommandParameterError, "Invalid netmask", false);
-                return 0;
-            }
+    char *msg = NULL;
+    asprintf(&msg, "%llu %llu %llu %llu %llu", (unsigned long long) r.windowMs,
+             (unsigned long long) r.rxBytesPerSec, (unsigned long long) r.rxPacketsPerSec,
+             (unsigned long long) r.txBytesPerSec, (unsigned long long) r.txPacketsPerSec);
+    sendMsg(cli, ResponseCode::InterfaceRatesResult, msg, false);
+    free(msg);
+    return 0;
+}
 
-            ifc_init();
-            if (ifc_set_addr(argv[2], addr.s_addr)) {
-                cli->sendMsg(ResponseCode::OperationFailed, "Failed to set address", true);
-                return 0;
-            }
+int CommandListener::InterfaceCmd::setSampling(SocketClient *cli, int argc, char **argv) {
+    return CounterSampler::Instance()->setInterval(atoi(argv[2]));
+}
 
-            if (ifc_set_mask(argv[2], mask.s_addr)) {
-                cli->sendMsg(ResponseCode::OperationFailed, "Failed to set netmask", true);
-                return 0;
-            }
+int CommandListener::InterfaceCmd::subscribe(SocketClient *cli, int argc, char **argv) {
+    int periodSecs = 0;
+    uint64_t bytesLimit = 0, rateLimit = 0;
+    char *end;
 
-            /* Process flags */
-            /* read from "[XX" arg to "YY]" arg */
-            bool bStarted = false;
-            for (int i = 5; i < argc; i++) {
-                char *flag = argv[i];
-                if (!bStarted) {
-                    if (*flag == '[') {
-                        flag++;
-                        bStarted = true;
-                    } else {
-                        continue;
-                    }
-                }
-                int len = strlen(flag);
-                if (flag[len-1] == ']') {
-                    i = argc;  // stop after this loop
-                    flag[len-1] = 0;
-                }
-                if (!strcmp(flag, "up")) {
-                    LOGD("Trying to bring up %s", argv[2]);
-                    if (ifc_up(argv[2])) {
-                        LOGE("Error upping interface");
-                        cli->sendMsg(ResponseCode::OperationFailed, "Failed to up interface", true);
-                        return 0;
-                    }
-                } else if (!strcmp(flag, "down")) {
-                    LOGD("Trying to bring down %s", argv[2]);
-                    if (ifc_down(argv[2])) {
-                        LOGE("Error downing interface");
-                        cli->sendMsg(ResponseCode::OperationFailed, "Failed to down interface", true);
-                        return 0;
-                    }
-                } else if (!strcmp(flag, "broadcast")) {
-                    LOGD("broadcast flag ignored");
-                } else if (!strcmp(flag, "multicast")) {
-                    LOGD("multicast flag ignored");
-                } else {
-                    cli->sendMsg(ResponseCode::CommandParameterError, "Flag unsupported", false);
-                    return 0;
-                }
-            }
-            cli->sendMsg(ResponseCode::CommandOkay, "Interface configuration set", false);
-            return 0;
+    for (int i = 3; i < argc; i += 2) {
+        if (i + 1 == argc) {
+            errno = EINVAL;
+            return -1;
+        }
+        unsigned long long val = strtoull(argv[i + 1], &end, 10);
+        if (*argv[i + 1] == '\0' || *end != '\0') {
+            errno = EINVAL;
+            return -1;
+        }
+        if (!strcmp(argv[i], "period")) {
+            periodSecs = (int) val;
+        } else if (!strcmp(argv[i], "bytes")) {
+            bytesLimit = val;
+        } else if (!strcmp(argv[i], "rate")) {
+            rateLimit = val;
         } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown interface cmd", false);
-            return 0;
+            errno = EINVAL;
+            return -1;
         }
     }
-    return 0;
+    return CounterSampler::Instance()->subscribe(cli, argv[2], periodSecs, bytesLimit,
+                                                 rateLimit);
 }
 
-CommandListener::ListTtysCmd::ListTtysCmd() :
-                 NetdCommand("list_ttys") {
+int CommandListener::InterfaceCmd::unsubscribe(SocketClient *cli, int argc, char **argv) {
+    return CounterSampler::Instance()->unsubscribe(cli, argv[2]);
 }
 
-int CommandListener::ListTtysCmd::runCommand(SocketClient *cli,
-                                             int argc, char **argv) {
-    TtyCollection *tlist = sPppCtrl->getTtyList();
-    TtyCollection::iterator it;
+/*
+ * The single-counter forms keep their old behaviour of reporting zero for
+ * an interface that doesn't exist (yet).
+ */
+int CommandListener::InterfaceCmd::readRxCounter(SocketClient *cli, int argc, char **argv) {
+    InterfaceStats stats;
 
-    for (it = tlist->begin(); it != tlist->end(); ++it) {
-        cli->sendMsg(ResponseCode::TtyListResult, *it, false);
+    memset(&stats, 0, sizeof(stats));
+    if (InterfaceTable::Instance()->readStats(argv[2], &stats) && errno != ENODEV) {
+        sendMsg(cli, ResponseCode::OperationFailed, "Failed to read counters", true);
+        return 0;
     }
 
-    cli->sendMsg(ResponseCode::CommandOkay, "Ttys listed.", false);
-    return 0;
-}
+    char *msg = NULL;
+    asprintf(&msg, "%llu", (unsigned long long) stats.rxBytes);
+    sendMsg(cli, ResponseCode::InterfaceRxCounterResult, msg, false);
+    free(msg);
 
-CommandListener::IpFwdCmd::IpFwdCmd() :
-                 NetdCommand("ipfwd") {
+    return 0;
 }
 
-int CommandListener::IpFwdCmd::runCommand(SocketClient *cli,
-                                                      int argc, char **argv) {
-    int rc = 0;
+int CommandListener::InterfaceCmd::readTxCounter(SocketClient *cli, int argc, char **argv) {
+    InterfaceStats stats;
 
-    if (argc < 2) {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
+    memset(&stats, 0, sizeof(stats));
+    if (InterfaceTable::Instance()->readStats(argv[2], &stats) && errno != ENODEV) {
+        sendMsg(cli, ResponseCode::OperationFailed, "Failed to read counters", true);
         return 0;
     }
 
-    if (!strcmp(argv[1], "status")) {
-        char *tmp = NULL;
+    char *msg = NULL;
+    asprintf(&msg, "%llu", (unsigned long long) stats.txBytes);
+    sendMsg(cli, ResponseCode::InterfaceTxCounterResult, msg, false);
+    free(msg);
+    return 0;
+}
 
-        asprintf(&tmp, "Forwarding %s", (sTetherCtrl->getIpFwdEnabled() ? "enabled" : "disabled"));
-        cli->sendMsg(ResponseCode::IpFwdStatusResult, tmp, false);
-        free(tmp);
-        return 0;
-    } else if (!strcmp(argv[1], "enable")) {
-        rc = sTetherCtrl->setIpFwdEnabled(true);
-    } else if (!strcmp(argv[1], "disable")) {
-        rc = sTetherCtrl->setIpFwdEnabled(false);
-    } else {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown ipfwd cmd", false);
+int CommandListener::InterfaceCmd::getThrottle(SocketClient *cli, int argc, char **argv) {
+    if (strcmp(argv[3], "rx") && strcmp(argv[3], "tx")) {
+        sendMsg(cli, ResponseCode::CommandSyntaxError,
+                "Usage: interface getthrottle <interface> <rx|tx>", false);
         return 0;
     }
+    int val = 0;
+    int rc = 0;
+    int voldRc = ResponseCode::InterfaceRxThrottleResult;
 
-    if (!rc) {
-        cli->sendMsg(ResponseCode::CommandOkay, "ipfwd operation succeeded", false);
+    if (!strcmp(argv[3], "rx")) {
+        rc = ThrottleController::getInterfaceRxThrottle(argv[2], &val);
     } else {
-        cli->sendMsg(ResponseCode::OperationFailed, "ipfwd operation failed", true);
+        rc = ThrottleController::getInterfaceTxThrottle(argv[2], &val);
+        voldRc = ResponseCode::InterfaceTxThrottleResult;
+    }
+    if (rc) {
+        sendMsg(cli, ResponseCode::OperationFailed, "Failed to get throttle", true);
+    } else {
+        char *msg = NULL;
+        asprintf(&msg, "%u", val);
+        sendMsg(cli, voldRc, msg, false);
+        free(msg);
     }
-
     return 0;
 }
 
-CommandListener::TetherCmd::TetherCmd() :
-                 NetdCommand("tether") {
+int CommandListener::InterfaceCmd::setThrottle(SocketClient *cli, int argc, char **argv) {
+    return ThrottleController::setInterfaceThrottle(argv[2], atoi(argv[3]), atoi(argv[4]));
 }
 
-int CommandListener::TetherCmd::runCommand(SocketClient *cli,
-                                                      int argc, char **argv) {
-    int rc = 0;
-
-    if (argc < 2) {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
-        return 0;
+/*
+ * "<hwaddr> <addr> <mask> [<flags>]" for an interface, reporting its first
+ * IPv4 address as SIOCGIFADDR would.
+ */
+static void formatInterfaceCfg(const InterfaceEntry *entry, char *buf, size_t len) {
+    struct in_addr addr, mask;
+    unsigned flags = entry->flags;
+    const unsigned char *hwaddr = entry->hwaddr;
+
+    addr.s_addr = mask.s_addr = 0;
+    for (int i = 0; i < entry->numAddrs; i++) {
+        if (entry->addrs[i].family == AF_INET) {
+            int prefixLen = entry->addrs[i].prefixLen;
+            memcpy(&addr.s_addr, entry->addrs[i].addr, sizeof(addr.s_addr));
+            mask.s_addr = prefixLen ? htonl(~0U << (32 - prefixLen)) : 0;
+            break;
+        }
     }
 
-    if (!strcmp(argv[1], "stop")) {
-        rc = sTetherCtrl->stopTethering();
-    } else if (!strcmp(argv[1], "status")) {
-        char *tmp = NULL;
+    char addr_s[INET_ADDRSTRLEN];
+    char mask_s[INET_ADDRSTRLEN];
+    const char *updown, *brdcst, *loopbk, *ppp, *running, *multi;
 
-        asprintf(&tmp, "Tethering services %s",
-                 (sTetherCtrl->isTetheringStarted() ? "started" : "stopped"));
-        cli->sendMsg(ResponseCode::TetherStatusResult, tmp, false);
-        free(tmp);
-        return 0;
-    } else {
-        /*
-         * These commands take a minimum of 4 arguments
-         */
-        if (argc < 4) {
-            cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
+    inet_ntop(AF_INET, &addr, addr_s, sizeof(addr_s));
+    inet_ntop(AF_INET, &mask, mask_s, sizeof(mask_s));
+
+    updown =  (flags & IFF_UP)           ? "up" : "down";
+    brdcst =  (flags & IFF_BROADCAST)    ? " broadcast" : "";
+    loopbk =  (flags & IFF_LOOPBACK)     ? " loopback" : "";
+    ppp =     (flags & IFF_POINTOPOINT)  ? " point-to-point" : "";
+    running = (flags & IFF_RUNNING)      ? " running" : "";
+    multi =   (flags & IFF_MULTICAST)    ? " multicast" : "";
+
+    snprintf(buf, len, "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x %s %s [%s%s%s%s%s%s]",
+             hwaddr[0], hwaddr[1], hwaddr[2], hwaddr[3], hwaddr[4], hwaddr[5],
+             addr_s, mask_s, updown, brdcst, loopbk, ppp, running, multi);
+}
+
+/*
+ * "interface getcfg <interface>" answers with a single InterfaceGetCfgResult.
+ * "interface getcfg all" and "interface getcfg <if1> <if2> ..." answer with
+ * one "<interface> <cfg>" InterfaceGetCfgListResult line per interface, all
+ * sent in one write.
+ */
+int CommandListener::InterfaceCmd::getCfg(SocketClient *cli, int argc, char **argv) {
+    char cfg[128];
+
+    if (argc == 3 && strcmp(argv[2], "all")) {
+        InterfaceEntry entry;
+
+        if (InterfaceTable::Instance()->get(argv[2], &entry)) {
+            sendMsg(cli, ResponseCode::OperationFailed, "Interface not found", true);
             return 0;
         }
+        formatInterfaceCfg(&entry, cfg, sizeof(cfg));
+        sendMsg(cli, ResponseCode::InterfaceGetCfgResult, cfg, false);
+        return 0;
+    }
 
-        if (!strcmp(argv[1], "start")) {
-            if (argc % 2 == 1) {
-                cli->sendMsg(ResponseCode::CommandSyntaxError, "Bad number of arguments", false);
-                return 0;
-            }
+    InterfaceEntry *entries;
+    int n = InterfaceTable::Instance()->getAll(&entries);
+    if (n < 0) {
+        sendMsg(cli, ResponseCode::OperationFailed, "Failed to read interfaces", true);
+        return 0;
+    }
 
-            int num_addrs = argc - 2;
-            int arg_index = 2;
-            int array_index = 0;
-            in_addr *addrs = (in_addr *)malloc(sizeof(in_addr) * num_addrs);
-            while (array_index < num_addrs) {
-                if (!inet_aton(argv[arg_index++], &(addrs[array_index++]))) {
-                    cli->sendMsg(ResponseCode::CommandParameterError, "Invalid address", false);
-                    free(addrs);
-                    return 0;
-                }
-            }
-            rc = sTetherCtrl->startTethering(num_addrs, addrs);
-            free(addrs);
-        } else if (!strcmp(argv[1], "interface")) {
-            if (!strcmp(argv[2], "add")) {
-                rc = sTetherCtrl->tetherInterface(argv[3]);
-            } else if (!strcmp(argv[2], "remove")) {
-                rc = sTetherCtrl->untetherInterface(argv[3]);
-            } else if (!strcmp(argv[2], "list")) {
-                InterfaceCollection *ilist = sTetherCtrl->getTetheredInterfaceList();
-                InterfaceCollection::iterator it;
-
-                for (it = ilist->begin(); it != ilist->end(); ++it) {
-                    cli->sendMsg(ResponseCode::TetherInterfaceListResult, *it, false);
-                }
-            } else {
-                cli->sendMsg(ResponseCode::CommandParameterError,
-                             "Unknown tether interface operation", false);
-                return 0;
-            }
-        } else if (!strcmp(argv[1], "dns")) {
-            if (!strcmp(argv[2], "set")) {
-                rc = sTetherCtrl->setDnsForwarders(&argv[3], argc - 3);
-            } else if (!strcmp(argv[2], "list")) {
-                NetAddressCollection *dlist = sTetherCtrl->getDnsForwarders();
-                NetAddressCollection::iterator it;
-
-                for (it = dlist->begin(); it != dlist->end(); ++it) {
-                    cli->sendMsg(ResponseCode::TetherDnsFwdTgtListResult, inet_ntoa(*it), false);
-                }
-            } else {
-                cli->sendMsg(ResponseCode::CommandParameterError,
-                             "Unknown tether interface operation", false);
+    // Listed interfaces come back in the order asked for
+    bool all = (argc == 3);
+    int count = all ? n : argc - 2;
+    for (int i = 0; i < count; i++) {
+        const InterfaceEntry *entry = all ? &entries[i] : NULL;
+
+        if (!all) {
+            int j;
+            for (j = 0; j < n && strcmp(entries[j].name, argv[i + 2]); j++)
+                ;
+            if (j == n) {
+                free(entries);
+                errno = ENODEV;
+                sendMsg(cli, ResponseCode::OperationFailed, "Interface not found", true);
                 return 0;
             }
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown tether cmd", false);
-            return 0;
+            entry = &entries[j];
         }
-    }
 
-    if (!rc) {
-        cli->sendMsg(ResponseCode::CommandOkay, "Tether operation succeeded", false);
-    } else {
-        cli->sendMsg(ResponseCode::OperationFailed, "Tether operation failed", true);
+        char line[IFNAMSIZ + sizeof(cfg)];
+        formatInterfaceCfg(entry, cfg, sizeof(cfg));
+        snprintf(line, sizeof(line), "%s %s", entry->name, cfg);
+        sendMsg(cli, ResponseCode::InterfaceGetCfgListResult, line, false);
     }
+    free(entries);
 
+    sendMsg(cli, ResponseCode::CommandOkay, "Interface configuration listed", false);
     return 0;
 }
 
-CommandListener::NatCmd::NatCmd() :
-                 NetdCommand("nat") {
-}
-
-int CommandListener::NatCmd::runCommand(SocketClient *cli,
-                                                      int argc, char **argv) {
-    int rc = 0;
-
-    if (argc < 3) {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
-        return 0;
-    }
-
-    if (!strcmp(argv[1], "enable")) {
-        rc = sNatCtrl->enableNat(argv[2], argv[3]);
-    } else if (!strcmp(argv[1], "disable")) {
-        rc = sNatCtrl->disableNat(argv[2], argv[3]);
+/*
+ * Parses "<addr> <mask>" where the mask is dotted IPv4 or a prefix length.
+ * 0.0.0.0 clears the interface's IPv4 address.
+ */
+static int parseInterfaceAddress(const char *addr, const char *mask, InterfaceConfig *cfg) {
+    struct in_addr m;
+    char *end;
+
+    if (inet_pton(AF_INET, addr, cfg->addr) > 0) {
+        cfg->family = AF_INET;
+    } else if (inet_pton(AF_INET6, addr, cfg->addr) > 0) {
+        cfg->family = AF_INET6;
     } else {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown nat cmd", false);
-        return 0;
+        errno = EINVAL;
+        return -1;
     }
 
-    if (!rc) {
-        cli->sendMsg(ResponseCode::CommandOkay, "Nat operation succeeded", false);
+    int maxLen = (cfg->family == AF_INET) ? 32 : 128;
+    if (cfg->family == AF_INET && strchr(mask, '.') && inet_aton(mask, &m)) {
+        uint32_t bits = ntohl(m.s_addr);
+        cfg->prefixLen = 0;
+        while (bits & 0x80000000) {
+            cfg->prefixLen++;
+            bits <<= 1;
+        }
+        if (bits) {
+            LOGE("Netmask %s is not contiguous", mask);
+            errno = EINVAL;
+            return -1;
+        }
     } else {
-        cli->sendMsg(ResponseCode::OperationFailed, "Nat operation failed", true);
+        cfg->prefixLen = strtol(mask, &end, 10);
+        if (*mask == '\0' || *end != '\0' || cfg->prefixLen < 0 ||
+            cfg->prefixLen > maxLen) {
+            errno = EINVAL;
+            return -1;
+        }
     }
-
     return 0;
 }
 
-CommandListener::PppdCmd::PppdCmd() :
-                 NetdCommand("pppd") {
-}
+int CommandListener::InterfaceCmd::setCfg(SocketClient *cli, int argc, char **argv) {
+    // arglist: iface addr mask [flags] [mtu <mtu>]
+    LOGD("Setting iface cfg");
 
-int CommandListener::PppdCmd::runCommand(SocketClient *cli,
-                                                      int argc, char **argv) {
-    int rc = 0;
+    InterfaceConfig cfg;
 
-    if (argc < 3) {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
-        return 0;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.up = -1;
+    if (parseInterfaceAddress(argv[3], argv[4], &cfg)) {
+        LOGE("Bad address %s/%s for %s", argv[3], argv[4], argv[2]);
+        return -1;
     }
 
-    if (!strcmp(argv[1], "attach")) {
-        struct in_addr l, r, dns1, dns2;
-
-        memset(&dns1, sizeof(struct in_addr), 0);
-        memset(&dns2, sizeof(struct in_addr), 0);
-
-        if (!inet_aton(argv[3], &l)) {
-            cli->sendMsg(ResponseCode::CommandParameterError, "Invalid local address", false);
-            return 0;
-        }
-        if (!inet_aton(argv[4], &r)) {
-            cli->sendMsg(ResponseCode::CommandParameterError, "Invalid remote address", false);
-            return 0;
+    /* Process flags */
+    /* read from "[XX" arg to "YY]" arg */
+    bool bStarted = false;
+    bool bDone = false;
+    for (int i = 5; i < argc; i++) {
+        char *flag = argv[i];
+        if (!bStarted || bDone) {
+            if (*flag == '[' && !bStarted) {
+                flag++;
+                bStarted = true;
+            } else {
+                if (!strcmp(flag, "mtu") && i + 1 < argc) {
+                    cfg.mtu = atoi(argv[++i]);
+                }
+                continue;
+            }
         }
-        if ((argc > 3) && (!inet_aton(argv[5], &dns1))) {
-            cli->sendMsg(ResponseCode::CommandParameterError, "Invalid dns1 address", false);
-            return 0;
+        int len = strlen(flag);
+        if (len && flag[len-1] == ']') {
+            bDone = true;
+            flag[len-1] = 0;
         }
-        if ((argc > 4) && (!inet_aton(argv[6], &dns2))) {
-            cli->sendMsg(ResponseCode::CommandParameterError, "Invalid dns2 address", false);
-            return 0;
+        if (!strcmp(flag, "up")) {
+            cfg.up = 1;
+        } else if (!strcmp(flag, "down")) {
+            cfg.up = 0;
+        } else if (!strcmp(flag, "broadcast")) {
+            LOGD("broadcast flag ignored");
+        } else if (!strcmp(flag, "multicast")) {
+            LOGD("multicast flag ignored");
+        } else if (*flag) {
+            LOGE("Flag '%s' unsupported", flag);
+            errno = EINVAL;
+            return -1;
         }
-        rc = sPppCtrl->attachPppd(argv[2], l, r, dns1, dns2);
-    } else if (!strcmp(argv[1], "detach")) {
-        rc = sPppCtrl->detachPppd(argv[2]);
-    } else {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown pppd cmd", false);
-        return 0;
     }
 
-    if (!rc) {
-        cli->sendMsg(ResponseCode::CommandOkay, "Pppd operation succeeded", false);
-    } else {
-        cli->sendMsg(ResponseCode::OperationFailed, "Pppd operation failed", true);
+    if (InterfaceController::setConfig(argv[2], &cfg)) {
+        LOGE("Failed to configure %s (%s)", argv[2], strerror(errno));
+        return -1;
     }
-
     return 0;
 }
 
-CommandListener::PanCmd::PanCmd() :
-                 NetdCommand("pan") {
+/*
+ * What setcfg is about to change: the primary IPv4 address, the link, and
+ * whether an IPv6 address being added was already there.
+ */
+struct SavedInterfaceCfg {
+    InterfaceConfig v4;
+    bool            hadAddr6;
+};
+
+void *CommandListener::InterfaceCmd::saveCfg(int argc, char **argv) {
+    SavedInterfaceCfg *saved = (SavedInterfaceCfg *) calloc(1, sizeof(SavedInterfaceCfg));
+    InterfaceEntry entry;
+    InterfaceConfig cfg;
+
+    if (!saved || InterfaceTable::Instance()->get(argv[2], &entry) ||
+        parseInterfaceAddress(argv[3], argv[4], &cfg)) {
+        free(saved);
+        return NULL;
+    }
+
+    saved->v4.family = AF_INET;
+    saved->v4.up = (entry.flags & IFF_UP) ? 1 : 0;
+    saved->v4.mtu = entry.mtu;
+    bool haveV4 = false;
+    for (int i = 0; i < entry.numAddrs; i++) {
+        InterfaceAddress *a = &entry.addrs[i];
+        if (a->family == AF_INET && !haveV4) {
+            haveV4 = true;
+            memcpy(saved->v4.addr, a->addr, 4);
+            saved->v4.prefixLen = a->prefixLen;
+        } else if (a->family == AF_INET6 && cfg.family == AF_INET6 &&
+                   !memcmp(a->addr, cfg.addr, 16)) {
+            saved->hadAddr6 = true;
+        }
+    }
+    return saved;
 }
 
-int CommandListener::PanCmd::runCommand(SocketClient *cli,
-                                        int argc, char **argv) {
+int CommandListener::InterfaceCmd::undoSetCfg(void *saved, int argc, char **argv) {
+    SavedInterfaceCfg *cfg = (SavedInterfaceCfg *) saved;
+    InterfaceConfig added;
     int rc = 0;
 
-    if (argc < 2) {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Missing argument", false);
-        return 0;
+    if (!parseInterfaceAddress(argv[3], argv[4], &added) && added.family == AF_INET6) {
+        if (!cfg->hadAddr6) {
+            rc = InterfaceController::removeAddress(argv[2], AF_INET6, added.addr,
+                                                    added.prefixLen);
+        }
+        cfg->v4.family = AF_UNSPEC;
     }
+    if (InterfaceController::setConfig(argv[2], &cfg->v4)) {
+        rc = -1;
+    }
+    return rc;
+}
 
-    if (!strcmp(argv[1], "start")) {
-        rc = sPanCtrl->startPan();
-    } else if (!strcmp(argv[1], "stop")) {
-        rc = sPanCtrl->stopPan();
-    } else if (!strcmp(argv[1], "status")) {
-        char *tmp = NULL;
+void *CommandListener::InterfaceCmd::saveThrottle(int argc, char **argv) {
+    int *saved = (int *) malloc(2 * sizeof(int));
 
-        asprintf(&tmp, "Pan services %s",
-                 (sPanCtrl->isPanStarted() ? "started" : "stopped"));
-        cli->sendMsg(ResponseCode::PanStatusResult, tmp, false);
-        free(tmp);
-        return 0;
-    } else {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Unknown pan cmd", false);
-        return 0;
+    if (!saved || ThrottleController::getInterfaceRxThrottle(argv[2], &saved[0]) ||
+        ThrottleController::getInterfaceTxThrottle(argv[2], &saved[1])) {
+        free(saved);
+        return NULL;
     }
+    return saved;
+}
 
-    if (!rc) {
-        cli->sendMsg(ResponseCode::CommandOkay, "Pan operation succeeded", false);
-    } else {
-        cli->sendMsg(ResponseCode::OperationFailed, "Pan operation failed", true);
-    }
+int CommandListener::InterfaceCmd::undoSetThrottle(void *saved, int argc, char **argv) {
+    int *kbps = (int *) saved;
 
-    return 0;
+    return ThrottleController::setInterfaceThrottle(argv[2], kbps[0], kbps[1]);
 }
 
-CommandListener::SoftapCmd::SoftapCmd() :
-                 NetdCommand("softap") {
+/* Queued like the rest, as the PPP lock is held across pppd's fork */
+const SubCommand CommandListener::ListTtysCmd::sSubCmds[] = {
+    { "", NULL, 0, 1, -1, NULL, list, "Usage: list_ttys", NULL, NULL },
+};
+
+CommandListener::ListTtysCmd::ListTtysCmd() :
+                 NetdCommand("list_ttys", sSubCmds, ARRAY_SIZE(sSubCmds), &sPppLock) {
 }
 
-int CommandListener::SoftapCmd::runCommand(SocketClient *cli,
-                                        int argc, char **argv) {
-    int rc = 0, flag = 0;
+int CommandListener::ListTtysCmd::list(SocketClient *cli, int argc, char **argv) {
+    TtyCollection *tlist = sPppCtrl->getTtyList();
+    TtyCollection::iterator it;
 
-    if (argc < 2) {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Softap Missing argument", false);
-        return 0;
+    for (it = tlist->begin(); it != tlist->end(); ++it) {
+        sendMsg(cli, ResponseCode::TtyListResult, *it, false);
     }
 
-    if (!strcmp(argv[1], "start")) {
-        rc = sSoftapCtrl->startDriver(argv[2]);
-    } else if (!strcmp(argv[1], "stop")) {
-        rc = sSoftapCtrl->stopDriver(argv[2]);
-    } else if (!strcmp(argv[1], "startap")) {
-        rc = sSoftapCtrl->startSoftap();
-    } else if (!strcmp(argv[1], "stopap")) {
-        rc = sSoftapCtrl->stopSoftap();
-    } else if (!strcmp(argv[1], "fwreload")) {
-        rc = sSoftapCtrl->fwReloadSoftap(argc, argv);
-    } else if (!strcmp(argv[1], "status")) {
-        char *tmp = NULL;
-
-        asprintf(&tmp, "Softap service %s",
-                 (sSoftapCtrl->isSoftapStarted() ? "started" : "stopped"));
-        cli->sendMsg(ResponseCode::SoftapStatusResult, tmp, false);
-        free(tmp);
-        return 0;
-    } else if (!strcmp(argv[1], "set")) {
-        rc = sSoftapCtrl->setSoftap(argc, argv);
-    } else {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Softap Unknown cmd", false);
-        return 0;
-    }
+    sendMsg(cli, ResponseCode::CommandOkay, "Ttys listed.", false);
+    return 0;
+}
 
-    if (!rc) {
-        cli->sendMsg(ResponseCode::CommandOkay, "Softap operation succeeded", false);
-    } else {
-        cli->sendMsg(ResponseCode::OperationFailed, "Softap operation failed", true);
-    }
+const SubCommand CommandListener::IpFwdCmd::sSubCmds[] = {
+    { "disable", NULL, 0, 2, 2, NULL, disable, "Usage: ipfwd disable",
+      "ipfwd operation succeeded", "ipfwd operation failed",
+      saveEnabled, undoSetEnabled },
+    { "enable", NULL, 0, 2, 2, NULL, enable, "Usage: ipfwd enable",
+      "ipfwd operation succeeded", "ipfwd operation failed",
+      saveEnabled, undoSetEnabled },
+    { "status", NULL, 0, 2, 2, NULL, status, "Usage: ipfwd status", NULL, NULL },
+};
+
+CommandListener::IpFwdCmd::IpFwdCmd() :
+                 NetdCommand("ipfwd", sSubCmds, ARRAY_SIZE(sSubCmds), &sTetherLock) {
+}
+
+int CommandListener::IpFwdCmd::status(SocketClient *cli, int argc, char **argv) {
+    char *tmp = NULL;
 
+    asprintf(&tmp, "Forwarding %s", (sTetherCtrl->getIpFwdEnabled() ? "enabled" : "disabled"));
+    sendMsg(cli, ResponseCode::IpFwdStatusResult, tmp, false);
+    free(tmp);
     return 0;
 }
 
-CommandListener::UsbCmd::UsbCmd() :
-                 NetdCommand("usb") {
+int CommandListener::IpFwdCmd::enable(SocketClient *cli, int argc, char **argv) {
+    return sTetherCtrl->setIpFwdEnabled(true);
 }
 
-int CommandListener::UsbCmd::runCommand(SocketClient *cli, int argc, char **argv) {
-    int rc = 0;
+int CommandListener::IpFwdCmd::disable(SocketClient *cli, int argc, char **argv) {
+    return sTetherCtrl->setIpFwdEnabled(false);
+}
 
-    if (argc < 2) {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Usb Missing argument", false);
-        return 0;
+// A malloc'd copy of an on/off state, for a SubCommandSaver to return
+static void *saveFlag(bool flag) {
+    bool *saved = (bool *) malloc(sizeof(bool));
+
+    if (saved) {
+        *saved = flag;
     }
+    return saved;
+}
 
-    if (!strcmp(argv[1], "startrndis")) {
-        rc = sUsbCtrl->startRNDIS();
-    } else if (!strcmp(argv[1], "stoprndis")) {
-        rc = sUsbCtrl->stopRNDIS();
-    } else if (!strcmp(argv[1], "rndisstatus")) {
-        char *tmp = NULL;
+void *CommandListener::IpFwdCmd::saveEnabled(int argc, char **argv) {
+    return saveFlag(sTetherCtrl->getIpFwdEnabled());
+}
 
-        asprintf(&tmp, "Usb RNDIS %s",
-                (sUsbCtrl->isRNDISStarted() ? "started" : "stopped"));
-        cli->sendMsg(ResponseCode::UsbRNDISStatusResult, tmp, false);
-        free(tmp);
-        return 0;
-    } else {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Usb Unknown cmd", false);
-        return 0;
-    }
+int CommandListener::IpFwdCmd::undoSetEnabled(void *saved, int argc, char **argv) {
+    return sTetherCtrl->setIpFwdEnabled(*(bool *) saved);
+}
 
-    if (!rc) {
-        cli->sendMsg(ResponseCode::CommandOkay, "Usb operation succeeded", false);
-    } else {
-        cli->sendMsg(ResponseCode::OperationFailed, "Softap operation failed", true);
-    }
+const SubCommand CommandListener::TetherCmd::sDnsSubCmds[] = {
+    { "list", NULL, 0, 3, 3, NULL, dnsList, "Usage: tether dns list",
+      "Tether operation succeeded", "Tether operation failed" },
+    { "set", NULL, 0, 4, -1, "a", dnsSet, "Usage: tether dns set <addr> [<addr> ...]",
+      "Tether operation succeeded", "Tether operation failed",
+      saveDnsForwarders, undoDnsSet },
+};
+
+const SubCommand CommandListener::TetherCmd::sInterfaceSubCmds[] = {
+    { "add", NULL, 0, 4, 4, "s", interfaceAdd, "Usage: tether interface add <interface>",
+      "Tether operation succeeded", "Tether operation failed",
+      NULL, undoInterfaceAdd },
+    { "list", NULL, 0, 3, 3, NULL, interfaceList, "Usage: tether interface list",
+      "Tether operation succeeded", "Tether operation failed" },
+    { "remove", NULL, 0, 4, 4, "s", interfaceRemove,
+      "Usage: tether interface remove <interface>",
+      "Tether operation succeeded", "Tether operation failed",
+      NULL, undoInterfaceRemove },
+};
+
+const SubCommand CommandListener::TetherCmd::sSubCmds[] = {
+    { "dns", sDnsSubCmds, ARRAY_SIZE(sDnsSubCmds), 0, 0, NULL, NULL,
+      "Usage: tether dns <set|list> ...", NULL, NULL },
+    { "interface", sInterfaceSubCmds, ARRAY_SIZE(sInterfaceSubCmds), 0, 0, NULL, NULL,
+      "Usage: tether interface <add|remove|list> ...", NULL, NULL },
+    { "start", NULL, 0, 4, -1, "a", start,
+      "Usage: tether start <dhcp_start> <dhcp_end> [<start> <end> ...]",
+      "Tether operation succeeded", "Tether operation failed",
+      saveStarted, undoStart },
+    { "status", NULL, 0, 2, 2, NULL, status, "Usage: tether status", NULL, NULL },
+    { "stop", NULL, 0, 2, 2, NULL, stop, "Usage: tether stop",
+      "Tether operation succeeded", "Tether operation failed" },
+};
 
-    return 0;
+CommandListener::TetherCmd::TetherCmd() :
+                 NetdCommand("tether", sSubCmds, ARRAY_SIZE(sSubCmds), &sTetherLock) {
 }
 
-CommandListener::ResolverCmd::ResolverCmd() :
-        NetdCommand("resolver") {
+int CommandListener::TetherCmd::stop(SocketClient *cli, int argc, char **argv) {
+    return sTetherCtrl->stopTethering();
 }
 
-int CommandListener::ResolverCmd::runCommand(SocketClient *cli, int argc, char **argv) {
-    int rc = 0;
-    struct in_addr addr;
+int CommandListener::TetherCmd::status(SocketClient *cli, int argc, char **argv) {
+    char *tmp = NULL;
 
-    if (argc < 2) {
-        cli->sendMsg(ResponseCode::CommandSyntaxError, "Resolver missing arguments", false);
-        return 0;
+    asprintf(&tmp, "Tethering services %s",
+             (sTetherCtrl->isTetheringStarted() ? "started" : "stopped"));
+    sendMsg(cli, ResponseCode::TetherStatusResult, tmp, false);
+    free(tmp);
+    return 0;
+}
+
+int CommandListener::TetherCmd::start(SocketClient *cli, int argc, char **argv) {
+    // DHCP ranges come in start/end pairs
+    if (argc % 2 == 1) {
+        errno = EINVAL;
+        return -1;
     }
 
-    if (!strcmp(argv[1], "setdefaultif")) { // "resolver setdefaultif <iface>"
-        if (argc == 3) {
-            rc = sResolverCtrl->setDefaultInterface(argv[2]);
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Wrong number of arguments to resolver setdefaultif", false);
-            return 0;
-        }
-    } else if (!strcmp(argv[1], "setifdns")) { // "resolver setifdns <iface> <dns1> <dns2> ..."
-        if (argc >= 4) {
-            rc = sResolverCtrl->setInterfaceDnsServers(argv[2], &argv[3], argc - 3);
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Wrong number of arguments to resolver setifdns", false);
-            return 0;
+    int num_addrs = argc - 2;
+    in_addr *addrs = (in_addr *)malloc(sizeof(in_addr) * num_addrs);
+    for (int i = 0; i < num_addrs; i++) {
+        inet_aton(argv[i + 2], &addrs[i]);
+    }
+    int rc = sTetherCtrl->startTethering(num_addrs, addrs);
+    free(addrs);
+    return rc;
+}
+
+void *CommandListener::TetherCmd::saveStarted(int argc, char **argv) {
+    return saveFlag(sTetherCtrl->isTetheringStarted());
+}
+
+// Leaves alone tethering that was already running before the start
+int CommandListener::TetherCmd::undoStart(void *saved, int argc, char **argv) {
+    return *(bool *) saved ? 0 : sTetherCtrl->stopTethering();
+}
+
+int CommandListener::TetherCmd::interfaceAdd(SocketClient *cli, int argc, char **argv) {
+    return sTetherCtrl->tetherInterface(argv[3]);
+}
+
+int CommandListener::TetherCmd::interfaceRemove(SocketClient *cli, int argc, char **argv) {
+    return sTetherCtrl->untetherInterface(argv[3]);
+}
+
+int CommandListener::TetherCmd::undoInterfaceAdd(void *saved, int argc, char **argv) {
+    return sTetherCtrl->untetherInterface(argv[3]);
+}
+
+int CommandListener::TetherCmd::undoInterfaceRemove(void *saved, int argc, char **argv) {
+    return sTetherCtrl->tetherInterface(argv[3]);
+}
+
+int CommandListener::TetherCmd::interfaceList(SocketClient *cli, int argc, char **argv) {
+    InterfaceCollection *ilist = sTetherCtrl->getTetheredInterfaceList();
+    InterfaceCollection::iterator it;
+
+    for (it = ilist->begin(); it != ilist->end(); ++it) {
+        sendMsg(cli, ResponseCode::TetherInterfaceListResult, *it, false);
+    }
+    return 0;
+}
+
+int CommandListener::TetherCmd::dnsSet(SocketClient *cli, int argc, char **argv) {
+    return sTetherCtrl->setDnsForwarders(&argv[3], argc - 3);
+}
+
+struct SavedDnsForwarders {
+    int            count;
+    struct in_addr addrs[0];
+};
+
+void *CommandListener::TetherCmd::saveDnsForwarders(int argc, char **argv) {
+    NetAddressCollection *dlist = sTetherCtrl->getDnsForwarders();
+    NetAddressCollection::iterator it;
+    int count = 0;
+
+    for (it = dlist->begin(); it != dlist->end(); ++it) {
+        count++;
+    }
+
+    SavedDnsForwarders *saved = (SavedDnsForwarders *)
+            malloc(sizeof(SavedDnsForwarders) + count * sizeof(struct in_addr));
+    if (!saved) {
+        return NULL;
+    }
+    saved->count = 0;
+    for (it = dlist->begin(); it != dlist->end(); ++it) {
+        saved->addrs[saved->count++] = *it;
+    }
+    return saved;
+}
+
+int CommandListener::TetherCmd::undoDnsSet(void *saved, int argc, char **argv) {
+    SavedDnsForwarders *fwds = (SavedDnsForwarders *) saved;
+    char (*strs)[INET_ADDRSTRLEN] = NULL;
+    char **servers = NULL;
+
+    if (fwds->count) {
+        strs = (char (*)[INET_ADDRSTRLEN]) malloc(fwds->count * INET_ADDRSTRLEN);
+        servers = (char **) malloc(fwds->count * sizeof(char *));
+        if (!strs || !servers) {
+            free(strs);
+            free(servers);
+            errno = ENOMEM;
+            return -1;
         }
+    }
+    for (int i = 0; i < fwds->count; i++) {
+        inet_ntop(AF_INET, &fwds->addrs[i], strs[i], INET_ADDRSTRLEN);
+        servers[i] = strs[i];
+    }
+    int rc = sTetherCtrl->setDnsForwarders(servers, fwds->count);
+    free(strs);
+    free(servers);
+    return rc;
+}
+
+int CommandListener::TetherCmd::dnsList(SocketClient *cli, int argc, char **argv) {
+    NetAddressCollection *dlist = sTetherCtrl->getDnsForwarders();
+    NetAddressCollection::iterator it;
+
+    for (it = dlist->begin(); it != dlist->end(); ++it) {
+        sendMsg(cli, ResponseCode::TetherDnsFwdTgtListResult, inet_ntoa(*it), false);
+    }
+    return 0;
+}
+
+const SubCommand CommandListener::NatCmd::sSubCmds[] = {
+    { "disable", NULL, 0, 4, 4, "ss", disable,
+      "Usage: nat disable <internal_interface> <external_interface>",
+      "Nat operation succeeded", "Nat operation failed", NULL, undoDisable },
+    { "enable", NULL, 0, 4, 4, "ss", enable,
+      "Usage: nat enable <internal_interface> <external_interface>",
+      "Nat operation succeeded", "Nat operation failed", NULL, undoEnable },
+};
+
+CommandListener::NatCmd::NatCmd() :
+                 NetdCommand("nat", sSubCmds, ARRAY_SIZE(sSubCmds), &sNatLock) {
+}
 
-        // set the address of the interface to which the name servers
-        // are bound. Required in order to bind to right interface when
-        // doing the dns query.
-        if (!rc) {
-            ifc_init();
-            ifc_get_info(argv[2], &addr.s_addr, NULL, 0);
+int CommandListener::NatCmd::enable(SocketClient *cli, int argc, char **argv) {
+    return sNatCtrl->enableNat(argv[2], argv[3]);
+}
+
+int CommandListener::NatCmd::disable(SocketClient *cli, int argc, char **argv) {
+    return sNatCtrl->disableNat(argv[2], argv[3]);
+}
+
+int CommandListener::NatCmd::undoEnable(void *saved, int argc, char **argv) {
+    return sNatCtrl->disableNat(argv[2], argv[3]);
+}
 
-            rc = sResolverCtrl->setInterfaceAddress(argv[2], &addr);
+int CommandListener::NatCmd::undoDisable(void *saved, int argc, char **argv) {
+    return sNatCtrl->enableNat(argv[2], argv[3]);
+}
+
+const SubCommand CommandListener::PppdCmd::sSubCmds[] = {
+    { "attach", NULL, 0, 5, 7, "saaaa", attach,
+      "Usage: pppd attach <tty> <local_addr> <remote_addr> [<dns1> [<dns2>]]",
+      "Pppd operation succeeded", "Pppd operation failed" },
+    { "detach", NULL, 0, 3, 3, "s", detach, "Usage: pppd detach <tty>",
+      "Pppd operation succeeded", "Pppd operation failed" },
+};
+
+CommandListener::PppdCmd::PppdCmd() :
+                 NetdCommand("pppd", sSubCmds, ARRAY_SIZE(sSubCmds), &sPppLock) {
+}
+
+int CommandListener::PppdCmd::attach(SocketClient *cli, int argc, char **argv) {
+    struct in_addr l, r, dns1, dns2;
+
+    memset(&dns1, 0, sizeof(struct in_addr));
+    memset(&dns2, 0, sizeof(struct in_addr));
+
+    inet_aton(argv[3], &l);
+    inet_aton(argv[4], &r);
+    if (argc > 5) {
+        inet_aton(argv[5], &dns1);
+    }
+    if (argc > 6) {
+        inet_aton(argv[6], &dns2);
+    }
+    return sPppCtrl->attachPppd(argv[2], l, r, dns1, dns2);
+}
+
+int CommandListener::PppdCmd::detach(SocketClient *cli, int argc, char **argv) {
+    return sPppCtrl->detachPppd(argv[2]);
+}
+
+const SubCommand CommandListener::PanCmd::sSubCmds[] = {
+    { "start", NULL, 0, 2, 2, NULL, start, "Usage: pan start",
+      "Pan operation succeeded", "Pan operation failed", saveStarted, undoStart },
+    { "status", NULL, 0, 2, 2, NULL, status, "Usage: pan status", NULL, NULL },
+    { "stop", NULL, 0, 2, 2, NULL, stop, "Usage: pan stop",
+      "Pan operation succeeded", "Pan operation failed", saveStarted, undoStop },
+};
+
+CommandListener::PanCmd::PanCmd() :
+                 NetdCommand("pan", sSubCmds, ARRAY_SIZE(sSubCmds), &sPanLock) {
+}
+
+int CommandListener::PanCmd::start(SocketClient *cli, int argc, char **argv) {
+    return sPanCtrl->startPan();
+}
+
+int CommandListener::PanCmd::stop(SocketClient *cli, int argc, char **argv) {
+    return sPanCtrl->stopPan();
+}
+
+void *CommandListener::PanCmd::saveStarted(int argc, char **argv) {
+    return saveFlag(sPanCtrl->isPanStarted());
+}
+
+// Each undo acts only if its subcommand actually changed the state
+int CommandListener::PanCmd::undoStart(void *saved, int argc, char **argv) {
+    return *(bool *) saved ? 0 : sPanCtrl->stopPan();
+}
+
+int CommandListener::PanCmd::undoStop(void *saved, int argc, char **argv) {
+    return *(bool *) saved ? sPanCtrl->startPan() : 0;
+}
+
+int CommandListener::PanCmd::status(SocketClient *cli, int argc, char **argv) {
+    char *tmp = NULL;
+
+    asprintf(&tmp, "Pan services %s",
+             (sPanCtrl->isPanStarted() ? "started" : "stopped"));
+    sendMsg(cli, ResponseCode::PanStatusResult, tmp, false);
+    free(tmp);
+    return 0;
+}
+
+const SubCommand CommandListener::SoftapCmd::sSubCmds[] = {
+    { "fwreload", NULL, 0, 4, 4, "ss", fwReload, "Usage: softap fwreload <interface> <AP|STA>",
+      "Softap operation succeeded", "Softap operation failed" },
+    { "set", NULL, 0, 4, 10, "sssssdss", set,
+      "Usage: softap set <wlan_iface> <softap_iface> [<ssid> <sec> <key> <channel> "
+      "<preamble> <max_scb>]",
+      "Softap operation succeeded", "Softap operation failed" },
+    { "start", NULL, 0, 2, 3, "s", start, "Usage: softap start [<interface>]",
+      "Softap operation succeeded", "Softap operation failed" },
+    { "startap", NULL, 0, 2, 2, NULL, startAp, "Usage: softap startap",
+      "Softap operation succeeded", "Softap operation failed" },
+    { "status", NULL, 0, 2, 2, NULL, status, "Usage: softap status", NULL, NULL },
+    { "stop", NULL, 0, 2, 3, "s", stop, "Usage: softap stop [<interface>]",
+      "Softap operation succeeded", "Softap operation failed" },
+    { "stopap", NULL, 0, 2, 2, NULL, stopAp, "Usage: softap stopap",
+      "Softap operation succeeded", "Softap operation failed" },
+};
+
+CommandListener::SoftapCmd::SoftapCmd() :
+                 NetdCommand("softap", sSubCmds, ARRAY_SIZE(sSubCmds), &sSoftapLock) {
+}
+
+int CommandListener::SoftapCmd::start(SocketClient *cli, int argc, char **argv) {
+    return sSoftapCtrl->startDriver(argv[2]);
+}
+
+int CommandListener::SoftapCmd::stop(SocketClient *cli, int argc, char **argv) {
+    return sSoftapCtrl->stopDriver(argv[2]);
+}
+
+int CommandListener::SoftapCmd::startAp(SocketClient *cli, int argc, char **argv) {
+    return sSoftapCtrl->startSoftap();
+}
+
+int CommandListener::SoftapCmd::stopAp(SocketClient *cli, int argc, char **argv) {
+    return sSoftapCtrl->stopSoftap();
+}
+
+int CommandListener::SoftapCmd::fwReload(SocketClient *cli, int argc, char **argv) {
+    return sSoftapCtrl->fwReloadSoftap(argc, argv);
+}
+
+int CommandListener::SoftapCmd::status(SocketClient *cli, int argc, char **argv) {
+    char *tmp = NULL;
+
+    asprintf(&tmp, "Softap service %s",
+             (sSoftapCtrl->isSoftapStarted() ? "started" : "stopped"));
+    sendMsg(cli, ResponseCode::SoftapStatusResult, tmp, false);
+    free(tmp);
+    return 0;
+}
+
+int CommandListener::SoftapCmd::set(SocketClient *cli, int argc, char **argv) {
+    return sSoftapCtrl->setSoftap(argc, argv);
+}
+
+const SubCommand CommandListener::UsbCmd::sSubCmds[] = {
+    { "rndisstatus", NULL, 0, 2, 2, NULL, rndisStatus, "Usage: usb rndisstatus", NULL, NULL },
+    { "startrndis", NULL, 0, 2, 2, NULL, startRndis, "Usage: usb startrndis",
+      "Usb operation succeeded", "Usb operation failed", saveRndisStarted, undoStartRndis },
+    { "stoprndis", NULL, 0, 2, 2, NULL, stopRndis, "Usage: usb stoprndis",
+      "Usb operation succeeded", "Usb operation failed", saveRndisStarted, undoStopRndis },
+};
+
+CommandListener::UsbCmd::UsbCmd() :
+                 NetdCommand("usb", sSubCmds, ARRAY_SIZE(sSubCmds), &sUsbLock) {
+}
+
+int CommandListener::UsbCmd::startRndis(SocketClient *cli, int argc, char **argv) {
+    return sUsbCtrl->startRNDIS();
+}
+
+int CommandListener::UsbCmd::stopRndis(SocketClient *cli, int argc, char **argv) {
+    return sUsbCtrl->stopRNDIS();
+}
+
+void *CommandListener::UsbCmd::saveRndisStarted(int argc, char **argv) {
+    return saveFlag(sUsbCtrl->isRNDISStarted());
+}
+
+// Each undo acts only if its subcommand actually changed the state
+int CommandListener::UsbCmd::undoStartRndis(void *saved, int argc, char **argv) {
+    return *(bool *) saved ? 0 : sUsbCtrl->stopRNDIS();
+}
+
+int CommandListener::UsbCmd::undoStopRndis(void *saved, int argc, char **argv) {
+    return *(bool *) saved ? sUsbCtrl->startRNDIS() : 0;
+}
+
+int CommandListener::UsbCmd::rndisStatus(SocketClient *cli, int argc, char **argv) {
+    char *tmp = NULL;
+
+    asprintf(&tmp, "Usb RNDIS %s",
+            (sUsbCtrl->isRNDISStarted() ? "started" : "stopped"));
+    sendMsg(cli, ResponseCode::UsbRNDISStatusResult, tmp, false);
+    free(tmp);
+    return 0;
+}
+
+const SubCommand CommandListener::BatchCmd::sSubCmds[] = {
+    { "abort", NULL, 0, 2, 2, NULL, abort, "Usage: batch abort",
+      "Batch aborted", "No batch in progress", NULL, NULL, SUBCMD_FLAG_INLINE },
+    { "add", NULL, 0, 3, -1, "s", add, "Usage: batch add <command> [<args> ...]",
+      NULL, NULL, NULL, NULL, SUBCMD_FLAG_INLINE },
+    { "begin", NULL, 0, 2, 2, NULL, begin, "Usage: batch begin",
+      "Batch started", "Batch already in progress", NULL, NULL, SUBCMD_FLAG_INLINE },
+    { "commit", NULL, 0, 2, 2, NULL, commit, "Usage: batch commit", NULL, NULL,
+      NULL, NULL, 0, detach, release },
+};
+
+CommandListener::BatchCmd::BatchCmd() :
+                 NetdCommand("batch", sSubCmds, ARRAY_SIZE(sSubCmds), NULL) {
+}
+
+Batch *CommandListener::findBatchLocked(SocketClient *c) {
+    BatchCollection::iterator it;
+
+    for (it = sBatches->begin(); it != sBatches->end(); ++it) {
+        if ((*it)->client == c) {
+            return *it;
         }
-    } else if (!strcmp(argv[1], "flushdefaultif")) { // "resolver flushdefaultif"
-        if (argc == 2) {
-            rc = sResolverCtrl->flushDefaultDnsCache();
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Wrong number of arguments to resolver flushdefaultif", false);
-            return 0;
+    }
+    return NULL;
+}
+
+void CommandListener::freeBatchLocked(Batch *batch) {
+    BatchCollection::iterator it;
+
+    for (it = sBatches->begin(); it != sBatches->end(); ++it) {
+        if (*it == batch) {
+            sBatches->erase(it);
+            break;
         }
-    } else if (!strcmp(argv[1], "flushif")) { // "resolver flushif <iface>"
-        if (argc == 3) {
-            rc = sResolverCtrl->flushInterfaceDnsCache(argv[2]);
-        } else {
-            cli->sendMsg(ResponseCode::CommandSyntaxError,
-                    "Wrong number of arguments to resolver setdefaultif", false);
-            return 0;
+    }
+    for (int i = 0; i < batch->numSteps; i++) {
+        for (int j = 0; j < batch->steps[i].argc; j++) {
+            free(batch->steps[i].argv[j]);
         }
-    } else {
-        cli->sendMsg(ResponseCode::CommandSyntaxError,"Resolver unknown command", false);
+    }
+    free(batch);
+}
+
+int CommandListener::BatchCmd::begin(SocketClient *cli, int argc, char **argv) {
+    pthread_mutex_lock(&sBatchLock);
+    if (findBatchLocked(cli)) {
+        pthread_mutex_unlock(&sBatchLock);
+        errno = EBUSY;
+        return -1;
+    }
+
+    Batch *batch = (Batch *) calloc(1, sizeof(Batch));
+    if (!batch) {
+        pthread_mutex_unlock(&sBatchLock);
+        return -1;
+    }
+    batch->client = cli;
+    sBatches->push_back(batch);
+    pthread_mutex_unlock(&sBatchLock);
+    return 0;
+}
+
+int CommandListener::BatchCmd::abort(SocketClient *cli, int argc, char **argv) {
+    pthread_mutex_lock(&sBatchLock);
+    Batch *batch = findBatchLocked(cli);
+
+    if (!batch) {
+        pthread_mutex_unlock(&sBatchLock);
+        errno = ENOENT;
+        return -1;
+    }
+    freeBatchLocked(batch);
+    pthread_mutex_unlock(&sBatchLock);
+    return 0;
+}
+
+/*
+ * Steps are checked as they are added, so a batch that reaches commit
+ * only holds known subcommands with valid arguments and an undo.
+ */
+int CommandListener::BatchCmd::add(SocketClient *cli, int argc, char **argv) {
+    NetdCommand *cmd = findCommand(argv[2]);
+    if (!cmd || !cmd->hasSubCommands()) {
+        sendMsg(cli, ResponseCode::CommandParameterError, "Command cannot be batched", false);
         return 0;
     }
 
-    if (!rc) {
-        cli->sendMsg(ResponseCode::CommandOkay, "Resolver command succeeded", false);
+    const SubCommand *sc = cmd->resolve(cli, argc - 2, &argv[2]);
+    if (!sc) {
+        return 0;
+    }
+    if (!sc->undo) {
+        sendMsg(cli, ResponseCode::CommandParameterError,
+                     "Subcommand cannot be undone, so cannot be batched", false);
+        return 0;
+    }
+
+    pthread_mutex_lock(&sBatchLock);
+    Batch *batch = findBatchLocked(cli);
+
+    if (!batch) {
+        pthread_mutex_unlock(&sBatchLock);
+        sendMsg(cli, ResponseCode::OperationFailed, "No batch in progress", false);
+        return 0;
+    }
+    if (batch->numSteps == BATCH_MAX_STEPS) {
+        pthread_mutex_unlock(&sBatchLock);
+        sendMsg(cli, ResponseCode::OperationFailed, "Batch is full", false);
+        return 0;
+    }
+
+    BatchStep *step = &batch->steps[batch->numSteps++];
+    step->cmd = cmd;
+    step->argc = argc - 2;
+    for (int i = 0; i < step->argc; i++) {
+        step->argv[i] = strdup(argv[i + 2]);
+    }
+    step->subCmd = sc;
+    int numSteps = batch->numSteps;
+    pthread_mutex_unlock(&sBatchLock);
+
+    char *msg = NULL;
+    asprintf(&msg, "Batch step %d queued", numSteps);
+    sendMsg(cli, ResponseCode::CommandOkay, msg, false);
+    free(msg);
+    return 0;
+}
+
+static int compareLocks(const void *a, const void *b) {
+    uintptr_t la = (uintptr_t) *(pthread_mutex_t * const *) a;
+    uintptr_t lb = (uintptr_t) *(pthread_mutex_t * const *) b;
+
+    return (la < lb) ? -1 : (la > lb);
+}
+
+/*
+ * Takes the batch off the client on the listener thread, before commit is
+ * queued, so a "batch begin" or "batch add" that follows commit on the
+ * same connection sees no batch in progress.
+ */
+void *CommandListener::BatchCmd::detach(SocketClient *cli, int argc, char **argv) {
+    pthread_mutex_lock(&sBatchLock);
+    Batch *batch = findBatchLocked(cli);
+    if (batch) {
+        BatchCollection::iterator it;
+        for (it = sBatches->begin(); it != sBatches->end(); ++it) {
+            if (*it == batch) {
+                sBatches->erase(it);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&sBatchLock);
+
+    if (!batch) {
+        sendMsg(cli, ResponseCode::OperationFailed, "No batch in progress", false);
+    }
+    return batch;
+}
+
+void CommandListener::BatchCmd::release(void *batch) {
+    pthread_mutex_lock(&sBatchLock);
+    freeBatchLocked((Batch *) batch);
+    pthread_mutex_unlock(&sBatchLock);
+}
+
+/*
+ * Runs the steps in order. If one fails, the steps before it are undone
+ * in reverse order and the client gets a single failure naming the step.
+ * The locks of every controller involved are held throughout, taken in
+ * address order so two batches can't deadlock.
+ */
+int CommandListener::BatchCmd::commit(SocketClient *cli, int argc, char **argv) {
+    pthread_mutex_t *locks[BATCH_MAX_STEPS];
+    void *saved[BATCH_MAX_STEPS];
+    Batch *batch = (Batch *) getPrepared();
+    int numLocks = 0;
+    int failed = -1;
+    int i;
+
+    for (i = 0; i < batch->numSteps; i++) {
+        pthread_mutex_t *lock = batch->steps[i].cmd->getLock(batch->steps[i].subCmd);
+        if (lock) {
+            locks[numLocks++] = lock;
+        }
+    }
+    qsort(locks, numLocks, sizeof(locks[0]), compareLocks);
+    for (i = 0; i < numLocks; i++) {
+        if (i == 0 || locks[i] != locks[i - 1]) {
+            pthread_mutex_lock(locks[i]);
+        }
+    }
+
+    for (i = 0; i < batch->numSteps; i++) {
+        BatchStep *step = &batch->steps[i];
+        const SubCommand *sc = step->subCmd;
+
+        saved[i] = NULL;
+        if (sc->save && !(saved[i] = sc->save(step->argc, step->argv))) {
+            LOGE("Batch step %d: failed to save state (%s)", i + 1, strerror(errno));
+            failed = i;
+            break;
+        }
+        if (sc->handler(cli, step->argc, step->argv)) {
+            failed = i;
+            break;
+        }
+    }
+
+    char *msg = NULL;
+    int code = ResponseCode::CommandOkay;
+    int savedErrno = errno;
+
+    if (failed < 0) {
+        asprintf(&msg, "Batch committed %d steps", batch->numSteps);
     } else {
-        cli->sendMsg(ResponseCode::OperationFailed, "Resolver command failed", true);
+        int undoFailures = 0;
+
+        for (i = failed - 1; i >= 0; i--) {
+            BatchStep *step = &batch->steps[i];
+
+            if (step->subCmd->undo(saved[i], step->argc, step->argv)) {
+                LOGE("Batch step %d (%s %s): undo failed (%s)", i + 1,
+                     step->argv[0], step->argv[1], strerror(errno));
+                undoFailures++;
+            }
+        }
+
+        asprintf(&msg, "Batch step %d (%s %s) failed; rolled back %d steps%s",
+                 failed + 1, batch->steps[failed].argv[0], batch->steps[failed].argv[1],
+                 failed, (undoFailures ? " with errors" : ""));
+        code = ResponseCode::OperationFailed;
     }
 
+    for (i = numLocks - 1; i >= 0; i--) {
+        if (i == 0 || locks[i] != locks[i - 1]) {
+            pthread_mutex_unlock(locks[i]);
+        }
+    }
+
+    errno = savedErrno;
+    sendMsg(cli, code, msg, (failed >= 0));
+    free(msg);
+
+    int ran = (failed < 0) ? batch->numSteps : failed + 1;
+    for (i = 0; i < ran; i++) {
+        free(saved[i]);
+    }
+    release(batch);
     return 0;
 }
 
-int CommandListener::readInterfaceCounters(const char *iface, unsigned long *rx, unsigned long *tx) {
-    FILE *fp = fopen("/proc/net/dev", "r");
-    if (!fp) {
-        LOGE("Failed to open /proc/net/dev (%s)", strerror(errno));
-        return -1;
+const SubCommand CommandListener::ResolverCmd::sSubCmds[] = {
+    { "breakerstatus", NULL, 0, 2, 2, NULL, breakerStatus, "Usage: resolver breakerstatus",
+      "Resolver command succeeded", "Resolver command failed" },
+    { "flushdefaultif", NULL, 0, 2, 2, NULL, flushDefaultIf, "Usage: resolver flushdefaultif",
+      "Resolver command succeeded", "Resolver command failed" },
+    { "flushif", NULL, 0, 3, 3, "s", flushIf, "Usage: resolver flushif <interface>",
+      "Resolver command succeeded", "Resolver command failed" },
+    { "getwarmup", NULL, 0, 2, 2, NULL, getWarmup, "Usage: resolver getwarmup",
+      "Resolver command succeeded", "Resolver command failed" },
+    { "proxystats", NULL, 0, 2, 2, NULL, proxyStats, "Usage: resolver proxystats",
+      NULL, NULL },
+    { "querylog", NULL, 0, 2, 2, NULL, queryLog, "Usage: resolver querylog", NULL, NULL },
+    { "setdefaultif", NULL, 0, 3, 3, "s", setDefaultIf,
+      "Usage: resolver setdefaultif <interface>",
+      "Resolver command succeeded", "Resolver command failed" },
+    { "setifdns", NULL, 0, 4, -1, "s", setIfDns,
+      "Usage: resolver setifdns <interface> <dns1> [<dns2> ...]",
+      "Resolver command succeeded", "Resolver command failed" },
+    { "setwarmup", NULL, 0, 2, -1, "s", setWarmup,
+      "Usage: resolver setwarmup [<host1> <host2> ...]", NULL, NULL },
+};
+
+CommandListener::ResolverCmd::ResolverCmd() :
+        NetdCommand("resolver", sSubCmds, ARRAY_SIZE(sSubCmds), NULL) {
+}
+
+int CommandListener::ResolverCmd::setDefaultIf(SocketClient *cli, int argc, char **argv) {
+    return sResolverCtrl->setDefaultInterface(argv[2]);
+}
+
+int CommandListener::ResolverCmd::setIfDns(SocketClient *cli, int argc, char **argv) {
+    struct in_addr addr;
+    int rc = sResolverCtrl->setInterfaceDnsServers(argv[2], &argv[3], argc - 3);
+
+    // set the address of the interface to which the name servers
+    // are bound. Required in order to bind to right interface when
+    // doing the dns query.
+    if (!rc) {
+        pthread_mutex_lock(&sInterfaceLock);
+        ifc_init();
+        ifc_get_info(argv[2], &addr.s_addr, NULL, 0);
+        pthread_mutex_unlock(&sInterfaceLock);
+
+        rc = sResolverCtrl->setInterfaceAddress(argv[2], &addr);
     }
+    return rc;
+}
+
+int CommandListener::ResolverCmd::flushDefaultIf(SocketClient *cli, int argc, char **argv) {
+    return sResolverCtrl->flushDefaultDnsCache();
+}
+
+int CommandListener::ResolverCmd::flushIf(SocketClient *cli, int argc, char **argv) {
+    return sResolverCtrl->flushInterfaceDnsCache(argv[2]);
+}
+
+int CommandListener::ResolverCmd::breakerStatus(SocketClient *cli, int argc, char **argv) {
+    InterfaceDnsConfigCollection *configs = sResolverCtrl->getBreakerStatus();
+    InterfaceDnsConfigCollection::iterator it;
+
+    for (it = configs->begin(); it != configs->end(); ++it) {
+        for (int i = 0; i < (*it)->numServers; i++) {
+            NameserverState *ns = &(*it)->servers[i];
+            char *msg = NULL;
 
-    char buffer[512];
-
-    fgets(buffer, sizeof(buffer), fp); // Header 1
-    fgets(buffer, sizeof(buffer), fp); // Header 2
-    while(fgets(buffer, sizeof(buffer), fp)) {
-        buffer[strlen(buffer)-1] = '\0';
-
-        char name[31];
-        unsigned long d;
-        sscanf(buffer, "%30s %lu %lu %lu %lu %lu %lu %lu %lu %lu",
-                name, rx, &d, &d, &d, &d, &d, &d, &d, tx);
-        char *rxString = strchr(name, ':');
-        *rxString = '\0';
-        rxString++;
-        // when the rx count gets too big it changes from "name: 999" to "name:1000"
-        // and the sscanf munge the two together.  Detect that and fix
-        // note that all the %lu will be off by one and the real tx value will be in d
-        if (*rxString != '\0') {
-            *tx = d;
-            sscanf(rxString, "%20lu", rx);
+            asprintf(&msg, "%s %s %s %d %u", (*it)->iface, ns->addr,
+                     (ns->open ? "open" : "closed"),
+                     ns->consecutiveTimeouts, ns->totalTimeouts);
+            sendMsg(cli, ResponseCode::ResolverBreakerListResult, msg, false);
+            free(msg);
         }
-        if (strcmp(name, iface)) {
-            continue;
+        delete *it;
+    }
+    delete configs;
+    return 0;
+}
+
+int CommandListener::ResolverCmd::setWarmup(SocketClient *cli, int argc, char **argv) {
+    for (int i = 2; i < argc; i++) {
+        if (!ResolverController::isValidHostname(argv[i])) {
+            sendMsg(cli, ResponseCode::CommandParameterError, "Invalid hostname", false);
+            return -1;
         }
-        fclose(fp);
+    }
+    if (sResolverCtrl->setWarmupHosts(&argv[2], argc - 2)) {
+        sendMsg(cli, ResponseCode::OperationFailed, "Resolver command failed", true);
+        return -1;
+    }
+    sendMsg(cli, ResponseCode::CommandOkay, "Resolver command succeeded", false);
+    return 0;
+}
+
+int CommandListener::ResolverCmd::getWarmup(SocketClient *cli, int argc, char **argv) {
+    HostnameCollection *hosts = sResolverCtrl->getWarmupHosts();
+    HostnameCollection::iterator it;
+
+    for (it = hosts->begin(); it != hosts->end(); ++it) {
+        sendMsg(cli, ResponseCode::ResolverWarmupListResult, *it, false);
+        free(*it);
+    }
+    delete hosts;
+    return 0;
+}
+
+int CommandListener::ResolverCmd::queryLog(SocketClient *cli, int argc, char **argv) {
+    char *log = sResolverCtrl->getQueryLog()->dump();
+
+    // The log can be tens of KB; sendMsg() copes as it formats on the heap
+    if (!log) {
+        sendMsg(cli, ResponseCode::OperationFailed, "Failed to dump query log", true);
         return 0;
     }
+    sendMsg(cli, ResponseCode::ResolverQueryLogResult, log, false);
+    free(log);
+    return 0;
+}
 
-    fclose(fp);
-    *rx = 0;
-    *tx = 0;
+int CommandListener::ResolverCmd::proxyStats(SocketClient *cli, int argc, char **argv) {
+    if (!sDnsProxy) {
+        sendMsg(cli, ResponseCode::OperationFailed, "DNS proxy not running", false);
+        return 0;
+    }
+    WorkQueueStats stats;
+    char *msg = NULL;
+
+    sDnsProxy->getQueueStats(&stats);
+    asprintf(&msg, "queued %d active %d peak %d completed %u rejected %u "
+             "avgwait_us %llu maxwait_us %u",
+             stats.queued, stats.active, stats.peakQueued, stats.completed,
+             stats.rejected,
+             (unsigned long long) (stats.completed ?
+                     stats.totalWaitUs / stats.completed : 0),
+             stats.maxWaitUs);
+    sendMsg(cli, ResponseCode::ResolverProxyStatsResult, msg, false);
+    free(msg);
+    return 0;
+}
+
+const SubCommand CommandListener::QuotaCmd::sSubCmds[] = {
+    { "list", NULL, 0, 2, 2, NULL, list, "Usage: quota list", NULL, NULL },
+    { "remove", NULL, 0, 3, 3, "s", remove, "Usage: quota remove <interface>",
+      "Quota removed", "Failed to remove quota" },
+    { "set", NULL, 0, 4, 4, "sd", set, "Usage: quota set <interface> <bytes>",
+      "Quota set", "Failed to set quota" },
+};
+
+CommandListener::QuotaCmd::QuotaCmd() :
+                 NetdCommand("quota", sSubCmds, ARRAY_SIZE(sSubCmds), NULL) {
+}
+
+int CommandListener::QuotaCmd::list(SocketClient *cli, int argc, char **argv) {
+    InterfaceQuotaCollection *quotas = QuotaController::Instance()->getQuotas();
+    InterfaceQuotaCollection::iterator it;
+
+    for (it = quotas->begin(); it != quotas->end(); ++it) {
+        char *msg = NULL;
+        asprintf(&msg, "%s %llu %s", (*it)->iface, (unsigned long long) (*it)->bytes,
+                 (*it)->alerted ? "reached" : "active");
+        sendMsg(cli, ResponseCode::QuotaListResult, msg, false);
+        free(msg);
+        free(*it);
+    }
+    delete quotas;
+    sendMsg(cli, ResponseCode::CommandOkay, "Quota list completed", false);
+    return 0;
+}
+
+int CommandListener::QuotaCmd::remove(SocketClient *cli, int argc, char **argv) {
+    return QuotaController::Instance()->removeQuota(argv[2]);
+}
+
+int CommandListener::QuotaCmd::set(SocketClient *cli, int argc, char **argv) {
+    return QuotaController::Instance()->setQuota(argv[2], strtoull(argv[3], NULL, 10));
+}
+
+const SubCommand CommandListener::TrafficCmd::sSubCmds[] = {
+    { "disable", NULL, 0, 2, 2, NULL, disable, "Usage: traffic disable",
+      "Traffic accounting disabled", "Failed to disable traffic accounting" },
+    { "enable", NULL, 0, 2, 2, NULL, enable, "Usage: traffic enable",
+      "Traffic accounting enabled", "Failed to enable traffic accounting" },
+    { "uidstats", NULL, 0, 2, 3, "s", uidStats, "Usage: traffic uidstats [<interface>]",
+      NULL, NULL },
+};
+
+CommandListener::TrafficCmd::TrafficCmd() :
+                 NetdCommand("traffic", sSubCmds, ARRAY_SIZE(sSubCmds), &sTrafficLock) {
+}
+
+int CommandListener::TrafficCmd::disable(SocketClient *cli, int argc, char **argv) {
+    return sTrafficCtrl->disable();
+}
+
+int CommandListener::TrafficCmd::enable(SocketClient *cli, int argc, char **argv) {
+    return sTrafficCtrl->enable();
+}
+
+/*
+ * One "<interface> <uid> <rxbytes> <rxpackets> <txbytes> <txpackets>"
+ * TrafficUidStatsResult line per uid that has seen traffic, all sent in
+ * one write.
+ */
+int CommandListener::TrafficCmd::uidStats(SocketClient *cli, int argc, char **argv) {
+    UidStats *stats;
+    int n = sTrafficCtrl->getUidStats(argc == 3 ? argv[2] : NULL, &stats);
+
+    if (n < 0) {
+        sendMsg(cli, ResponseCode::OperationFailed, "Failed to read uid stats", true);
+        return 0;
+    }
+
+    for (int i = 0; i < n; i++) {
+        char line[128];
+        snprintf(line, sizeof(line), "%s %u %llu %llu %llu %llu", stats[i].iface, stats[i].uid,
+                 (unsigned long long) stats[i].rxBytes, (unsigned long long) stats[i].rxPackets,
+                 (unsigned long long) stats[i].txBytes, (unsigned long long) stats[i].txPackets);
+        sendMsg(cli, ResponseCode::TrafficUidStatsResult, line, false);
+    }
+    free(stats);
+
+    sendMsg(cli, ResponseCode::CommandOkay, "Uid stats listed", false);
+    return 0;
+}
+
+const SubCommand CommandListener::ClientCmd::sSubCmds[] = {
+    { "priority", NULL, 0, 3, 3, "s", priority, "Usage: client priority <high|normal>",
+      "Client priority set", "Failed to set client priority", NULL, NULL,
+      SUBCMD_FLAG_INLINE },
+};
+
+CommandListener::ClientCmd::ClientCmd() :
+                 NetdCommand("client", sSubCmds, ARRAY_SIZE(sSubCmds), NULL) {
+}
+
+/*
+ * Applies to this connection only, so a caller such as the connectivity
+ * service opens a connection of its own for the queries that can't wait.
+ */
+int CommandListener::ClientCmd::priority(SocketClient *cli, int argc, char **argv) {
+    if (!strcmp(argv[2], "high")) {
+        setPriority(cli, true);
+    } else if (!strcmp(argv[2], "normal")) {
+        setPriority(cli, false);
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Stats run inline so that they still answer while the workers are stuck
+ * behind a slow command.
+ */
+const SubCommand CommandListener::StatsCmd::sSubCmds[] = {
+    { "list", NULL, 0, 2, 2, NULL, list, "Usage: stats list",
+      "Command stats listed", "Failed to list command stats", NULL, NULL,
+      SUBCMD_FLAG_INLINE },
+    { "reset", NULL, 0, 2, 2, NULL, reset, "Usage: stats reset",
+      "Command stats reset", "Failed to reset command stats", NULL, NULL,
+      SUBCMD_FLAG_INLINE },
+};
+
+CommandListener::StatsCmd::StatsCmd() :
+                 NetdCommand("stats", sSubCmds, ARRAY_SIZE(sSubCmds), NULL) {
+}
+
+int CommandListener::StatsCmd::list(SocketClient *cli, int argc, char **argv) {
+    NetdCommandCollection::iterator it;
+
+    for (it = sCommands->begin(); it != sCommands->end(); ++it) {
+        (*it)->sendStats(cli);
+    }
+    return 0;
+}
+
+int CommandListener::StatsCmd::reset(SocketClient *cli, int argc, char **argv) {
+    NetdCommandCollection::iterator it;
+
+    for (it = sCommands->begin(); it != sCommands->end(); ++it) {
+        (*it)->resetStats();
+    }
     return 0;
 }
@@ -17,8 +17,8 @@
 #ifndef _COMMANDLISTENER_H__
 #define _COMMANDLISTENER_H__
 
-#include <sysutils/FrameworkListener.h>
 
+#include "EpollListener.h"
 #include "NetdCommand.h"
 #include "TetherController.h"
 #include "NatController.h"
@@ -27,8 +27,38 @@
 #include "SoftapController.h"
 #include "UsbController.h"
 #include "ResolverController.h"
+#include "TrafficController.h"
+#include "DnsProxyListener.h"
 
-class CommandListener : public FrameworkListener {
+typedef android::List<NetdCommand *> NetdCommandCollection;
+
+/* Commands run on this many threads, with up to CMD_MAX_QUEUED waiting */
+#define CMD_WORKER_THREADS  4
+#define CMD_MAX_QUEUED      32
+
+/* Most commands one client connection may have waiting at once */
+#define CMD_MAX_PER_CLIENT  16
+
+/* Most steps one batch may hold */
+#define BATCH_MAX_STEPS 32
+
+struct BatchStep {
+    NetdCommand      *cmd;
+    int              argc;
+    char             *argv[EpollListener::CMD_ARGS_MAX];
+    const SubCommand *subCmd;
+};
+
+/* Steps queued by one client between "batch begin" and "batch commit" */
+struct Batch {
+    SocketClient *client;
+    int          numSteps;
+    BatchStep    steps[BATCH_MAX_STEPS];
+};
+
+typedef android::List<Batch *> BatchCollection;
+
+class CommandListener : public EpollListener {
     static TetherController *sTetherCtrl;
     static NatController *sNatCtrl;
     static PppController *sPppCtrl;
@@ -36,83 +66,280 @@ class CommandListener : public FrameworkListener {
     static SoftapController *sSoftapCtrl;
     static UsbController *sUsbCtrl;
     static ResolverController *sResolverCtrl;
+    static TrafficController *sTrafficCtrl;
+    static DnsProxyListener *sDnsProxy;
+    static NetdCommandCollection *sCommands;
+    static BatchCollection *sBatches;
+    static pthread_mutex_t sBatchLock;
+
+    /*
+     * One lock per controller. Commands that drive the same controller
+     * share its lock; ResolverController does its own locking.
+     */
+    static pthread_mutex_t sInterfaceLock;
+    static pthread_mutex_t sThrottleLock;
+    static pthread_mutex_t sTetherLock;
+    static pthread_mutex_t sNatLock;
+    static pthread_mutex_t sPppLock;
+    static pthread_mutex_t sPanLock;
+    static pthread_mutex_t sSoftapLock;
+    static pthread_mutex_t sUsbLock;
+    static pthread_mutex_t sTrafficLock;
+
+    WorkQueue *mQueue;
 
 public:
     CommandListener();
     virtual ~CommandListener() {}
 
-private:
+    ResolverController *getResolverController() { return sResolverCtrl; }
+    void setDnsProxyListener(DnsProxyListener *dpl) { sDnsProxy = dpl; }
 
-    static int readInterfaceCounters(const char *iface, unsigned long *rx, unsigned long *tx);
+protected:
+    virtual void dispatchCommand(SocketClient *c, char *data);
+    virtual void onClientClosed(SocketClient *c);
+
+private:
+    void registerNetdCmd(NetdCommand *cmd);
+    static NetdCommand *findCommand(const char *name);
+    static Batch *findBatchLocked(SocketClient *c);
+    static void freeBatchLocked(Batch *batch);
 
     class UsbCmd : public NetdCommand {
+        static const SubCommand sSubCmds[];
+
     public:
         UsbCmd();
         virtual ~UsbCmd() {}
-        int runCommand(SocketClient *c, int argc, char ** argv);
+
+    private:
+        static int rndisStatus(SocketClient *c, int argc, char **argv);
+        static int startRndis(SocketClient *c, int argc, char **argv);
+        static int stopRndis(SocketClient *c, int argc, char **argv);
+        static void *saveRndisStarted(int argc, char **argv);
+        static int undoStartRndis(void *saved, int argc, char **argv);
+        static int undoStopRndis(void *saved, int argc, char **argv);
     };
 
     class SoftapCmd : public NetdCommand {
+        static const SubCommand sSubCmds[];
+
     public:
         SoftapCmd();
         virtual ~SoftapCmd() {}
-        int runCommand(SocketClient *c, int argc, char ** argv);
+
+    private:
+        static int fwReload(SocketClient *c, int argc, char **argv);
+        static int set(SocketClient *c, int argc, char **argv);
+        static int start(SocketClient *c, int argc, char **argv);
+        static int startAp(SocketClient *c, int argc, char **argv);
+        static int status(SocketClient *c, int argc, char **argv);
+        static int stop(SocketClient *c, int argc, char **argv);
+        static int stopAp(SocketClient *c, int argc, char **argv);
     };
 
     class InterfaceCmd : public NetdCommand {
+        static const SubCommand sSubCmds[];
+
     public:
         InterfaceCmd();
         virtual ~InterfaceCmd() {}
-        int runCommand(SocketClient *c, int argc, char ** argv);
+
+    private:
+        static int getCfg(SocketClient *c, int argc, char **argv);
+        static int getThrottle(SocketClient *c, int argc, char **argv);
+        static int list(SocketClient *c, int argc, char **argv);
+        static int rates(SocketClient *c, int argc, char **argv);
+        static int readCounters(SocketClient *c, int argc, char **argv);
+        static int readRxCounter(SocketClient *c, int argc, char **argv);
+        static int readTxCounter(SocketClient *c, int argc, char **argv);
+        static int setCfg(SocketClient *c, int argc, char **argv);
+        static int setSampling(SocketClient *c, int argc, char **argv);
+        static int setThrottle(SocketClient *c, int argc, char **argv);
+        static int subscribe(SocketClient *c, int argc, char **argv);
+        static int unsubscribe(SocketClient *c, int argc, char **argv);
+        static void *saveCfg(int argc, char **argv);
+        static int undoSetCfg(void *saved, int argc, char **argv);
+        static void *saveThrottle(int argc, char **argv);
+        static int undoSetThrottle(void *saved, int argc, char **argv);
     };
 
     class IpFwdCmd : public NetdCommand {
+        static const SubCommand sSubCmds[];
+
     public:
         IpFwdCmd();
         virtual ~IpFwdCmd() {}
-        int runCommand(SocketClient *c, int argc, char ** argv);
+
+    private:
+        static int disable(SocketClient *c, int argc, char **argv);
+        static int enable(SocketClient *c, int argc, char **argv);
+        static int status(SocketClient *c, int argc, char **argv);
+        static void *saveEnabled(int argc, char **argv);
+        static int undoSetEnabled(void *saved, int argc, char **argv);
     };
 
     class TetherCmd : public NetdCommand {
+        static const SubCommand sDnsSubCmds[];
+        static const SubCommand sInterfaceSubCmds[];
+        static const SubCommand sSubCmds[];
+
     public:
         TetherCmd();
         virtual ~TetherCmd() {}
-        int runCommand(SocketClient *c, int argc, char ** argv);
+
+    private:
+        static int dnsList(SocketClient *c, int argc, char **argv);
+        static int dnsSet(SocketClient *c, int argc, char **argv);
+        static int interfaceAdd(SocketClient *c, int argc, char **argv);
+        static int interfaceList(SocketClient *c, int argc, char **argv);
+        static int interfaceRemove(SocketClient *c, int argc, char **argv);
+        static int start(SocketClient *c, int argc, char **argv);
+        static int status(SocketClient *c, int argc, char **argv);
+        static int stop(SocketClient *c, int argc, char **argv);
+        static void *saveDnsForwarders(int argc, char **argv);
+        static void *saveStarted(int argc, char **argv);
+        static int undoDnsSet(void *saved, int argc, char **argv);
+        static int undoInterfaceAdd(void *saved, int argc, char **argv);
+        static int undoInterfaceRemove(void *saved, int argc, char **argv);
+        static int undoStart(void *saved, int argc, char **argv);
     };
 
     class NatCmd : public NetdCommand {
+        static const SubCommand sSubCmds[];
+
     public:
         NatCmd();
         virtual ~NatCmd() {}
-        int runCommand(SocketClient *c, int argc, char ** argv);
+
+    private:
+        static int disable(SocketClient *c, int argc, char **argv);
+        static int enable(SocketClient *c, int argc, char **argv);
+        static int undoDisable(void *saved, int argc, char **argv);
+        static int undoEnable(void *saved, int argc, char **argv);
     };
 
     class ListTtysCmd : public NetdCommand {
+        static const SubCommand sSubCmds[];
+
     public:
         ListTtysCmd();
         virtual ~ListTtysCmd() {}
-        int runCommand(SocketClient *c, int argc, char ** argv);
+
+    private:
+        static int list(SocketClient *c, int argc, char **argv);
     };
 
     class PppdCmd : public NetdCommand {
+        static const SubCommand sSubCmds[];
+
     public:
         PppdCmd();
         virtual ~PppdCmd() {}
-        int runCommand(SocketClient *c, int argc, char ** argv);
+
+    private:
+        static int attach(SocketClient *c, int argc, char **argv);
+        static int detach(SocketClient *c, int argc, char **argv);
     };
 
     class PanCmd : public NetdCommand {
+        static const SubCommand sSubCmds[];
+
     public:
         PanCmd();
         virtual ~PanCmd() {}
-        int runCommand(SocketClient *c, int argc, char ** argv);
+
+    private:
+        static int start(SocketClient *c, int argc, char **argv);
+        static int status(SocketClient *c, int argc, char **argv);
+        static int stop(SocketClient *c, int argc, char **argv);
+        static void *saveStarted(int argc, char **argv);
+        static int undoStart(void *saved, int argc, char **argv);
+        static int undoStop(void *saved, int argc, char **argv);
+    };
+
+    class BatchCmd : public NetdCommand {
+        static const SubCommand sSubCmds[];
+
+    public:
+        BatchCmd();
+        virtual ~BatchCmd() {}
+
+    private:
+        static int abort(SocketClient *c, int argc, char **argv);
+        static int add(SocketClient *c, int argc, char **argv);
+        static int begin(SocketClient *c, int argc, char **argv);
+        static int commit(SocketClient *c, int argc, char **argv);
+        static void *detach(SocketClient *c, int argc, char **argv);
+        static void release(void *batch);
+    };
+
+    class QuotaCmd : public NetdCommand {
+        static const SubCommand sSubCmds[];
+
+    public:
+        QuotaCmd();
+        virtual ~QuotaCmd() {}
+
+    private:
+        static int list(SocketClient *c, int argc, char **argv);
+        static int remove(SocketClient *c, int argc, char **argv);
+        static int set(SocketClient *c, int argc, char **argv);
+    };
+
+    class TrafficCmd : public NetdCommand {
+        static const SubCommand sSubCmds[];
+
+    public:
+        TrafficCmd();
+        virtual ~TrafficCmd() {}
+
+    private:
+        static int disable(SocketClient *c, int argc, char **argv);
+        static int enable(SocketClient *c, int argc, char **argv);
+        static int uidStats(SocketClient *c, int argc, char **argv);
+    };
+
+    class ClientCmd : public NetdCommand {
+        static const SubCommand sSubCmds[];
+
+    public:
+        ClientCmd();
+        virtual ~ClientCmd() {}
+
+    private:
+        static int priority(SocketClient *c, int argc, char **argv);
+    };
+
+    class StatsCmd : public NetdCommand {
+        static const SubCommand sSubCmds[];
+
+    public:
+        StatsCmd();
+        virtual ~StatsCmd() {}
+
+    private:
+        static int list(SocketClient *c, int argc, char **argv);
+        static int reset(SocketClient *c, int argc, char **argv);
     };
 
     class ResolverCmd : public NetdCommand {
+        static const SubCommand sSubCmds[];
+
     public:
         ResolverCmd();
         virtual ~ResolverCmd() {}
-        int runCommand(SocketClient *c, int argc, char ** argv);
+
+    private:
+        static int breakerStatus(SocketClient *c, int argc, char **argv);
+        static int flushDefaultIf(SocketClient *c, int argc, char **argv);
+        static int flushIf(SocketClient *c, int argc, char **argv);
+        static int getWarmup(SocketClient *c, int argc, char **argv);
+        static int proxyStats(SocketClient *c, int argc, char **argv);
+        static int queryLog(SocketClient *c, int argc, char **argv);
+        static int setDefaultIf(SocketClient *c, int argc, char **argv);
+        static int setIfDns(SocketClient *c, int argc, char **argv);
+        static int setWarmup(SocketClient *c, int argc, char **argv);
     };
 };
 
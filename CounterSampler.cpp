@@ -0,0 +1,435 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_TAG "CounterSampler"
+#define DBG 0
+
+#include <cutils/log.h>
+
+#include <sysutils/SocketClient.h>
+
+#include "CounterSampler.h"
+#include "EpollListener.h"
+#include "EventLoop.h"
+#include "InterfaceTable.h"
+#include "ResponseCode.h"
+
+CounterSampler *CounterSampler::sInstance = NULL;
+
+CounterSampler *CounterSampler::Instance() {
+    if (!sInstance)
+        sInstance = new CounterSampler();
+    return sInstance;
+}
+
+CounterSampler::CounterSampler() {
+    pthread_mutex_init(&mLock, NULL);
+    pthread_mutex_init(&mSampleLock, NULL);
+    mInterfaces = new SampledInterfaceCollection();
+    mSubscriptions = new CounterSubscriptionCollection();
+    mIntervalMs = SAMPLER_DEFAULT_INTERVAL_MS;
+    mTimer = 0;
+    mLastQueryMs = 0;
+}
+
+CounterSampler::~CounterSampler() {
+    SampledInterfaceCollection::iterator it;
+
+    for (it = mInterfaces->begin(); it != mInterfaces->end(); ++it) {
+        free(*it);
+    }
+    delete mInterfaces;
+
+    CounterSubscriptionCollection::iterator sit;
+    for (sit = mSubscriptions->begin(); sit != mSubscriptions->end(); ++sit) {
+        freeSubscription(*sit);
+    }
+    delete mSubscriptions;
+    pthread_mutex_destroy(&mLock);
+    pthread_mutex_destroy(&mSampleLock);
+}
+
+static uint64_t nowMs() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * Starts the timer if it is not running. Returns true if it was started,
+ * in which case the caller takes a sample straight away once the lock is
+ * dropped, rather than an interval from now.
+ */
+bool CounterSampler::armLocked() {
+    if (mTimer) {
+        return false;
+    }
+    int id = EventLoop::Instance()->addTimer(mIntervalMs, CounterSampler::timerFired, this);
+    if (id < 0) {
+        LOGE("Unable to start sampling (%s)", strerror(errno));
+        return false;
+    }
+    mTimer = id;
+    return true;
+}
+
+int CounterSampler::setInterval(int intervalMs) {
+    if (intervalMs < SAMPLER_MIN_INTERVAL_MS) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&mLock);
+    mIntervalMs = intervalMs;
+    if (mTimer) {
+        EventLoop::Instance()->setTimerInterval(mTimer, intervalMs);
+    }
+    pthread_mutex_unlock(&mLock);
+    return 0;
+}
+
+int CounterSampler::getInterval() {
+    pthread_mutex_lock(&mLock);
+    int intervalMs = mIntervalMs;
+    pthread_mutex_unlock(&mLock);
+    return intervalMs;
+}
+
+void CounterSampler::timerFired(void *obj) {
+    reinterpret_cast<CounterSampler *>(obj)->sampleAll();
+}
+
+SampledInterface *CounterSampler::findLocked(const char *iface) {
+    SampledInterfaceCollection::iterator it;
+
+    for (it = mInterfaces->begin(); it != mInterfaces->end(); ++it) {
+        if (!strcmp((*it)->name, iface)) {
+            return *it;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Runs on the event loop's timer and, when sampling restarts, on the
+ * worker that restarted it. mSampleLock keeps the two from interleaving,
+ * so samples go into the rings in the order they were read.
+ */
+void CounterSampler::sampleAll() {
+    InterfaceEntry *entries;
+    SampledInterfaceCollection::iterator it;
+    int n;
+
+    pthread_mutex_lock(&mSampleLock);
+    if (InterfaceTable::Instance()->refreshStats() ||
+        (n = InterfaceTable::Instance()->getAll(&entries)) < 0) {
+        LOGW("Failed to sample interface counters (%s)", strerror(errno));
+        pthread_mutex_unlock(&mSampleLock);
+        return;
+    }
+    uint64_t now = nowMs();
+    PendingNoticeCollection notices;
+
+    pthread_mutex_lock(&mLock);
+    for (it = mInterfaces->begin(); it != mInterfaces->end(); ++it) {
+        (*it)->seen = false;
+    }
+
+    for (int i = 0; i < n; i++) {
+        SampledInterface *si = findLocked(entries[i].name);
+
+        if (!si) {
+            if (!(si = (SampledInterface *) calloc(1, sizeof(SampledInterface)))) {
+                continue;
+            }
+            strlcpy(si->name, entries[i].name, sizeof(si->name));
+            mInterfaces->push_back(si);
+        }
+
+        CounterSample *s = &si->samples[si->next];
+        s->timeMs = now;
+        s->rxBytes = entries[i].stats.rxBytes;
+        s->rxPackets = entries[i].stats.rxPackets;
+        s->txBytes = entries[i].stats.txBytes;
+        s->txPackets = entries[i].stats.txPackets;
+        si->next = (si->next + 1) % SAMPLER_HISTORY;
+        if (si->count < SAMPLER_HISTORY) {
+            si->count++;
+        }
+        si->seen = true;
+    }
+
+    // Forget interfaces that have gone away
+    it = mInterfaces->begin();
+    while (it != mInterfaces->end()) {
+        if (!(*it)->seen) {
+            if (DBG) LOGD("No longer sampling %s", (*it)->name);
+            free(*it);
+            it = mInterfaces->erase(it);
+        } else {
+            ++it;
+        }
+    }
+    checkSubscriptionsLocked(now, &notices);
+
+    if (mTimer && mSubscriptions->empty() && now - mLastQueryMs >= SAMPLER_IDLE_MS) {
+        if (DBG) LOGD("Nobody is watching; sampling stops");
+        EventLoop::Instance()->removeTimer(mTimer);
+        mTimer = 0;
+    }
+    pthread_mutex_unlock(&mLock);
+    pthread_mutex_unlock(&mSampleLock);
+
+    free(entries);
+
+    // Only queued here; the writes happen off the event loop's thread
+    PendingNoticeCollection::iterator nit;
+    for (nit = notices.begin(); nit != notices.end(); ++nit) {
+        if (!EpollListener::sendNotice(nit->client, nit->code, nit->msg, false)) {
+            LOGW("Dropped a counter notice to a client that is behind");
+        }
+        nit->client->decRef();
+        free(nit->msg);
+    }
+}
+
+/* Counters that went backwards belong to a recreated interface */
+static uint64_t ratePerSec(uint64_t newer, uint64_t older, uint64_t ms) {
+    return newer >= older ? (newer - older) * 1000 / ms : 0;
+}
+
+int CounterSampler::getRates(const char *iface, int windowSecs, InterfaceRates *rates) {
+    pthread_mutex_lock(&mLock);
+    mLastQueryMs = nowMs();
+    if (armLocked()) {
+        // The newest sample is as old as the idle spell
+        pthread_mutex_unlock(&mLock);
+        sampleAll();
+        pthread_mutex_lock(&mLock);
+    }
+    SampledInterface *si = findLocked(iface);
+
+    if (!si) {
+        pthread_mutex_unlock(&mLock);
+        errno = ENODEV;
+        return -1;
+    }
+    if (si->count < 2) {
+        pthread_mutex_unlock(&mLock);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    const CounterSample *newest = &si->samples[(si->next + SAMPLER_HISTORY - 1) % SAMPLER_HISTORY];
+    const CounterSample *oldest = NULL;
+    uint64_t windowMs = (uint64_t) windowSecs * 1000;
+
+    // Longer than the history could ever cover just means all of it
+    if (windowMs > (uint64_t) SAMPLER_HISTORY * mIntervalMs) {
+        windowMs = (uint64_t) SAMPLER_HISTORY * mIntervalMs;
+    }
+
+    // Oldest sample still inside the window, but never the newest itself
+    for (int i = 2; i <= si->count; i++) {
+        const CounterSample *s = &si->samples[(si->next + SAMPLER_HISTORY - i) % SAMPLER_HISTORY];
+        if (oldest && newest->timeMs - s->timeMs > windowMs) {
+            break;
+        }
+        oldest = s;
+    }
+
+    uint64_t ms = newest->timeMs - oldest->timeMs;
+    if (!ms) {
+        ms = 1;
+    }
+    rates->windowMs = ms;
+    rates->rxBytesPerSec = ratePerSec(newest->rxBytes, oldest->rxBytes, ms);
+    rates->rxPacketsPerSec = ratePerSec(newest->rxPackets, oldest->rxPackets, ms);
+    rates->txBytesPerSec = ratePerSec(newest->txBytes, oldest->txBytes, ms);
+    rates->txPacketsPerSec = ratePerSec(newest->txPackets, oldest->txPackets, ms);
+    pthread_mutex_unlock(&mLock);
+    return 0;
+}
+
+int CounterSampler::subscribe(SocketClient *c, const char *iface, int periodSecs,
+                              uint64_t bytesLimit, uint64_t rateLimit) {
+    CounterSubscriptionCollection::iterator it;
+    CounterSubscription *sub = NULL;
+
+    if (periodSecs < 0 || (!periodSecs && !bytesLimit && !rateLimit)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&mLock);
+    for (it = mSubscriptions->begin(); it != mSubscriptions->end(); ++it) {
+        if ((*it)->client == c && !strcmp((*it)->iface, iface)) {
+            sub = *it;
+            break;
+        }
+    }
+    if (!sub) {
+        if (!(sub = (CounterSubscription *) calloc(1, sizeof(CounterSubscription)))) {
+            pthread_mutex_unlock(&mLock);
+            return -1;
+        }
+        c->incRef();
+        sub->client = c;
+        strlcpy(sub->iface, iface, sizeof(sub->iface));
+        mSubscriptions->push_back(sub);
+    }
+    sub->periodSecs = periodSecs;
+    sub->bytesLimit = bytesLimit;
+    sub->rateLimit = rateLimit;
+    sub->lastReportMs = 0;
+    sub->bytesReached = false;
+    sub->rateAbove = false;
+    sub->haveBase = false;
+    SampledInterface *si = findLocked(iface);
+    if (si && si->count) {
+        const CounterSample *cur = &si->samples[(si->next + SAMPLER_HISTORY - 1) % SAMPLER_HISTORY];
+        sub->bytesBase = cur->rxBytes + cur->txBytes;
+        sub->haveBase = true;
+    }
+    bool armed = armLocked();
+    pthread_mutex_unlock(&mLock);
+
+    if (armed) {
+        sampleAll();
+    }
+    return 0;
+}
+
+int CounterSampler::unsubscribe(SocketClient *c, const char *iface) {
+    CounterSubscriptionCollection::iterator it;
+
+    pthread_mutex_lock(&mLock);
+    for (it = mSubscriptions->begin(); it != mSubscriptions->end(); ++it) {
+        if ((*it)->client == c && !strcmp((*it)->iface, iface)) {
+            freeSubscription(*it);
+            mSubscriptions->erase(it);
+            pthread_mutex_unlock(&mLock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+    errno = ENOENT;
+    return -1;
+}
+
+void CounterSampler::removeClient(SocketClient *c) {
+    CounterSubscriptionCollection::iterator it;
+
+    pthread_mutex_lock(&mLock);
+    it = mSubscriptions->begin();
+    while (it != mSubscriptions->end()) {
+        if ((*it)->client == c) {
+            freeSubscription(*it);
+            it = mSubscriptions->erase(it);
+        } else {
+            ++it;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+void CounterSampler::freeSubscription(CounterSubscription *sub) {
+    sub->client->decRef();
+    free(sub);
+}
+
+void CounterSampler::addNotice(PendingNoticeCollection *notices, SocketClient *c, int code,
+                               char *msg) {
+    PendingNotice notice;
+
+    if (!msg) {
+        return;
+    }
+    c->incRef();
+    notice.client = c;
+    notice.code = code;
+    notice.msg = msg;
+    notices->push_back(notice);
+}
+
+void CounterSampler::checkSubscriptionsLocked(uint64_t now, PendingNoticeCollection *notices) {
+    CounterSubscriptionCollection::iterator it;
+
+    for (it = mSubscriptions->begin(); it != mSubscriptions->end(); ++it) {
+        CounterSubscription *sub = *it;
+        SampledInterface *si = findLocked(sub->iface);
+        char *msg;
+
+        // Interfaces that come and go keep their subscriptions
+        if (!si || si->count < 1) {
+            continue;
+        }
+        const CounterSample *cur = &si->samples[(si->next + SAMPLER_HISTORY - 1) % SAMPLER_HISTORY];
+        const CounterSample *prev = (si->count > 1) ?
+                &si->samples[(si->next + SAMPLER_HISTORY - 2) % SAMPLER_HISTORY] : NULL;
+        uint64_t rxRate = 0, txRate = 0;
+
+        if (prev && cur->timeMs > prev->timeMs) {
+            uint64_t ms = cur->timeMs - prev->timeMs;
+            rxRate = ratePerSec(cur->rxBytes, prev->rxBytes, ms);
+            txRate = ratePerSec(cur->txBytes, prev->txBytes, ms);
+        }
+
+        if (sub->periodSecs &&
+            (!sub->lastReportMs || now - sub->lastReportMs >= (uint64_t) sub->periodSecs * 1000)) {
+            msg = NULL;
+            asprintf(&msg, "Iface counters %s %llu %llu %llu %llu %llu %llu", sub->iface,
+                     (unsigned long long) cur->rxBytes, (unsigned long long) cur->rxPackets,
+                     (unsigned long long) cur->txBytes, (unsigned long long) cur->txPackets,
+                     (unsigned long long) rxRate, (unsigned long long) txRate);
+            addNotice(notices, sub->client, ResponseCode::InterfaceCounterUpdate, msg);
+            sub->lastReportMs = now;
+        }
+
+        // The limit counts from the first sample after subscribing
+        uint64_t total = cur->rxBytes + cur->txBytes;
+        if (!sub->haveBase) {
+            sub->bytesBase = total;
+            sub->haveBase = true;
+        } else if (total < sub->bytesBase) {
+            // Recreated interface; its counters started over
+            sub->bytesBase = 0;
+        }
+        uint64_t used = total - sub->bytesBase;
+        if (sub->bytesLimit && !sub->bytesReached && used >= sub->bytesLimit) {
+            msg = NULL;
+            asprintf(&msg, "Iface limit %s %llu", sub->iface, (unsigned long long) used);
+            addNotice(notices, sub->client, ResponseCode::InterfaceBytesLimit, msg);
+            sub->bytesReached = true;
+        }
+
+        // Only crossings are reported, so a steady rate is silent
+        bool above = (rxRate + txRate >= sub->rateLimit);
+        if (sub->rateLimit && prev && above != sub->rateAbove) {
+            msg = NULL;
+            asprintf(&msg, "Iface rate %s %s %llu", sub->iface, above ? "above" : "below",
+                     (unsigned long long) (rxRate + txRate));
+            addNotice(notices, sub->client, ResponseCode::InterfaceRateLimit, msg);
+            sub->rateAbove = above;
+        }
+    }
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _COUNTER_SAMPLER_H
+#define _COUNTER_SAMPLER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <net/if.h>
+
+#include <utils/List.h>
+
+class SocketClient;
+
+/* Samples kept per interface; the longest window is this many intervals */
+#define SAMPLER_HISTORY 64
+
+#define SAMPLER_DEFAULT_INTERVAL_MS 5000
+#define SAMPLER_MIN_INTERVAL_MS     500
+
+/* With no subscriptions, sampling stops this long after the last rates query */
+#define SAMPLER_IDLE_MS             60000
+
+/* Window "interface rates" uses when none is given */
+#define SAMPLER_DEFAULT_WINDOW_SECS 10
+
+struct CounterSample {
+    uint64_t timeMs;        // CLOCK_MONOTONIC
+    uint64_t rxBytes;
+    uint64_t rxPackets;
+    uint64_t txBytes;
+    uint64_t txPackets;
+};
+
+struct InterfaceRates {
+    uint64_t windowMs;      // Actually covered, which may differ from what was asked
+    uint64_t rxBytesPerSec;
+    uint64_t rxPacketsPerSec;
+    uint64_t txBytesPerSec;
+    uint64_t txPacketsPerSec;
+};
+
+struct SampledInterface {
+    char          name[IFNAMSIZ];
+    int           next;     // Slot the next sample goes in
+    int           count;
+    CounterSample samples[SAMPLER_HISTORY];
+    bool          seen;     // In the latest pass
+};
+
+typedef android::List<SampledInterface *> SampledInterfaceCollection;
+
+/*
+ * A client's interest in one interface: periodic reports, and one-shot or
+ * edge-triggered notices when the byte count or the rate crosses a limit.
+ * Zero leaves the corresponding part off.
+ */
+struct CounterSubscription {
+    SocketClient *client;   // ref counted
+    char         iface[IFNAMSIZ];
+    int          periodSecs;
+    uint64_t     bytesLimit;     // rx + tx bytes since the subscription was made
+    uint64_t     bytesBase;      // rx + tx counters at that point
+    bool         haveBase;       // Not until the interface has been sampled
+    uint64_t     rateLimit;      // rx + tx bytes/sec over the last interval
+    uint64_t     lastReportMs;
+    bool         bytesReached;
+    bool         rateAbove;
+};
+
+typedef android::List<CounterSubscription *> CounterSubscriptionCollection;
+
+/* A notice worked out under the lock, queued once it is dropped */
+struct PendingNotice {
+    SocketClient *client;   // ref counted
+    int          code;
+    char         *msg;
+};
+
+typedef android::List<PendingNotice> PendingNoticeCollection;
+
+/*
+ * Reads the counters of every interface in one pass at a fixed interval,
+ * on an EventLoop timer, and keeps a ring of recent samples per
+ * interface, so clients can ask for rates instead of polling the counters
+ * themselves. The timer only runs while someone subscribes or has asked
+ * for rates recently; an idle device is not woken to sample.
+ */
+class CounterSampler {
+    static CounterSampler *sInstance;
+
+    pthread_mutex_t               mLock;
+    pthread_mutex_t               mSampleLock; // Held across a whole sampleAll()
+    SampledInterfaceCollection    *mInterfaces;
+    CounterSubscriptionCollection *mSubscriptions;
+    int                           mIntervalMs;
+    int                           mTimer;     // EventLoop timer id, 0 while idle
+    uint64_t                      mLastQueryMs;
+
+public:
+    virtual ~CounterSampler();
+
+    static CounterSampler *Instance();
+
+    int setInterval(int intervalMs);
+    int getInterval();
+
+    /*
+     * Rates over the last windowSecs (at least 1, or as far back as the
+     * history goes, if that is shorter). After an idle spell the window
+     * stretches back to the last sample taken before it. -1 with ENODEV
+     * for an unknown interface and EAGAIN if there aren't two samples yet.
+     */
+    int getRates(const char *iface, int windowSecs, InterfaceRates *rates);
+
+    /*
+     * Replaces the client's subscription to iface. Notices go to that
+     * client alone, as 6xx messages, until it unsubscribes or goes away.
+     * bytesLimit counts traffic from the time of subscribing.
+     */
+    int subscribe(SocketClient *c, const char *iface, int periodSecs,
+                  uint64_t bytesLimit, uint64_t rateLimit);
+    int unsubscribe(SocketClient *c, const char *iface);
+    void removeClient(SocketClient *c);
+
+private:
+    CounterSampler();
+
+    static void timerFired(void *obj);
+    bool armLocked();
+    void sampleAll();
+    SampledInterface *findLocked(const char *iface);
+    void checkSubscriptionsLocked(uint64_t now, PendingNoticeCollection *notices);
+    static void addNotice(PendingNoticeCollection *notices, SocketClient *c, int code,
+                          char *msg);
+    static void freeSubscription(CounterSubscription *sub);
+};
+
+#endif
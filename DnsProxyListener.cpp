@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 
 #define LOG_TAG "DnsProxyListener"
 #define DBG 0
@@ -31,11 +32,16 @@
 #include <sysutils/SocketClient.h>
 
 #include "DnsProxyListener.h"
+#include "AddressSorter.h"
 
-DnsProxyListener::DnsProxyListener() :
-                 FrameworkListener("dnsproxyd") {
-    registerCmd(new GetAddrInfoCmd());
-    registerCmd(new GetHostByAddrCmd());
+DnsProxyListener::DnsProxyListener(ResolverController *resolverCtrl) :
+                 EpollListener("dnsproxyd") {
+    mQueue = new WorkQueue("dnsproxyd", DNS_PROXY_THREADS, DNS_PROXY_MAX_QUEUED);
+    if (mQueue->start()) {
+        LOGE("Unable to start dnsproxyd workers");
+    }
+    registerCmd(new GetAddrInfoCmd(resolverCtrl, mQueue));
+    registerCmd(new GetHostByAddrCmd(resolverCtrl, mQueue));
 }
 
 // Sends 4 bytes of big-endian length, followed by the data.
@@ -46,8 +52,171 @@ static bool sendLenAndData(SocketClient *c, const int len, const void* data) {
         (len == 0 || c->sendData(data, len) == 0);
 }
 
-DnsProxyListener::GetAddrInfoCmd::GetAddrInfoCmd() :
+// Returns true if the name can only be answered by a nameserver, i.e.
+// it is not an address literal and not a bare name like "localhost".
+static bool needsNameserver(const char *name, int ai_flags) {
+    unsigned char buf[sizeof(struct in6_addr)];
+
+    if (!name || (ai_flags != -1 && (ai_flags & AI_NUMERICHOST)))
+        return false;
+    if (inet_pton(AF_INET, name, buf) == 1 || inet_pton(AF_INET6, name, buf) == 1)
+        return false;
+    return strchr(name, '.') != NULL;
+}
+
+static uint64_t nowUs() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Lookups answered faster than this can't have left the device
+#define CACHE_HIT_MAX_US 1000
+
+static int cacheOutcome(bool needsServer, uint32_t latencyUs) {
+    if (!needsServer)
+        return DNS_QUERY_LOCAL;
+    return (latencyUs < CACHE_HIT_MAX_US) ? DNS_QUERY_CACHE_HIT : DNS_QUERY_CACHE_MISS;
+}
+
+/*
+ * Sends the TTL trailer: a big-endian count, then one big-endian TTL per
+ * entry. Bionic's getaddrinfo() drops the TTLs of the answer it used, and
+ * its resolver cache keeps the expiry of that answer to itself, so there
+ * is nothing true to report and every entry is DNS_PROXY_TTL_UNKNOWN.
+ */
+static bool sendTtls(SocketClient *c, struct addrinfo *result) {
+    struct addrinfo *ai;
+    int count = 0;
+
+    for (ai = result; ai; ai = ai->ai_next) {
+        count++;
+    }
+
+    uint32_t *ttls = (uint32_t *) malloc((count + 1) * sizeof(uint32_t));
+    if (!ttls) {
+        return false;
+    }
+    ttls[0] = htonl(count);
+    for (int i = 1; i <= count; i++) {
+        ttls[i] = htonl(DNS_PROXY_TTL_UNKNOWN);
+    }
+    bool success = (c->sendData(ttls, (count + 1) * sizeof(uint32_t)) == 0);
+    free(ttls);
+    return success;
+}
+
+DnsProxyListener::GetAddrInfoHandler::GetAddrInfoHandler(SocketClient *c,
+                                                          char *host,
+                                                          char *service,
+                                                          struct addrinfo *hints,
+                                                          int proxyFlags,
+                                                          ResolverController *resolverCtrl) {
+    mClient = c;
+    mHost = host;
+    mService = service;
+    mHints = hints;
+    mProxyFlags = proxyFlags;
+    mResolverCtrl = resolverCtrl;
+}
+
+DnsProxyListener::GetAddrInfoHandler::~GetAddrInfoHandler() {
+    free(mHost);
+    free(mService);
+    free(mHints);
+}
+
+void DnsProxyListener::GetAddrInfoHandler::start(void *obj) {
+    GetAddrInfoHandler *handler = reinterpret_cast<GetAddrInfoHandler *>(obj);
+
+    handler->run();
+    delete handler;
+}
+
+static int queryType(struct addrinfo *hints) {
+    int family = hints ? hints->ai_family : -1;
+
+    return (family == AF_INET ? 1 : (family == AF_INET6 ? 28 : 255));
+}
+
+void DnsProxyListener::GetAddrInfoHandler::reject() {
+    int rv = DNS_PROXY_EAI_OVERLOADED;
+
+    mResolverCtrl->getQueryLog()->record(mClient->getUid(), mHost, queryType(mHints),
+            DNS_QUERY_REJECTED, DNS_QUERY_SERVER_NONE, nowUs() / 1000, 0, rv);
+    if (mClient->sendData(&rv, sizeof(rv))) {
+        LOGW("Error writing DNS result to client");
+        dropClient(mClient);
+    }
+    mClient->decRef();
+}
+
+void DnsProxyListener::GetAddrInfoHandler::run() {
+    if (DBG) {
+        LOGD("GetAddrInfoHandler, now for %s / %s", mHost, mService);
+    }
+
+    struct addrinfo* result = NULL;
+    int ai_flags = mHints ? mHints->ai_flags : -1;
+    bool needsServer = needsNameserver(mHost, ai_flags);
+    int server = mResolverCtrl->getPrimaryServerIndex();
+    uint64_t start = nowUs();
+    uint64_t end;
+    int outcome;
+    int rv;
+    if (needsServer && mResolverCtrl->isDefaultInterfaceDark()) {
+        // Every nameserver is known to be down; don't wait out the timeouts
+        rv = EAI_AGAIN;
+        end = nowUs();
+        outcome = DNS_QUERY_FAILED_FAST;
+    } else {
+        rv = getaddrinfo(mHost, mService, mHints, &result);
+        end = nowUs();
+        outcome = cacheOutcome(needsServer, end - start);
+        if (needsServer) {
+            // A name that doesn't exist was still answered by the server
+            mResolverCtrl->reportLookup((end - start) / 1000,
+                                        rv == 0 || rv == EAI_NONAME);
+        }
+    }
+    mResolverCtrl->getQueryLog()->record(mClient->getUid(), mHost, queryType(mHints),
+            outcome, (needsServer ? server : DNS_QUERY_SERVER_NONE),
+            end / 1000, end - start, rv);
+    if (rv == 0) {
+        AddressSorter::Instance()->sort(&result);
+    }
+    bool success = (mClient->sendData(&rv, sizeof(rv)) == 0);
+    if (rv == 0) {
+        struct addrinfo* ai = result;
+        while (ai && success) {
+            success = sendLenAndData(mClient, sizeof(struct addrinfo), ai)
+                && sendLenAndData(mClient, ai->ai_addrlen, ai->ai_addr)
+                && sendLenAndData(mClient,
+                                  ai->ai_canonname ? strlen(ai->ai_canonname) + 1 : 0,
+                                  ai->ai_canonname);
+            ai = ai->ai_next;
+        }
+        success = success && sendLenAndData(mClient, 0, "");
+        if (mProxyFlags & DNS_PROXY_FLAG_TTL) {
+            success = success && sendTtls(mClient, result);
+        }
+    }
+    if (result) {
+        freeaddrinfo(result);
+    }
+    if (!success) {
+        LOGW("Error writing DNS result to client");
+        dropClient(mClient);
+    }
+    mClient->decRef();
+}
+
+DnsProxyListener::GetAddrInfoCmd::GetAddrInfoCmd(ResolverController *resolverCtrl,
+                                                 WorkQueue *queue) :
     NetdCommand("getaddrinfo") {
+    mResolverCtrl = resolverCtrl;
+    mQueue = queue;
 }
 
 int DnsProxyListener::GetAddrInfoCmd::runCommand(SocketClient *cli,
@@ -57,7 +226,8 @@ int DnsProxyListener::GetAddrInfoCmd::runCommand(SocketClient *cli,
             LOGD("argv[%i]=%s", i, argv[i]);
         }
     }
-    if (argc != 7) {
+    // Clients that understand an extended reply pass DNS_PROXY_FLAG_* last
+    if (argc != 7 && argc != 8) {
         LOGW("Invalid number of arguments to getaddrinfo: %i", argc);
         sendLenAndData(cli, 0, NULL);
         return -1;
@@ -82,6 +252,7 @@ int DnsProxyListener::GetAddrInfoCmd::runCommand(SocketClient *cli,
     int ai_family = atoi(argv[4]);
     int ai_socktype = atoi(argv[5]);
     int ai_protocol = atoi(argv[6]);
+    int proxyFlags = (argc == 8) ? atoi(argv[7]) : 0;
     if (ai_flags != -1 || ai_family != -1 ||
         ai_socktype != -1 || ai_protocol != -1) {
         hints = (struct addrinfo*) calloc(1, sizeof(struct addrinfo));
@@ -97,30 +268,13 @@ int DnsProxyListener::GetAddrInfoCmd::runCommand(SocketClient *cli,
              service ? service : "[nullservice]");
     }
 
-    if (DBG) {
-        LOGD("GetAddrInfoCmd, now for %s / %s", name, service);
-    }
-
-    struct addrinfo* result = NULL;
-    int rv = getaddrinfo(name, service, hints, &result);
-    bool success = (cli->sendData(&rv, sizeof(rv)) == 0);
-    if (rv == 0) {
-        struct addrinfo* ai = result;
-        while (ai && success) {
-            success = sendLenAndData(cli, sizeof(struct addrinfo), ai)
-                && sendLenAndData(cli, ai->ai_addrlen, ai->ai_addr)
-                && sendLenAndData(cli,
-                                  ai->ai_canonname ? strlen(ai->ai_canonname) + 1 : 0,
-                                  ai->ai_canonname);
-            ai = ai->ai_next;
-        }
-        success = success && sendLenAndData(cli, 0, "");
-    }
-    if (result) {
-        freeaddrinfo(result);
-    }
-    if (!success) {
-        LOGW("Error writing DNS result to client");
+    // The listener may drop the client while the lookup is still queued
+    cli->incRef();
+    GetAddrInfoHandler* handler =
+            new GetAddrInfoHandler(cli, name, service, hints, proxyFlags, mResolverCtrl);
+    if (!mQueue->enqueue(GetAddrInfoHandler::start, handler)) {
+        handler->reject();
+        delete handler;
     }
 
     return 0;
@@ -129,8 +283,79 @@ int DnsProxyListener::GetAddrInfoCmd::runCommand(SocketClient *cli,
 /*******************************************************
  *                  GetHostByAddr                       *
  *******************************************************/
-DnsProxyListener::GetHostByAddrCmd::GetHostByAddrCmd() :
+DnsProxyListener::GetHostByAddrHandler::GetHostByAddrHandler(SocketClient *c,
+                                                             const char *addrStr,
+                                                             void *address,
+                                                             int addressLen,
+                                                             int addressFamily,
+                                                             ResolverController *resolverCtrl) {
+    mClient = c;
+    mAddrStr = strdup(addrStr);
+    mAddress = address;
+    mAddressLen = addressLen;
+    mAddressFamily = addressFamily;
+    mResolverCtrl = resolverCtrl;
+}
+
+DnsProxyListener::GetHostByAddrHandler::~GetHostByAddrHandler() {
+    free(mAddrStr);
+    free(mAddress);
+}
+
+void DnsProxyListener::GetHostByAddrHandler::start(void *obj) {
+    GetHostByAddrHandler *handler = reinterpret_cast<GetHostByAddrHandler *>(obj);
+
+    handler->run();
+    delete handler;
+}
+
+void DnsProxyListener::GetHostByAddrHandler::reject() {
+    mResolverCtrl->getQueryLog()->record(mClient->getUid(), mAddrStr, 12,
+            DNS_QUERY_REJECTED, DNS_QUERY_SERVER_NONE, nowUs() / 1000, 0, TRY_AGAIN);
+    // The legacy reply has no error code; an empty name is all we can say
+    if (!sendLenAndData(mClient, 0, NULL)) {
+        LOGW("GetHostByAddrHandler: Error writing DNS result to client\n");
+        dropClient(mClient);
+    }
+    mClient->decRef();
+}
+
+void DnsProxyListener::GetHostByAddrHandler::run() {
+    struct hostent* hp;
+    int server = mResolverCtrl->getPrimaryServerIndex();
+    uint64_t start = nowUs();
+
+    // NOTE gethostbyaddr should take a void* but bionic thinks it should be char*
+    hp = gethostbyaddr((char*)mAddress, mAddressLen, mAddressFamily);
+
+    uint64_t end = nowUs();
+    mResolverCtrl->getQueryLog()->record(mClient->getUid(), mAddrStr, 12,
+            cacheOutcome(true, end - start), server, end / 1000, end - start,
+            hp ? 0 : h_errno);
+
+    if (DBG) {
+        LOGD("GetHostByAddrHandler::run gethostbyaddr errno: %s hp->h_name = %s, name_len = %d\n",
+                hp ? "success" : strerror(errno),
+                (hp && hp->h_name) ? hp->h_name: "null",
+                (hp && hp->h_name) ? strlen(hp->h_name)+ 1 : 0);
+    }
+
+    bool success = sendLenAndData(mClient, (hp && hp->h_name) ? strlen(hp->h_name)+ 1 : 0,
+            (hp && hp->h_name) ? hp->h_name : "");
+
+
+    if (!success) {
+        LOGW("GetHostByAddrHandler: Error writing DNS result to client\n");
+        dropClient(mClient);
+    }
+    mClient->decRef();
+}
+
+DnsProxyListener::GetHostByAddrCmd::GetHostByAddrCmd(ResolverController *resolverCtrl,
+                                                     WorkQueue *queue) :
         NetdCommand("gethostbyaddr") {
+    mResolverCtrl = resolverCtrl;
+    mQueue = queue;
 }
 
 int DnsProxyListener::GetHostByAddrCmd::runCommand(SocketClient *cli,
@@ -160,24 +385,12 @@ int DnsProxyListener::GetHostByAddrCmd::runCommand(SocketClient *cli,
         return -1;
     }
 
-    struct hostent* hp;
-
-    // NOTE gethostbyaddr should take a void* but bionic thinks it should be char*
-    hp = gethostbyaddr((char*)addr, addrLen, addrFamily);
-
-    if (DBG) {
-        LOGD("GetHostByAddrCmd::runCommand gethostbyaddr errno: %s hp->h_name = %s, name_len = %d\n",
-                hp ? "success" : strerror(errno),
-                (hp && hp->h_name) ? hp->h_name: "null",
-                (hp && hp->h_name) ? strlen(hp->h_name)+ 1 : 0);
-    }
-
-    bool success = sendLenAndData(cli, (hp && hp->h_name) ? strlen(hp->h_name)+ 1 : 0,
-            (hp && hp->h_name) ? hp->h_name : "");
-
-
-    if (!success) {
-        LOGW("GetHostByAddrCmd: Error writing DNS result to client\n");
+    cli->incRef();
+    GetHostByAddrHandler* handler = new GetHostByAddrHandler(cli, addrStr, addr,
+            addrLen, addrFamily, mResolverCtrl);
+    if (!mQueue->enqueue(GetHostByAddrHandler::start, handler)) {
+        handler->reject();
+        delete handler;
     }
 
     return 0;
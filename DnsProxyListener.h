@@ -18,31 +18,110 @@
 #define _DNSPROXYLISTENER_H__
 
 #include <pthread.h>
-#include <sysutils/FrameworkListener.h>
 
+#include "EpollListener.h"
 #include "NetdCommand.h"
+#include "ResolverController.h"
+#include "WorkQueue.h"
+
+/*
+ * Lookups run on DNS_PROXY_THREADS threads, with up to DNS_PROXY_MAX_QUEUED
+ * more waiting for one. Anything beyond that is refused straight away.
+ */
+#define DNS_PROXY_THREADS       8
+#define DNS_PROXY_MAX_QUEUED    64
+
+/*
+ * getaddrinfo() result sent when a request is refused for overload. It is
+ * outside the range of EAI_* codes so clients can tell it from a failed
+ * lookup and back off.
+ */
+#define DNS_PROXY_EAI_OVERLOADED    100
+
+/*
+ * Optional last argument to getaddrinfo. With DNS_PROXY_FLAG_TTL set, a
+ * successful reply is followed, after the usual zero-length terminator,
+ * by a 4 byte big-endian count and then that many 4 byte big-endian TTLs
+ * in seconds, one per returned addrinfo in order. The resolver doesn't
+ * tell netd how long its answers have left, so for now every TTL is
+ * DNS_PROXY_TTL_UNKNOWN and clients fall back to their own policy.
+ * Clients that send 7 arguments get the legacy reply unchanged.
+ */
+#define DNS_PROXY_FLAG_TTL          0x1
+#define DNS_PROXY_TTL_UNKNOWN       0xffffffff
+
+class DnsProxyListener : public EpollListener {
+    WorkQueue *mQueue;
 
-class DnsProxyListener : public FrameworkListener {
 public:
-    DnsProxyListener();
+    DnsProxyListener(ResolverController *resolverCtrl);
     virtual ~DnsProxyListener() {}
 
+    void getQueueStats(WorkQueueStats *stats) { mQueue->getStats(stats); }
+
 private:
     class GetAddrInfoCmd : public NetdCommand {
+        ResolverController *mResolverCtrl;
+        WorkQueue          *mQueue;
+
     public:
-        GetAddrInfoCmd();
+        GetAddrInfoCmd(ResolverController *resolverCtrl, WorkQueue *queue);
         virtual ~GetAddrInfoCmd() {}
         int runCommand(SocketClient *c, int argc, char** argv);
     };
 
+    class GetAddrInfoHandler {
+        SocketClient       *mClient;   // ref counted
+        char               *mHost;     // owned
+        char               *mService;  // owned
+        struct addrinfo    *mHints;    // owned
+        int                mProxyFlags;
+        ResolverController *mResolverCtrl;
+
+    public:
+        GetAddrInfoHandler(SocketClient *c, char *host, char *service,
+                           struct addrinfo *hints, int proxyFlags,
+                           ResolverController *resolverCtrl);
+        ~GetAddrInfoHandler();
+
+        static void start(void *obj);
+        void reject();
+
+    private:
+        void run();
+    };
+
     /* ------ gethostbyaddr ------*/
     class GetHostByAddrCmd : public NetdCommand {
+        ResolverController *mResolverCtrl;
+        WorkQueue          *mQueue;
+
     public:
-        GetHostByAddrCmd();
+        GetHostByAddrCmd(ResolverController *resolverCtrl, WorkQueue *queue);
         virtual ~GetHostByAddrCmd() {}
         int runCommand(SocketClient *c, int argc, char** argv);
     };
 
+    class GetHostByAddrHandler {
+        SocketClient       *mClient;   // ref counted
+        char               *mAddrStr;  // owned
+        void               *mAddress;  // owned
+        int                mAddressLen;
+        int                mAddressFamily;
+        ResolverController *mResolverCtrl;
+
+    public:
+        GetHostByAddrHandler(SocketClient *c, const char *addrStr, void *address,
+                             int addressLen, int addressFamily,
+                             ResolverController *resolverCtrl);
+        ~GetHostByAddrHandler();
+
+        static void start(void *obj);
+        void reject();
+
+    private:
+        void run();
+    };
 };
 
 #endif
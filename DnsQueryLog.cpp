@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_TAG "DnsQueryLog"
+#include <cutils/log.h>
+#include <cutils/atomic.h>
+#include <cutils/atomic-inline.h>
+
+#include "DnsQueryLog.h"
+
+// The decoder relies on the exact record layout
+typedef char DnsQueryRecordSizeCheck[sizeof(DnsQueryRecord) == 32 ? 1 : -1];
+
+DnsQueryLog::DnsQueryLog() {
+    mNext = 0;
+    memset(mRecords, 0, sizeof(mRecords));
+}
+
+uint32_t DnsQueryLog::hashName(const char *name) {
+    uint32_t hash = 2166136261u;
+
+    if (!name)
+        return 0;
+    for (; *name; name++) {
+        unsigned char c = *name;
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
+
+void DnsQueryLog::record(uid_t uid, const char *name, int qtype, int cacheOutcome,
+                         int server, uint64_t timestampMs, uint32_t latencyUs, int result) {
+    uint32_t seq = (uint32_t) android_atomic_inc(&mNext) + 1;
+    DnsQueryRecord *r = &mRecords[(seq - 1) & (LOG_SIZE - 1)];
+
+    // Mark the slot busy; the barrier keeps the payload stores after it
+    android_atomic_release_store(0, (volatile int32_t *) &r->seq);
+    ANDROID_MEMBAR_FULL();
+    r->uid = uid;
+    r->timestampMs = timestampMs;
+    r->nameHash = hashName(name);
+    r->qtype = qtype;
+    r->cacheOutcome = cacheOutcome;
+    r->server = server;
+    r->latencyUs = latencyUs;
+    r->result = result;
+    android_atomic_release_store(seq ? seq : 1, (volatile int32_t *) &r->seq);
+}
+
+char *DnsQueryLog::dump() {
+    DnsQueryRecord *ordered = (DnsQueryRecord *) malloc(sizeof(mRecords));
+    if (!ordered) {
+        return NULL;
+    }
+
+    uint32_t next = (uint32_t) android_atomic_acquire_load(&mNext);
+
+    DnsQueryLogHeader hdr;
+    struct timespec ts;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = DNS_QUERY_LOG_MAGIC;
+    hdr.recordSize = sizeof(DnsQueryRecord);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    hdr.nowMonotonicMs = (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    hdr.nowRealtimeMs = (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+    /*
+     * Walk from the oldest slot, reading each as a seqlock: a slot whose
+     * seq was 0 (mid-write) or changed while it was copied is dropped.
+     */
+    for (int i = 0; i < LOG_SIZE; i++) {
+        DnsQueryRecord *r = &mRecords[(next + i) & (LOG_SIZE - 1)];
+        volatile int32_t *seqp = (volatile int32_t *) &r->seq;
+        int32_t seq = android_atomic_acquire_load(seqp);
+
+        if (!seq) {
+            continue;
+        }
+        ordered[hdr.numRecords] = *r;
+        ANDROID_MEMBAR_FULL();
+        if (android_atomic_acquire_load(seqp) == seq) {
+            hdr.numRecords++;
+        }
+    }
+
+    static const char hex[] = "0123456789abcdef";
+    size_t len = sizeof(hdr) + hdr.numRecords * sizeof(DnsQueryRecord);
+    char *out = (char *) malloc(len * 2 + 1);
+    if (out) {
+        const unsigned char *src = (const unsigned char *) &hdr;
+        char *p = out;
+
+        for (size_t i = 0; i < len; i++) {
+            unsigned char b = (i < sizeof(hdr)) ? src[i] :
+                    ((const unsigned char *) ordered)[i - sizeof(hdr)];
+            *p++ = hex[b >> 4];
+            *p++ = hex[b & 0x0f];
+        }
+        *p = '\0';
+    }
+    free(ordered);
+    return out;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DNS_QUERY_LOG_H
+#define _DNS_QUERY_LOG_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "DnsQueryRecord.h"
+
+/*
+ * Fixed-size ring of the most recent dnsproxyd requests. Writers claim a
+ * slot with one atomic increment and never block. Each slot's seq works as
+ * a seqlock, so a reader copying the ring skips slots that were written
+ * while it read them.
+ */
+class DnsQueryLog {
+public:
+    /* Must be a power of two */
+    static const int LOG_SIZE = 1024;
+
+private:
+    volatile int32_t mNext;
+    DnsQueryRecord   mRecords[LOG_SIZE];
+
+public:
+    DnsQueryLog();
+    virtual ~DnsQueryLog() {}
+
+    void record(uid_t uid, const char *name, int qtype, int cacheOutcome,
+                int server, uint64_t timestampMs, uint32_t latencyUs, int result);
+
+    /*
+     * Returns the header and records, oldest first, hex-encoded in one
+     * malloc'd string suitable for a single response.
+     */
+    char *dump();
+
+    static uint32_t hashName(const char *name);
+};
+
+#endif
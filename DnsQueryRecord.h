@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DNS_QUERY_RECORD_H
+#define _DNS_QUERY_RECORD_H
+
+/*
+ * Binary layout of the dnsproxyd query log, shared by netd and the host
+ * side decoder (querylogdump). All fields are little-endian and naturally
+ * aligned, so the structs have no padding.
+ *
+ * A dump is a DnsQueryLogHeader followed by numRecords DnsQueryRecords,
+ * oldest first, sent hex-encoded as the text of one response.
+ */
+
+#include <stdint.h>
+
+#define DNS_QUERY_LOG_MAGIC     0x314c5144  /* "DQL1" */
+
+/* Values of DnsQueryRecord.cacheOutcome */
+#define DNS_QUERY_LOCAL         0   /* Literal or local name, no nameserver involved */
+#define DNS_QUERY_CACHE_HIT     1   /* Answered too fast to have left the device */
+#define DNS_QUERY_CACHE_MISS    2
+#define DNS_QUERY_FAILED_FAST   3   /* Rejected without a lookup (no nameserver up) */
+#define DNS_QUERY_REJECTED      4   /* Refused because dnsproxyd was overloaded */
+
+/* Value of DnsQueryRecord.server when it isn't known */
+#define DNS_QUERY_SERVER_NONE   0xff
+
+struct DnsQueryLogHeader {
+    uint32_t magic;
+    uint16_t recordSize;
+    uint16_t numRecords;
+    uint64_t nowMonotonicMs;   /* Clocks at dump time, to place the records */
+    uint64_t nowRealtimeMs;
+};
+
+struct DnsQueryRecord {
+    uint32_t seq;              /* 0 while the slot is being written */
+    uint32_t uid;
+    uint64_t timestampMs;      /* CLOCK_MONOTONIC at completion */
+    uint32_t nameHash;         /* FNV-1a of the lowercased name */
+    uint16_t qtype;            /* 1 A, 28 AAAA, 255 A+AAAA, 12 PTR */
+    uint8_t  cacheOutcome;
+    uint8_t  server;           /* Index of the first nameserver in use */
+    uint32_t latencyUs;
+    int32_t  result;           /* EAI_* for getaddrinfo, h_errno for PTR */
+};
+
+#endif
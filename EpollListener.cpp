@@ -0,0 +1,397 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define LOG_TAG "EpollListener"
+#include <cutils/log.h>
+#include <cutils/sockets.h>
+
+#include <sysutils/SocketClient.h>
+
+#include "EpollListener.h"
+#include "EventLoop.h"
+#include "ResponseCode.h"
+#include "WorkQueue.h"
+
+WorkQueue *EpollListener::sNotices = NULL;
+
+EpollListener::EpollListener(const char *socketName) {
+    mSocketName = socketName;
+    mSock = -1;
+    pthread_mutex_init(&mClientsLock, NULL);
+    mClients = new EpollClientCollection();
+    mCommands = new FrameworkCommandCollection();
+}
+
+EpollListener::~EpollListener() {
+    delete mClients;
+    delete mCommands;
+}
+
+void EpollListener::dropClient(SocketClient *c) {
+    LOGW("Disconnecting a client that a write failed on (%s)", strerror(errno));
+    shutdown(c->getSocket(), SHUT_RDWR);
+}
+
+/* For the errors sent from the loop's thread */
+static void sendSyntaxError(SocketClient *c, const char *msg) {
+    if (c->sendMsg(ResponseCode::CommandSyntaxError, msg, false)) {
+        EpollListener::dropClient(c);
+    }
+}
+
+void EpollListener::registerCmd(FrameworkCommand *cmd) {
+    mCommands->push_back(cmd);
+}
+
+int EpollListener::startListener() {
+    if ((mSock = android_get_control_socket(mSocketName)) < 0) {
+        LOGE("Obtaining file descriptor socket '%s' failed: %s",
+             mSocketName, strerror(errno));
+        return -1;
+    }
+    if (listen(mSock, 4) < 0) {
+        LOGE("Unable to listen on socket (%s)", strerror(errno));
+        return -1;
+    }
+    // Accepted in a loop until EAGAIN, as the socket is edge triggered
+    fcntl(mSock, F_SETFL, fcntl(mSock, F_GETFL) | O_NONBLOCK);
+
+    // Shared by every listener, and started with the first
+    if (!sNotices) {
+        sNotices = new WorkQueue("notice", EPOLL_NOTICE_THREADS, EPOLL_NOTICE_MAX_QUEUED,
+                                 EPOLL_NOTICE_MAX_PER_CLIENT);
+        if (sNotices->start()) {
+            LOGE("Unable to start notice writers");
+            return -1;
+        }
+    }
+
+    if (EventLoop::Instance()->addFd(mSock, EPOLLIN | EPOLLET, EpollListener::acceptReady,
+                                     this)) {
+        LOGE("Unable to watch socket (%s)", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* Must be called on the event loop's thread */
+int EpollListener::stopListener() {
+    if (EventLoop::Instance()->removeFd(mSock)) {
+        LOGE("Unable to stop watching socket (%s)", strerror(errno));
+        return -1;
+    }
+    while (!mClients->empty()) {
+        closeClient(*mClients->begin());
+    }
+    return 0;
+}
+
+void EpollListener::acceptReady(void *obj, int fd) {
+    reinterpret_cast<EpollListener *>(obj)->acceptClients();
+}
+
+void EpollListener::clientReady(void *obj, int fd) {
+    EpollClient *ec = reinterpret_cast<EpollClient *>(obj);
+
+    if (!ec->listener->readClient(ec)) {
+        ec->listener->closeClient(ec);
+    }
+}
+
+void EpollListener::acceptClients() {
+    while (1) {
+        struct sockaddr addr;
+        socklen_t alen = sizeof(addr);
+        int c = TEMP_FAILURE_RETRY(accept(mSock, &addr, &alen));
+
+        if (c < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOGE("accept failed (%s)", strerror(errno));
+            }
+            return;
+        }
+
+        EpollClient *ec = (EpollClient *) malloc(sizeof(EpollClient));
+        if (!ec) {
+            LOGE("No memory for a new client");
+            close(c);
+            continue;
+        }
+        // Even a reply written on the loop's thread can only stall it so long
+        struct timeval tv;
+        tv.tv_sec = EPOLL_SEND_TIMEOUT_SECS;
+        tv.tv_usec = 0;
+        setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        ec->listener = this;
+        ec->client = new SocketClient(c, true);
+        ec->len = 0;
+        ec->discard = false;
+
+        pthread_mutex_lock(&mClientsLock);
+        mClients->push_back(ec);
+        pthread_mutex_unlock(&mClientsLock);
+
+        // Anything the client already sent is reported straight away
+        if (EventLoop::Instance()->addFd(c, EPOLLIN | EPOLLET, EpollListener::clientReady, ec)) {
+            LOGE("Unable to watch client (%s)", strerror(errno));
+            closeClient(ec);
+        }
+    }
+}
+
+/*
+ * Reads until the socket is drained, dispatching every complete command
+ * and keeping the unfinished tail for next time. The socket itself stays
+ * blocking so that replies are written out in full, up to the send
+ * timeout. Returns false once the client has gone.
+ */
+bool EpollListener::readClient(EpollClient *ec) {
+    int fd = ec->client->getSocket();
+
+    while (1) {
+        int n = TEMP_FAILURE_RETRY(recv(fd, ec->buf + ec->len, sizeof(ec->buf) - ec->len,
+                                        MSG_DONTWAIT));
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            // A client that hangs up with replies unread is reset, not an error
+            if (errno != ECONNRESET) {
+                LOGE("read() failed (%s)", strerror(errno));
+            }
+            return false;
+        }
+        if (n == 0) {
+            return false;
+        }
+
+        int start = 0;
+        int end = ec->len + n;
+        for (int i = ec->len; i < end; i++) {
+            if (ec->buf[i] != '\0') {
+                continue;
+            }
+            if (ec->discard) {
+                ec->discard = false;
+            } else {
+                dispatchCommand(ec->client, ec->buf + start);
+            }
+            start = i + 1;
+        }
+
+        if (ec->discard) {
+            ec->len = 0;
+            continue;
+        }
+        ec->len = end - start;
+        memmove(ec->buf, ec->buf + start, ec->len);
+        if (ec->len == (int) sizeof(ec->buf)) {
+            sendSyntaxError(ec->client, "Command too long");
+            ec->len = 0;
+            ec->discard = true;
+        }
+    }
+}
+
+void EpollListener::closeClient(EpollClient *ec) {
+    EpollClientCollection::iterator it;
+
+    EventLoop::Instance()->removeFd(ec->client->getSocket());
+    onClientClosed(ec->client);
+
+    pthread_mutex_lock(&mClientsLock);
+    for (it = mClients->begin(); it != mClients->end(); ++it) {
+        if (*it == ec) {
+            mClients->erase(it);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mClientsLock);
+
+    ec->client->decRef();
+    free(ec);
+}
+
+void EpollListener::sendBroadcast(int code, const char *msg, bool addErrno) {
+    EpollClientCollection::iterator it;
+    char *buf = NULL;
+
+    // Formatted once, before anything can change errno
+    if (addErrno) {
+        if (asprintf(&buf, "%s (%s)", msg, strerror(errno)) < 0) {
+            return;
+        }
+        msg = buf;
+    }
+
+    pthread_mutex_lock(&mClientsLock);
+    for (it = mClients->begin(); it != mClients->end(); ++it) {
+        if (!sendNotice((*it)->client, code, msg, false)) {
+            LOGW("Dropped broadcast %d to a client that is behind", code);
+        }
+    }
+    pthread_mutex_unlock(&mClientsLock);
+    free(buf);
+}
+
+bool EpollListener::sendNotice(SocketClient *c, int code, const char *msg, bool addErrno) {
+    Notice *n = (Notice *) malloc(sizeof(Notice));
+
+    if (!n) {
+        return false;
+    }
+    n->msg = NULL;
+    if ((addErrno ? asprintf(&n->msg, "%s (%s)", msg, strerror(errno)) :
+                    asprintf(&n->msg, "%s", msg)) < 0) {
+        free(n);
+        return false;
+    }
+    c->incRef();
+    n->client = c;
+    n->code = code;
+
+    // Keyed on the client, so its notices go out one at a time and in order
+    if (!sNotices || !sNotices->enqueue(EpollListener::runNotice, n, c, false)) {
+        c->decRef();
+        free(n->msg);
+        free(n);
+        return false;
+    }
+    return true;
+}
+
+void EpollListener::runNotice(void *arg) {
+    Notice *n = reinterpret_cast<Notice *>(arg);
+
+    if (n->client->sendMsg(n->code, n->msg, false)) {
+        dropClient(n->client);
+    }
+    n->client->decRef();
+    free(n->msg);
+    free(n);
+}
+
+void EpollListener::dispatchCommand(SocketClient *cli, char *data) {
+    char *argv[CMD_ARGS_MAX + 1];
+    FrameworkCommandCollection::iterator it;
+    int argc = parseArgs(cli, data, argv);
+
+    if (argc < 0) {
+        return;
+    }
+    if (!argc) {
+        sendSyntaxError(cli, "Missing command");
+        return;
+    }
+
+    for (it = mCommands->begin(); it != mCommands->end(); ++it) {
+        FrameworkCommand *c = *it;
+
+        if (!strcmp(argv[0], c->getCommand())) {
+            if (c->runCommand(cli, argc, argv)) {
+                LOGW("Handler '%s' error (%s)", c->getCommand(), strerror(errno));
+            }
+            break;
+        }
+    }
+    if (it == mCommands->end()) {
+        sendSyntaxError(cli, "Command not recognized");
+    }
+
+    for (int i = 0; i < argc; i++) {
+        free(argv[i]);
+    }
+}
+
+int EpollListener::parseArgs(SocketClient *cli, const char *data, char **argv) {
+    char tmp[EPOLL_CMD_MAX];
+    const char *p = data;
+    char *q = tmp;
+    bool esc = false;
+    bool quote = false;
+    bool token = false;     // Started a token, even an empty quoted one
+    const char *err = NULL;
+    int argc = 0;
+
+    memset(argv, 0, (CMD_ARGS_MAX + 1) * sizeof(argv[0]));
+    while (*p) {
+        if (esc) {
+            if (*p != '"' && *p != '\\') {
+                err = "Unsupported escape sequence";
+                goto fail;
+            }
+            *q++ = *p++;
+            esc = false;
+            token = true;
+            continue;
+        }
+        if (*p == '\\') {
+            esc = true;
+            p++;
+            continue;
+        }
+        if (*p == '"') {
+            quote = !quote;
+            token = true;
+            p++;
+            continue;
+        }
+        if (!quote && *p == ' ') {
+            p++;
+            if (!token) {
+                continue;
+            }
+            *q = '\0';
+            if (argc == CMD_ARGS_MAX) {
+                err = "Too many arguments";
+                goto fail;
+            }
+            argv[argc++] = strdup(tmp);
+            q = tmp;
+            token = false;
+            continue;
+        }
+        *q++ = *p++;
+        token = true;
+    }
+    if (token) {
+        *q = '\0';
+        if (argc == CMD_ARGS_MAX) {
+            err = "Too many arguments";
+            goto fail;
+        }
+        argv[argc++] = strdup(tmp);
+    }
+    return argc;
+
+fail:
+    sendSyntaxError(cli, err);
+    for (int i = 0; i < argc; i++) {
+        free(argv[i]);
+        argv[i] = NULL;
+    }
+    return -1;
+}
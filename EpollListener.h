@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _EPOLL_LISTENER_H
+#define _EPOLL_LISTENER_H
+
+#include <pthread.h>
+#include <sysutils/FrameworkCommand.h>
+#include <utils/List.h>
+
+class SocketClient;
+
+class EpollListener;
+class WorkQueue;
+
+/* Longest command a client may send, including its terminating NUL */
+#define EPOLL_CMD_MAX       1024
+
+/*
+ * Broadcasts and other unsolicited messages are written by these threads,
+ * never by the caller. A client with this many still unsent has its
+ * newer ones dropped.
+ */
+#define EPOLL_NOTICE_THREADS        2
+#define EPOLL_NOTICE_MAX_QUEUED     128
+#define EPOLL_NOTICE_MAX_PER_CLIENT 16
+
+/* A client that takes no data for this long is disconnected */
+#define EPOLL_SEND_TIMEOUT_SECS     5
+
+struct EpollClient {
+    EpollListener *listener;
+    SocketClient  *client;      // ref counted
+    int           len;          // Bytes of an unfinished command in buf
+    bool          discard;      // Dropping the rest of an over-long command
+    char          buf[EPOLL_CMD_MAX];
+};
+
+typedef android::List<EpollClient *> EpollClientCollection;
+
+/*
+ * Serves a framework control socket, like FrameworkListener, but from the
+ * EventLoop's epoll set instead of a select() thread of its own. Each
+ * client is registered once, edge triggered, and keeps its own buffer, so
+ * a wakeup only touches the clients that have something to read, a
+ * command may arrive in pieces, and there is no FD_SETSIZE limit on how
+ * many clients connect.
+ */
+class EpollListener {
+public:
+    static const int CMD_ARGS_MAX = 16;
+
+private:
+    static WorkQueue           *sNotices;
+
+    const char                 *mSocketName;
+    int                        mSock;
+    pthread_mutex_t            mClientsLock;
+    EpollClientCollection      *mClients;
+    FrameworkCommandCollection *mCommands;
+
+public:
+    EpollListener(const char *socketName);
+    virtual ~EpollListener();
+
+    int startListener();
+    int stopListener();
+
+    void sendBroadcast(int code, const char *msg, bool addErrno);
+
+    /*
+     * Queues a message for c alone and returns without waiting for it to
+     * be written; false if it was dropped. A client the write fails on is
+     * disconnected.
+     */
+    static bool sendNotice(SocketClient *c, int code, const char *msg, bool addErrno);
+
+    /*
+     * Disconnects a client a write to has failed or timed out. Part of a
+     * message may have gone out, so nothing more can be sent without the
+     * client misreading it; the loop sees the socket close and cleans up
+     * as usual.
+     */
+    static void dropClient(SocketClient *c);
+
+protected:
+    void registerCmd(FrameworkCommand *cmd);
+
+    /* Handles one complete command; data is NUL-terminated */
+    virtual void dispatchCommand(SocketClient *c, char *data);
+
+    /* Called once a client has hung up, before its last reference goes */
+    virtual void onClientClosed(SocketClient *c) {}
+
+    /*
+     * Splits a command into at most CMD_ARGS_MAX strdup()ed arguments,
+     * honouring double quotes and backslash escapes. On a syntax error
+     * the client is told and -1 is returned with nothing to free.
+     */
+    static int parseArgs(SocketClient *c, const char *data, char **argv);
+
+private:
+    struct Notice {
+        SocketClient *client;   // ref counted
+        int          code;
+        char         *msg;
+    };
+
+    static void runNotice(void *arg);
+    static void acceptReady(void *obj, int fd);
+    static void clientReady(void *obj, int fd);
+    void acceptClients();
+    bool readClient(EpollClient *ec);
+    void closeClient(EpollClient *ec);
+};
+
+#endif
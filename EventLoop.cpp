@@ -0,0 +1,401 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+
+#define LOG_TAG "EventLoop"
+#include <cutils/log.h>
+
+#include "EventLoop.h"
+
+EventLoop *EventLoop::sInstance = NULL;
+int EventLoop::sWakeFd = -1;
+
+EventLoop *EventLoop::Instance() {
+    if (!sInstance)
+        sInstance = new EventLoop();
+    return sInstance;
+}
+
+EventLoop::EventLoop() {
+    struct epoll_event ev;
+    struct sigaction sa;
+
+    pthread_mutex_init(&mLock, NULL);
+    mFds = new EventFdCollection();
+    mTimers = new EventTimerCollection();
+    mChildren = new EventChildCollection();
+    mNextTimerId = 1;
+    mWakePipe[0] = mWakePipe[1] = -1;
+
+    if ((mEpollFd = epoll_create(EVENT_LOOP_MAX_EVENTS)) < 0) {
+        LOGE("epoll_create failed (%s)", strerror(errno));
+        return;
+    }
+    if (pipe(mWakePipe)) {
+        LOGE("pipe failed (%s)", strerror(errno));
+        return;
+    }
+    // A burst of signals must never block the handler
+    fcntl(mWakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(mWakePipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(mWakePipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(mWakePipe[1], F_SETFD, FD_CLOEXEC);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakePipe[0], &ev)) {
+        LOGE("Unable to watch wake pipe (%s)", strerror(errno));
+        return;
+    }
+
+    sWakeFd = mWakePipe[1];
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = EventLoop::sigchld;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+
+    /*
+     * Only the loop takes SIGCHLD, so it can't cut short a sleep or a read
+     * on another thread. Every thread netd starts comes after this and
+     * inherits the mask; run() lifts it on the loop's own thread, and
+     * children get the default back before they exec.
+     */
+    blockChildSignal(SIG_BLOCK);
+    pthread_atfork(NULL, NULL, EventLoop::forkedChild);
+}
+
+EventLoop::~EventLoop() {
+}
+
+static uint64_t nowMs() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void EventLoop::sigchld(int sig) {
+    int saved = errno;
+    char c = 'c';
+
+    write(sWakeFd, &c, 1);
+    errno = saved;
+}
+
+void EventLoop::blockChildSignal(int how) {
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(how, &mask, NULL);
+}
+
+void EventLoop::forkedChild() {
+    blockChildSignal(SIG_UNBLOCK);
+}
+
+void EventLoop::wake() {
+    char c = 'w';
+
+    write(mWakePipe[1], &c, 1);
+}
+
+int EventLoop::addFd(int fd, uint32_t events, EventFdCallback callback, void *obj) {
+    EventFd *ef = (EventFd *) malloc(sizeof(EventFd));
+    struct epoll_event ev;
+
+    if (!ef) {
+        return -1;
+    }
+    ef->fd = fd;
+    ef->callback = callback;
+    ef->obj = obj;
+    ef->removed = false;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = ef;
+
+    pthread_mutex_lock(&mLock);
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev)) {
+        int saved = errno;
+        pthread_mutex_unlock(&mLock);
+        free(ef);
+        errno = saved;
+        return -1;
+    }
+    mFds->push_back(ef);
+    pthread_mutex_unlock(&mLock);
+    return 0;
+}
+
+int EventLoop::removeFd(int fd) {
+    EventFdCollection::iterator it;
+    struct epoll_event ev;
+
+    pthread_mutex_lock(&mLock);
+    for (it = mFds->begin(); it != mFds->end(); ++it) {
+        if ((*it)->fd == fd && !(*it)->removed) {
+            break;
+        }
+    }
+    if (it == mFds->end()) {
+        pthread_mutex_unlock(&mLock);
+        errno = ENOENT;
+        return -1;
+    }
+    // Pre-2.6.9 kernels insist on an event even for EPOLL_CTL_DEL
+    memset(&ev, 0, sizeof(ev));
+    epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, &ev);
+    (*it)->removed = true;
+    pthread_mutex_unlock(&mLock);
+    return 0;
+}
+
+int EventLoop::addTimer(int intervalMs, EventTimerCallback callback, void *obj) {
+    EventTimer *et = (EventTimer *) malloc(sizeof(EventTimer));
+
+    if (!et) {
+        return -1;
+    }
+    et->intervalMs = intervalMs;
+    et->dueMs = nowMs() + intervalMs;
+    et->callback = callback;
+    et->obj = obj;
+
+    pthread_mutex_lock(&mLock);
+    et->id = mNextTimerId++;
+    mTimers->push_back(et);
+    pthread_mutex_unlock(&mLock);
+    wake();
+    return et->id;
+}
+
+int EventLoop::setTimerInterval(int id, int intervalMs) {
+    EventTimerCollection::iterator it;
+
+    pthread_mutex_lock(&mLock);
+    for (it = mTimers->begin(); it != mTimers->end(); ++it) {
+        if ((*it)->id == id) {
+            (*it)->intervalMs = intervalMs;
+            (*it)->dueMs = nowMs() + intervalMs;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+    if (it == mTimers->end()) {
+        errno = ENOENT;
+        return -1;
+    }
+    wake();
+    return 0;
+}
+
+int EventLoop::removeTimer(int id) {
+    EventTimerCollection::iterator it;
+
+    pthread_mutex_lock(&mLock);
+    for (it = mTimers->begin(); it != mTimers->end(); ++it) {
+        if ((*it)->id == id) {
+            free(*it);
+            mTimers->erase(it);
+            pthread_mutex_unlock(&mLock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+    errno = ENOENT;
+    return -1;
+}
+
+int EventLoop::watchChild(pid_t pid, EventChildCallback callback, void *obj) {
+    EventChild *ec = (EventChild *) malloc(sizeof(EventChild));
+
+    if (!ec) {
+        return -1;
+    }
+    ec->pid = pid;
+    ec->callback = callback;
+    ec->obj = obj;
+
+    pthread_mutex_lock(&mLock);
+    mChildren->push_back(ec);
+    pthread_mutex_unlock(&mLock);
+
+    // It may have exited before it was watched
+    wake();
+    return 0;
+}
+
+int EventLoop::unwatchChild(pid_t pid) {
+    EventChildCollection::iterator it;
+
+    pthread_mutex_lock(&mLock);
+    for (it = mChildren->begin(); it != mChildren->end(); ++it) {
+        if ((*it)->pid == pid) {
+            free(*it);
+            mChildren->erase(it);
+            pthread_mutex_unlock(&mLock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+    errno = ENOENT;
+    return -1;
+}
+
+int EventLoop::nextTimeout() {
+    EventTimerCollection::iterator it;
+    uint64_t now = nowMs();
+    int timeout = -1;
+
+    pthread_mutex_lock(&mLock);
+    for (it = mTimers->begin(); it != mTimers->end(); ++it) {
+        int left = (*it)->dueMs > now ? (int) ((*it)->dueMs - now) : 0;
+        if (timeout < 0 || left < timeout) {
+            timeout = left;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+    return timeout;
+}
+
+/*
+ * Runs every timer that is due. A timer is rescheduled before its
+ * callback runs, so one that overruns is not run again straight away.
+ */
+void EventLoop::runTimers() {
+    uint64_t now = nowMs();
+
+    while (1) {
+        EventTimerCollection::iterator it;
+        EventTimerCallback callback = NULL;
+        void *obj = NULL;
+
+        pthread_mutex_lock(&mLock);
+        for (it = mTimers->begin(); it != mTimers->end(); ++it) {
+            if ((*it)->dueMs <= now) {
+                (*it)->dueMs = now + (*it)->intervalMs;
+                callback = (*it)->callback;
+                obj = (*it)->obj;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&mLock);
+
+        if (!callback) {
+            return;
+        }
+        callback(obj);
+    }
+}
+
+void EventLoop::reapChildren() {
+    while (1) {
+        EventChildCollection::iterator it;
+        EventChild *reaped = NULL;
+        bool exited = false;
+        int status = 0;
+
+        pthread_mutex_lock(&mLock);
+        for (it = mChildren->begin(); it != mChildren->end(); ++it) {
+            pid_t pid = waitpid((*it)->pid, &status, WNOHANG);
+
+            // ECHILD means someone else has already waited for it
+            if (pid == (*it)->pid || (pid < 0 && errno == ECHILD)) {
+                exited = (pid == (*it)->pid);
+                reaped = *it;
+                mChildren->erase(it);
+                break;
+            }
+        }
+        pthread_mutex_unlock(&mLock);
+
+        if (!reaped) {
+            return;
+        }
+        if (exited) {
+            reaped->callback(reaped->obj, reaped->pid, status);
+        }
+        free(reaped);
+    }
+}
+
+void EventLoop::freeRemoved() {
+    EventFdCollection::iterator it;
+
+    pthread_mutex_lock(&mLock);
+    it = mFds->begin();
+    while (it != mFds->end()) {
+        if ((*it)->removed) {
+            free(*it);
+            it = mFds->erase(it);
+        } else {
+            ++it;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+void EventLoop::run() {
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+    LOGI("Event loop running");
+    blockChildSignal(SIG_UNBLOCK);
+    while (1) {
+        int n = epoll_wait(mEpollFd, events, EVENT_LOOP_MAX_EVENTS, nextTimeout());
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("epoll_wait failed (%s)", strerror(errno));
+            sleep(1);
+            continue;
+        }
+
+        for (int i = 0; i < n; i++) {
+            EventFd *ef = (EventFd *) events[i].data.ptr;
+
+            if (!ef) {
+                char buf[64];
+
+                // Timers are looked at below anyway; only children need it
+                while (read(mWakePipe[0], buf, sizeof(buf)) > 0)
+                    ;
+                reapChildren();
+                continue;
+            }
+            // An earlier callback in this round may have removed it
+            if (!ef->removed) {
+                ef->callback(ef->obj, ef->fd);
+            }
+        }
+        runTimers();
+        freeRemoved();
+    }
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _EVENT_LOOP_H
+#define _EVENT_LOOP_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/List.h>
+
+/* Most events taken from the kernel per epoll_wait() */
+#define EVENT_LOOP_MAX_EVENTS   32
+
+typedef void (*EventFdCallback)(void *obj, int fd);
+typedef void (*EventTimerCallback)(void *obj);
+typedef void (*EventChildCallback)(void *obj, pid_t pid, int status);
+
+struct EventFd {
+    int             fd;
+    EventFdCallback callback;
+    void            *obj;
+    bool            removed;    // Freed once the current round of events is done
+};
+
+struct EventTimer {
+    int                id;
+    int                intervalMs;
+    uint64_t           dueMs;       // CLOCK_MONOTONIC
+    EventTimerCallback callback;
+    void               *obj;
+};
+
+struct EventChild {
+    pid_t              pid;
+    EventChildCallback callback;
+    void               *obj;
+};
+
+typedef android::List<EventFd *> EventFdCollection;
+typedef android::List<EventTimer *> EventTimerCollection;
+typedef android::List<EventChild *> EventChildCollection;
+
+/*
+ * The one thread that waits for anything in netd. Sockets, periodic
+ * timers and the exit of child processes are all multiplexed on a single
+ * epoll set, and their callbacks run one at a time on the thread that
+ * called run(), in the order the kernel reported them. Callbacks must not
+ * block for long; slow work belongs on a WorkQueue.
+ *
+ * SIGCHLD only wakes the loop, which then reaps the children registered
+ * with watchChild() and nothing else, so code that forks and waits for
+ * its own child is unaffected. The signal is blocked in every other
+ * thread, so Instance() must be called before netd starts any.
+ */
+class EventLoop {
+    static EventLoop *sInstance;
+    static int       sWakeFd;   // Write end of mWakePipe, for the signal handler
+
+    int                  mEpollFd;
+    int                  mWakePipe[2];
+    pthread_mutex_t      mLock;
+    EventFdCollection    *mFds;
+    EventTimerCollection *mTimers;
+    EventChildCollection *mChildren;
+    int                  mNextTimerId;
+
+public:
+    virtual ~EventLoop();
+
+    static EventLoop *Instance();
+
+    /* events are EPOLL* flags; the callback runs while fd is ready */
+    int addFd(int fd, uint32_t events, EventFdCallback callback, void *obj);
+    int removeFd(int fd);
+
+    /* Returns an id for setTimerInterval(); the first run is one interval away */
+    int addTimer(int intervalMs, EventTimerCallback callback, void *obj);
+    int setTimerInterval(int id, int intervalMs);
+    int removeTimer(int id);
+
+    /* The callback gets the child's wait status once it has been reaped */
+    int watchChild(pid_t pid, EventChildCallback callback, void *obj);
+
+    /*
+     * -1 with ENOENT if the child is no longer watched, i.e. it has
+     * already been reaped and its callback has run or is about to.
+     */
+    int unwatchChild(pid_t pid);
+
+    /* Never returns */
+    void run();
+
+private:
+    EventLoop();
+
+    static void sigchld(int sig);
+    static void blockChildSignal(int how);
+    static void forkedChild();
+    void wake();
+    int nextTimeout();
+    void runTimers();
+    void reapChildren();
+    void freeRemoved();
+};
+
+#endif
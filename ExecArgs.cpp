@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+
+#define LOG_TAG "ExecArgs"
+#include <cutils/log.h>
+
+#include "ExecArgs.h"
+
+extern "C" int logwrap(int argc, const char **argv, int background);
+
+static char IPTABLES_PATH[] = "/system/bin/iptables";
+
+pthread_mutex_t ExecArgs::sIptablesLock = PTHREAD_MUTEX_INITIALIZER;
+
+ExecArgs::ExecArgs(const char *path) {
+    mArgv[0] = path;
+    mArgv[1] = NULL;
+    mArgc = 1;
+    mOverflow = false;
+}
+
+void ExecArgs::add(const char *arg) {
+    if (mArgc == EXEC_ARGS_MAX) {
+        mOverflow = true;
+        return;
+    }
+    mArgv[mArgc++] = arg;
+    mArgv[mArgc] = NULL;
+}
+
+void ExecArgs::addv(const char *arg, va_list ap) {
+    for (; arg; arg = va_arg(ap, const char *)) {
+        add(arg);
+    }
+}
+
+int ExecArgs::run() {
+    if (mOverflow) {
+        LOGE("%s argument overflow", mArgv[0]);
+        errno = E2BIG;
+        return -1;
+    }
+    return logwrap(mArgc, mArgv, 0);
+}
+
+int ExecArgs::runIptables(const char *arg, ...) {
+    ExecArgs args(IPTABLES_PATH);
+    va_list ap;
+
+    args.add("--verbose");
+    va_start(ap, arg);
+    args.addv(arg, ap);
+    va_end(ap);
+
+    pthread_mutex_lock(&sIptablesLock);
+    int rc = args.run();
+    pthread_mutex_unlock(&sIptablesLock);
+    return rc;
+}
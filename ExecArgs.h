@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _EXEC_ARGS_H
+#define _EXEC_ARGS_H
+
+#include <pthread.h>
+#include <stdarg.h>
+
+/* Most arguments a program may be given, its own path included */
+#define EXEC_ARGS_MAX 48
+
+/*
+ * Builds the argument vector of a program run through logwrap one word at
+ * a time, so callers need not format a command line only for it to be
+ * split up again. Arguments are referenced, not copied, and must outlive
+ * run(). Running out of room fails the run with E2BIG rather than cutting
+ * the command short.
+ */
+class ExecArgs {
+    static pthread_mutex_t sIptablesLock;
+
+    const char *mArgv[EXEC_ARGS_MAX + 1];
+    int        mArgc;
+    bool       mOverflow;
+
+public:
+    ExecArgs(const char *path);
+    virtual ~ExecArgs() {}
+
+    void add(const char *arg);
+
+    /* Adds arg and every argument after it in ap, up to a NULL */
+    void addv(const char *arg, va_list ap);
+
+    int run();
+
+    /*
+     * Runs iptables --verbose with the arguments up to a NULL. iptables
+     * rewrites a whole table for every change, so two runs at once can
+     * lose one of them; every controller goes through here and they are
+     * serialized.
+     */
+    static int runIptables(const char *arg, ...) __attribute__((sentinel));
+};
+
+#endif
@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#define LOG_TAG "InterfaceController"
+#define DBG 0
+
+#include <cutils/log.h>
+
+#include "InterfaceController.h"
+#include "InterfaceTable.h"
+
+/*
+ * Room for a delete, an add, the re-adds of every other address, and a
+ * link change and query, with all their attributes
+ */
+#define REQUEST_BUFFER_SIZE 1024
+
+/* Echoed link messages carry statistics, so replies can be large */
+#define REPLY_BUFFER_SIZE 8192
+
+static int addrLength(int family) {
+    return family == AF_INET6 ? 16 : 4;
+}
+
+struct nlmsghdr *InterfaceController::addMessage(char *buf, int *len, int size, int type,
+                                                 int flags, const void *body, int bodyLen) {
+    struct nlmsghdr *nh = (struct nlmsghdr *) (buf + *len);
+
+    if (*len + (int) NLMSG_SPACE(bodyLen) > size) {
+        return NULL;
+    }
+    memset(nh, 0, NLMSG_SPACE(bodyLen));
+    nh->nlmsg_len = NLMSG_LENGTH(bodyLen);
+    nh->nlmsg_type = type;
+    nh->nlmsg_flags = NLM_F_REQUEST | flags;
+    memcpy(NLMSG_DATA(nh), body, bodyLen);
+    *len += NLMSG_ALIGN(nh->nlmsg_len);
+    return nh;
+}
+
+/* Appends to nh, which must be the last message; size is the room from nh on */
+int InterfaceController::addAttr(struct nlmsghdr *nh, int size, int type, const void *data,
+                                 int dataLen) {
+    int alignedLen = NLMSG_ALIGN(nh->nlmsg_len);
+
+    if (alignedLen + (int) RTA_SPACE(dataLen) > size) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    struct rtattr *rta = (struct rtattr *) ((char *) nh + alignedLen);
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(dataLen);
+    memcpy(RTA_DATA(rta), data, dataLen);
+    nh->nlmsg_len = alignedLen + RTA_ALIGN(rta->rta_len);
+    return 0;
+}
+
+int InterfaceController::addAddress(char *buf, int *len, int size, int type, int index,
+                                    int family, const unsigned char *addr, int prefixLen) {
+    struct ifaddrmsg ifa;
+    int flags = (type == RTM_NEWADDR) ? (NLM_F_CREATE | NLM_F_REPLACE) : 0;
+    int start = *len;
+
+    // Have the kernel tell us what it did, so the table can follow
+    flags |= NLM_F_ECHO;
+
+    memset(&ifa, 0, sizeof(ifa));
+    ifa.ifa_family = family;
+    ifa.ifa_prefixlen = prefixLen;
+    ifa.ifa_index = index;
+
+    struct nlmsghdr *nh = addMessage(buf, len, size, type, flags, &ifa, sizeof(ifa));
+    if (!nh ||
+        addAttr(nh, size - start, IFA_LOCAL, addr, addrLength(family)) ||
+        addAttr(nh, size - start, IFA_ADDRESS, addr, addrLength(family))) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    // SIOCSIFNETMASK derives the broadcast address; rtnetlink leaves it to us
+    if (family == AF_INET && type == RTM_NEWADDR && prefixLen < 31) {
+        in_addr_t brd;
+        memcpy(&brd, addr, sizeof(brd));
+        brd |= htonl(prefixLen ? ~0U >> prefixLen : ~0U);
+        if (addAttr(nh, size - start, IFA_BROADCAST, &brd, sizeof(brd))) {
+            return -1;
+        }
+    }
+    *len = start + NLMSG_ALIGN(nh->nlmsg_len);
+    return 0;
+}
+
+/*
+ * Sets the link's up flag and MTU (when up >= 0 and mtu > 0 respectively),
+ * then asks for the link back: link changes aren't echoed, and the answer
+ * brings the table up to date.
+ */
+int InterfaceController::addLink(char *buf, int *len, int size, int index, int up, int mtu) {
+    struct ifinfomsg ifi;
+    int start = *len;
+
+    memset(&ifi, 0, sizeof(ifi));
+    ifi.ifi_family = AF_UNSPEC;
+    ifi.ifi_index = index;
+    if (up >= 0) {
+        ifi.ifi_change = IFF_UP;
+        ifi.ifi_flags = up ? IFF_UP : 0;
+    }
+
+    struct nlmsghdr *nh = addMessage(buf, len, size, RTM_NEWLINK, 0, &ifi, sizeof(ifi));
+    if (!nh) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    if (mtu > 0) {
+        unsigned int val = mtu;
+        if (addAttr(nh, size - start, IFLA_MTU, &val, sizeof(val))) {
+            return -1;
+        }
+        *len = start + NLMSG_ALIGN(nh->nlmsg_len);
+    }
+
+    memset(&ifi, 0, sizeof(ifi));
+    ifi.ifi_family = AF_UNSPEC;
+    ifi.ifi_index = index;
+    if (!addMessage(buf, len, size, RTM_GETLINK, 0, &ifi, sizeof(ifi))) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Deleting an interface's primary IPv4 address takes the secondaries in
+ * its subnet with it, so when the primary is replaced every other IPv4
+ * address is added back after the new one.
+ */
+int InterfaceController::addChange(char *buf, int *len, int size, const InterfaceEntry *entry,
+                                   const InterfaceConfig *cfg) {
+    if (cfg->family == AF_INET) {
+        static const unsigned char any[4] = { 0, 0, 0, 0 };
+        bool clearing = !memcmp(cfg->addr, any, sizeof(any));
+        const InterfaceAddress *primary = NULL;
+
+        for (int i = 0; i < entry->numAddrs; i++) {
+            if (entry->addrs[i].family == AF_INET) {
+                primary = &entry->addrs[i];
+                break;
+            }
+        }
+
+        bool same = primary && !clearing && primary->prefixLen == cfg->prefixLen &&
+                    !memcmp(primary->addr, cfg->addr, 4);
+        if (primary && !same &&
+            addAddress(buf, len, size, RTM_DELADDR, entry->index, AF_INET,
+                       primary->addr, primary->prefixLen)) {
+            return -1;
+        }
+        if (!clearing &&
+            addAddress(buf, len, size, RTM_NEWADDR, entry->index, AF_INET,
+                       cfg->addr, cfg->prefixLen)) {
+            return -1;
+        }
+        for (int i = 0; primary && !same && !clearing && i < entry->numAddrs; i++) {
+            const InterfaceAddress *a = &entry->addrs[i];
+
+            if (a == primary || a->family != AF_INET || !memcmp(a->addr, cfg->addr, 4)) {
+                continue;
+            }
+            if (addAddress(buf, len, size, RTM_NEWADDR, entry->index, AF_INET,
+                           a->addr, a->prefixLen)) {
+                return -1;
+            }
+        }
+    } else if (cfg->family == AF_INET6) {
+        if (addAddress(buf, len, size, RTM_NEWADDR, entry->index, AF_INET6,
+                       cfg->addr, cfg->prefixLen)) {
+            return -1;
+        }
+    }
+
+    // The link goes last so an interface comes up with its new address
+    if (cfg->up >= 0 || cfg->mtu > 0) {
+        return addLink(buf, len, size, entry->index, cfg->up, cfg->mtu);
+    }
+    return 0;
+}
+
+/*
+ * Puts back the addresses and link settings recorded in entry after a
+ * change that failed part way. The kernel runs every message of a batch
+ * even when an earlier one fails, so the change may have been applied in
+ * any part.
+ */
+int InterfaceController::addRestore(char *buf, int *len, int size, const InterfaceEntry *entry,
+                                    const InterfaceConfig *cfg) {
+    bool hadAddr = false;
+
+    for (int i = 0; i < entry->numAddrs; i++) {
+        if (entry->addrs[i].family == cfg->family &&
+            !memcmp(entry->addrs[i].addr, cfg->addr, addrLength(cfg->family))) {
+            hadAddr = true;
+        }
+    }
+    if (cfg->family == AF_INET) {
+        static const unsigned char any[4] = { 0, 0, 0, 0 };
+        hadAddr = hadAddr || !memcmp(cfg->addr, any, sizeof(any));
+    }
+    // Drop the new address first: as a primary it would take re-adds with it
+    if ((cfg->family == AF_INET || cfg->family == AF_INET6) && !hadAddr &&
+        addAddress(buf, len, size, RTM_DELADDR, entry->index, cfg->family,
+                   cfg->addr, cfg->prefixLen)) {
+        return -1;
+    }
+    if (cfg->family == AF_INET) {
+        for (int i = 0; i < entry->numAddrs; i++) {
+            const InterfaceAddress *a = &entry->addrs[i];
+
+            if (a->family == AF_INET &&
+                addAddress(buf, len, size, RTM_NEWADDR, entry->index, AF_INET,
+                           a->addr, a->prefixLen)) {
+                return -1;
+            }
+        }
+    }
+    if (cfg->up >= 0 || cfg->mtu > 0) {
+        return addLink(buf, len, size, entry->index,
+                       (cfg->up >= 0) ? ((entry->flags & IFF_UP) ? 1 : 0) : -1,
+                       (cfg->mtu > 0) ? entry->mtu : 0);
+    }
+    return 0;
+}
+
+int InterfaceController::setConfig(const char *iface, const InterfaceConfig *cfg) {
+    InterfaceEntry entry;
+    char buf[REQUEST_BUFFER_SIZE];
+    int len = 0;
+
+    if (InterfaceTable::Instance()->get(iface, &entry) ||
+        addChange(buf, &len, sizeof(buf), &entry, cfg)) {
+        return -1;
+    }
+    if (!len || !transact(buf, len)) {
+        return 0;
+    }
+
+    int savedErrno = errno;
+    len = 0;
+    if (addRestore(buf, &len, sizeof(buf), &entry, cfg) || transact(buf, len)) {
+        // Undoing a step that never happened fails too, so this may be benign
+        LOGW("Restoring %s after a failed change reported: %s", iface, strerror(errno));
+    }
+    errno = savedErrno;
+    return -1;
+}
+
+int InterfaceController::removeAddress(const char *iface, int family,
+                                       const unsigned char *addr, int prefixLen) {
+    InterfaceEntry entry;
+    char buf[REQUEST_BUFFER_SIZE];
+    int len = 0;
+
+    if (InterfaceTable::Instance()->get(iface, &entry) ||
+        addAddress(buf, &len, sizeof(buf), RTM_DELADDR, entry.index, family, addr,
+                   prefixLen)) {
+        return -1;
+    }
+    return transact(buf, len);
+}
+
+/*
+ * Sends every message in buf with one write and waits for the kernel's
+ * answer. Only the last message asks for an ack; the kernel acks any
+ * failing one regardless, so the first error seen is the one reported.
+ * The address and link messages the kernel sends back are applied to the
+ * interface table, so it is current by the time this returns.
+ */
+int InterfaceController::transact(char *buf, int len) {
+    struct nlmsghdr *nh;
+    unsigned int seq = 0;
+    unsigned int lastSeq = 0;
+    int remaining = len;
+    int sock;
+    int error = 0;
+
+    for (nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, (unsigned) remaining);
+         nh = NLMSG_NEXT(nh, remaining)) {
+        nh->nlmsg_seq = lastSeq = ++seq;
+        if (NLMSG_ALIGN(nh->nlmsg_len) >= (unsigned) remaining) {
+            nh->nlmsg_flags |= NLM_F_ACK;
+        }
+    }
+
+    if ((sock = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE)) < 0) {
+        LOGE("Unable to create rtnetlink socket (%s)", strerror(errno));
+        return -1;
+    }
+    if (TEMP_FAILURE_RETRY(send(sock, buf, len, 0)) != len) {
+        LOGE("Unable to send rtnetlink request (%s)", strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    char reply[REPLY_BUFFER_SIZE];
+    while (1) {
+        int n = TEMP_FAILURE_RETRY(recv(sock, reply, sizeof(reply), 0));
+        if (n < 0) {
+            LOGE("Unable to read rtnetlink ack (%s)", strerror(errno));
+            close(sock);
+            return -1;
+        }
+
+        for (nh = (struct nlmsghdr *) reply; NLMSG_OK(nh, (unsigned) n);
+             nh = NLMSG_NEXT(nh, n)) {
+            if (nh->nlmsg_type != NLMSG_ERROR) {
+                InterfaceTable::Instance()->handleMessage(nh);
+                continue;
+            }
+            struct nlmsgerr *err = (struct nlmsgerr *) NLMSG_DATA(nh);
+            if (err->error && !error) {
+                error = -err->error;
+                if (DBG) LOGD("rtnetlink request %u failed (%s)", nh->nlmsg_seq,
+                              strerror(error));
+            }
+            if (nh->nlmsg_seq == lastSeq) {
+                close(sock);
+                errno = error;
+                return error ? -1 : 0;
+            }
+        }
+    }
+}
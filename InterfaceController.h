@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INTERFACE_CONTROLLER_H
+#define _INTERFACE_CONTROLLER_H
+
+struct nlmsghdr;
+struct InterfaceEntry;
+
+/*
+ * A change to an interface's configuration. An IPv4 address replaces the
+ * interface's primary IPv4 address (0.0.0.0 just removes it), as
+ * SIOCSIFADDR would; an IPv6 address is added alongside the others.
+ */
+struct InterfaceConfig {
+    int           family;       // AF_INET, AF_INET6, or AF_UNSPEC for no address
+    unsigned char addr[16];
+    int           prefixLen;
+    int           up;           // 1 up, 0 down, -1 unchanged
+    int           mtu;          // 0 unchanged
+};
+
+class InterfaceController {
+public:
+    /*
+     * Applies the whole change as one batch of rtnetlink requests, sent
+     * with a single write and answered with a single ack. If any part
+     * fails, the interface is put back as it was before returning -1.
+     * Either way the interface table reflects the result on return.
+     */
+    static int setConfig(const char *iface, const InterfaceConfig *cfg);
+    static int removeAddress(const char *iface, int family, const unsigned char *addr,
+                             int prefixLen);
+
+private:
+    static struct nlmsghdr *addMessage(char *buf, int *len, int size, int type,
+                                       int flags, const void *body, int bodyLen);
+    static int addAttr(struct nlmsghdr *nh, int size, int type, const void *data,
+                       int dataLen);
+    static int addAddress(char *buf, int *len, int size, int type, int index,
+                          int family, const unsigned char *addr, int prefixLen);
+    static int addLink(char *buf, int *len, int size, int index, int up, int mtu);
+    static int addChange(char *buf, int *len, int size, const InterfaceEntry *entry,
+                         const InterfaceConfig *cfg);
+    static int addRestore(char *buf, int *len, int size, const InterfaceEntry *entry,
+                          const InterfaceConfig *cfg);
+    static int transact(char *buf, int len);
+};
+
+#endif
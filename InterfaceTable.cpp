@@ -0,0 +1,582 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#define LOG_TAG "InterfaceTable"
+#define DBG 0
+
+#include <cutils/log.h>
+
+#include "InterfaceTable.h"
+
+/* Big enough for a dump chunk from any kernel we run on */
+#define DUMP_BUFFER_SIZE 16384
+
+#ifndef IFLA_STATS64
+#define IFLA_STATS64 23
+#endif
+
+/* Leading fields of struct rtnl_link_stats64, which older headers lack */
+struct LinkStats64 {
+    uint64_t rx_packets;
+    uint64_t tx_packets;
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint64_t rx_errors;
+    uint64_t tx_errors;
+    uint64_t rx_dropped;
+    uint64_t tx_dropped;
+};
+
+InterfaceTable *InterfaceTable::sInstance = NULL;
+
+InterfaceTable *InterfaceTable::Instance() {
+    if (!sInstance)
+        sInstance = new InterfaceTable();
+    return sInstance;
+}
+
+InterfaceTable::InterfaceTable() {
+    pthread_rwlock_init(&mLock, NULL);
+    pthread_mutex_init(&mLoadLock, NULL);
+    mEntries = new InterfaceEntryCollection();
+    mLoading = false;
+    mPending = new PendingMessageCollection();
+}
+
+InterfaceTable::~InterfaceTable() {
+    clear(mEntries);
+    delete mEntries;
+    clearPending();
+    delete mPending;
+    pthread_mutex_destroy(&mLoadLock);
+    pthread_rwlock_destroy(&mLock);
+}
+
+/*
+ * The dump is built aside and swapped in, so readers never wait for it.
+ * Messages that reach the old table meanwhile are also kept, and replayed
+ * onto the new one before the swap; the dump may already include some of
+ * them, which applying again leaves as they are.
+ */
+int InterfaceTable::load() {
+    InterfaceEntryCollection *entries = new InterfaceEntryCollection();
+    InterfaceEntryCollection *old;
+    PendingMessageCollection::iterator it;
+    int sock;
+
+    pthread_mutex_lock(&mLoadLock);
+    pthread_rwlock_wrlock(&mLock);
+    mLoading = true;
+    pthread_rwlock_unlock(&mLock);
+
+    if ((sock = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE)) < 0) {
+        LOGE("Unable to create rtnetlink socket (%s)", strerror(errno));
+        goto fail;
+    }
+
+    // Links first, so that every address finds its interface
+    if (dumpRequest(sock, RTM_GETLINK, 1, entries) ||
+        dumpRequest(sock, RTM_GETADDR, 2, entries)) {
+        int savedErrno = errno;
+        close(sock);
+        errno = savedErrno;
+        goto fail;
+    }
+    close(sock);
+
+    pthread_rwlock_wrlock(&mLock);
+    for (it = mPending->begin(); it != mPending->end(); ++it) {
+        apply(entries, *it);
+    }
+    clearPending();
+    mLoading = false;
+    old = mEntries;
+    mEntries = entries;
+    pthread_rwlock_unlock(&mLock);
+    pthread_mutex_unlock(&mLoadLock);
+
+    clear(old);
+    delete old;
+    return 0;
+
+fail:
+    int savedErrno = errno;
+    pthread_rwlock_wrlock(&mLock);
+    clearPending();
+    mLoading = false;
+    pthread_rwlock_unlock(&mLock);
+    pthread_mutex_unlock(&mLoadLock);
+    clear(entries);
+    delete entries;
+    errno = savedErrno;
+    return -1;
+}
+
+int InterfaceTable::refreshStats() {
+    InterfaceEntryCollection *links = new InterfaceEntryCollection();
+    InterfaceEntryCollection::iterator it;
+    int sock;
+
+    if ((sock = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE)) < 0) {
+        delete links;
+        return -1;
+    }
+    if (dumpRequest(sock, RTM_GETLINK, 1, links)) {
+        int savedErrno = errno;
+        close(sock);
+        clear(links);
+        delete links;
+        errno = savedErrno;
+        return -1;
+    }
+    close(sock);
+
+    // Only the counters are taken; events keep everything else current
+    pthread_rwlock_wrlock(&mLock);
+    for (it = links->begin(); it != links->end(); ++it) {
+        InterfaceEntry *entry = findByIndex(mEntries, (*it)->index);
+        if (entry) {
+            memcpy(&entry->stats, &(*it)->stats, sizeof(entry->stats));
+        }
+    }
+    pthread_rwlock_unlock(&mLock);
+
+    clear(links);
+    delete links;
+    return 0;
+}
+
+/* seq only has to differ between the dumps made on one socket */
+int InterfaceTable::dumpRequest(int sock, int type, unsigned int seq,
+                                InterfaceEntryCollection *entries) {
+    struct {
+        struct nlmsghdr nh;
+        struct rtgenmsg g;
+    } req;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.g));
+    req.nh.nlmsg_type = type;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = seq;
+    req.g.rtgen_family = AF_UNSPEC;
+
+    if (send(sock, &req, req.nh.nlmsg_len, 0) < 0) {
+        LOGE("Unable to send rtnetlink dump request (%s)", strerror(errno));
+        return -1;
+    }
+
+    char *buf = (char *) malloc(DUMP_BUFFER_SIZE);
+    if (!buf) {
+        return -1;
+    }
+
+    while (1) {
+        int len = TEMP_FAILURE_RETRY(recv(sock, buf, DUMP_BUFFER_SIZE, 0));
+        if (len < 0) {
+            LOGE("Unable to read rtnetlink dump (%s)", strerror(errno));
+            free(buf);
+            return -1;
+        }
+
+        struct nlmsghdr *nh = (struct nlmsghdr *) buf;
+        for (; NLMSG_OK(nh, (unsigned) len); nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_seq != req.nh.nlmsg_seq) {
+                continue;
+            }
+            if (nh->nlmsg_type == NLMSG_DONE) {
+                free(buf);
+                return 0;
+            }
+            if (nh->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr *err = (struct nlmsgerr *) NLMSG_DATA(nh);
+                errno = -err->error;
+                LOGE("rtnetlink dump failed (%s)", strerror(errno));
+                free(buf);
+                return -1;
+            }
+            apply(entries, nh);
+        }
+    }
+}
+
+void InterfaceTable::handleMessage(const struct nlmsghdr *nh) {
+    pthread_rwlock_wrlock(&mLock);
+    applyLocked(nh);
+    pthread_rwlock_unlock(&mLock);
+}
+
+void InterfaceTable::applyLocked(const struct nlmsghdr *nh) {
+    apply(mEntries, nh);
+    if (mLoading) {
+        struct nlmsghdr *copy = (struct nlmsghdr *) malloc(nh->nlmsg_len);
+        if (!copy) {
+            LOGW("Out of memory; an interface change may be lost by the reload");
+            return;
+        }
+        memcpy(copy, nh, nh->nlmsg_len);
+        mPending->push_back(copy);
+    }
+}
+
+void InterfaceTable::clearPending() {
+    PendingMessageCollection::iterator it;
+
+    for (it = mPending->begin(); it != mPending->end(); ++it) {
+        free(*it);
+    }
+    mPending->clear();
+}
+
+void InterfaceTable::apply(InterfaceEntryCollection *entries, const struct nlmsghdr *nh) {
+    switch (nh->nlmsg_type) {
+    case RTM_NEWLINK:
+    case RTM_DELLINK:
+        applyLink(entries, nh);
+        break;
+    case RTM_NEWADDR:
+    case RTM_DELADDR:
+        applyAddr(entries, nh);
+        break;
+    }
+}
+
+InterfaceEntry *InterfaceTable::findByIndex(InterfaceEntryCollection *entries, int index) {
+    InterfaceEntryCollection::iterator it;
+
+    for (it = entries->begin(); it != entries->end(); ++it) {
+        if ((*it)->index == index) {
+            return *it;
+        }
+    }
+    return NULL;
+}
+
+void InterfaceTable::applyLink(InterfaceEntryCollection *entries, const struct nlmsghdr *nh) {
+    struct ifinfomsg *ifi = (struct ifinfomsg *) NLMSG_DATA(nh);
+    InterfaceEntryCollection::iterator it;
+
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi))) {
+        return;
+    }
+
+    if (nh->nlmsg_type == RTM_DELLINK) {
+        for (it = entries->begin(); it != entries->end(); ++it) {
+            if ((*it)->index == ifi->ifi_index) {
+                if (DBG) LOGD("Removed %s", (*it)->name);
+                free(*it);
+                entries->erase(it);
+                break;
+            }
+        }
+        return;
+    }
+
+    InterfaceEntry *entry = findByIndex(entries, ifi->ifi_index);
+    if (!entry) {
+        if (!(entry = (InterfaceEntry *) calloc(1, sizeof(InterfaceEntry)))) {
+            return;
+        }
+        entry->index = ifi->ifi_index;
+        for (it = entries->begin(); it != entries->end() && (*it)->index < entry->index; ++it)
+            ;
+        entries->insert(it, entry);
+    }
+    entry->flags = ifi->ifi_flags;
+
+    const struct rtnl_link_stats *stats32 = NULL;
+    const LinkStats64 *stats64 = NULL;
+    int len = IFLA_PAYLOAD(nh);
+    struct rtattr *rta;
+    for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        switch (rta->rta_type) {
+        case IFLA_IFNAME:
+            strlcpy(entry->name, (const char *) RTA_DATA(rta), sizeof(entry->name));
+            break;
+        case IFLA_ADDRESS:
+            if (RTA_PAYLOAD(rta) >= sizeof(entry->hwaddr)) {
+                memcpy(entry->hwaddr, RTA_DATA(rta), sizeof(entry->hwaddr));
+            }
+            break;
+        case IFLA_MTU:
+            entry->mtu = *(unsigned int *) RTA_DATA(rta);
+            break;
+        case IFLA_STATS:
+            if (RTA_PAYLOAD(rta) >= sizeof(struct rtnl_link_stats)) {
+                stats32 = (const struct rtnl_link_stats *) RTA_DATA(rta);
+            }
+            break;
+        case IFLA_STATS64:
+            if (RTA_PAYLOAD(rta) >= sizeof(LinkStats64)) {
+                stats64 = (const LinkStats64 *) RTA_DATA(rta);
+            }
+            break;
+        }
+    }
+
+    // The 32-bit counters wrap; they are only for kernels without the others
+    if (stats64) {
+        entry->stats.rxBytes = stats64->rx_bytes;
+        entry->stats.rxPackets = stats64->rx_packets;
+        entry->stats.rxErrors = stats64->rx_errors;
+        entry->stats.rxDropped = stats64->rx_dropped;
+        entry->stats.txBytes = stats64->tx_bytes;
+        entry->stats.txPackets = stats64->tx_packets;
+        entry->stats.txErrors = stats64->tx_errors;
+        entry->stats.txDropped = stats64->tx_dropped;
+    } else if (stats32) {
+        entry->stats.rxBytes = stats32->rx_bytes;
+        entry->stats.rxPackets = stats32->rx_packets;
+        entry->stats.rxErrors = stats32->rx_errors;
+        entry->stats.rxDropped = stats32->rx_dropped;
+        entry->stats.txBytes = stats32->tx_bytes;
+        entry->stats.txPackets = stats32->tx_packets;
+        entry->stats.txErrors = stats32->tx_errors;
+        entry->stats.txDropped = stats32->tx_dropped;
+    }
+    if (DBG) LOGD("Link %d %s flags 0x%x", entry->index, entry->name, entry->flags);
+}
+
+void InterfaceTable::applyAddr(InterfaceEntryCollection *entries, const struct nlmsghdr *nh) {
+    struct ifaddrmsg *ifa = (struct ifaddrmsg *) NLMSG_DATA(nh);
+    const unsigned char *local = NULL, *address = NULL;
+    int addrLen = 0;
+
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa))) {
+        return;
+    }
+    if (ifa->ifa_family == AF_INET) {
+        addrLen = 4;
+    } else if (ifa->ifa_family == AF_INET6) {
+        addrLen = 16;
+    } else {
+        return;
+    }
+
+    InterfaceEntry *entry = findByIndex(entries, ifa->ifa_index);
+    if (!entry) {
+        return;
+    }
+
+    int len = IFA_PAYLOAD(nh);
+    struct rtattr *rta;
+    for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if ((int) RTA_PAYLOAD(rta) < addrLen) {
+            continue;
+        }
+        if (rta->rta_type == IFA_LOCAL) {
+            local = (const unsigned char *) RTA_DATA(rta);
+        } else if (rta->rta_type == IFA_ADDRESS) {
+            address = (const unsigned char *) RTA_DATA(rta);
+        }
+    }
+    // On point-to-point links IFA_ADDRESS is the peer
+    if (local) {
+        address = local;
+    }
+    if (!address) {
+        return;
+    }
+
+    int i;
+    for (i = 0; i < entry->numAddrs; i++) {
+        if (entry->addrs[i].family == ifa->ifa_family &&
+            !memcmp(entry->addrs[i].addr, address, addrLen)) {
+            break;
+        }
+    }
+
+    if (nh->nlmsg_type == RTM_DELADDR) {
+        if (i < entry->numAddrs) {
+            memmove(&entry->addrs[i], &entry->addrs[i + 1],
+                    (entry->numAddrs - i - 1) * sizeof(entry->addrs[0]));
+            entry->numAddrs--;
+        }
+        return;
+    }
+
+    if (i == entry->numAddrs) {
+        if (entry->numAddrs == IFTABLE_MAX_ADDRS) {
+            LOGW("Too many addresses on %s; ignoring one", entry->name);
+            return;
+        }
+        // The kernel keeps primaries ahead of secondaries; so does the table
+        if (ifa->ifa_family == AF_INET && !(ifa->ifa_flags & IFA_F_SECONDARY)) {
+            for (i = 0; i < entry->numAddrs; i++) {
+                if (entry->addrs[i].family == AF_INET &&
+                    (entry->addrs[i].flags & IFA_F_SECONDARY)) {
+                    break;
+                }
+            }
+            memmove(&entry->addrs[i + 1], &entry->addrs[i],
+                    (entry->numAddrs - i) * sizeof(entry->addrs[0]));
+        }
+        entry->numAddrs++;
+        memset(&entry->addrs[i], 0, sizeof(entry->addrs[i]));
+        entry->addrs[i].family = ifa->ifa_family;
+        memcpy(entry->addrs[i].addr, address, addrLen);
+    }
+    entry->addrs[i].prefixLen = ifa->ifa_prefixlen;
+    entry->addrs[i].flags = ifa->ifa_flags;
+}
+
+int InterfaceTable::get(const char *name, InterfaceEntry *entry) {
+    InterfaceEntryCollection::iterator it;
+    int rc = -1;
+
+    pthread_rwlock_rdlock(&mLock);
+    for (it = mEntries->begin(); it != mEntries->end(); ++it) {
+        if (!strcmp((*it)->name, name)) {
+            memcpy(entry, *it, sizeof(*entry));
+            rc = 0;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&mLock);
+
+    if (rc) {
+        errno = ENODEV;
+    }
+    return rc;
+}
+
+int InterfaceTable::findIndex(const char *name) {
+    InterfaceEntryCollection::iterator it;
+    int index = -1;
+
+    pthread_rwlock_rdlock(&mLock);
+    for (it = mEntries->begin(); it != mEntries->end(); ++it) {
+        if (!strcmp((*it)->name, name)) {
+            index = (*it)->index;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&mLock);
+    return index;
+}
+
+int InterfaceTable::readStats(const char *name, InterfaceStats *stats) {
+    struct {
+        struct nlmsghdr  nh;
+        struct ifinfomsg ifi;
+    } req;
+    int index = findIndex(name);
+    int sock;
+    int len;
+
+    if (index < 0) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+    req.nh.nlmsg_type = RTM_GETLINK;
+    req.nh.nlmsg_flags = NLM_F_REQUEST;
+    req.ifi.ifi_family = AF_UNSPEC;
+    req.ifi.ifi_index = index;
+
+    // A link message carries far more than the counters; don't truncate it
+    char *buf = (char *) malloc(DUMP_BUFFER_SIZE);
+    if (!buf) {
+        return -1;
+    }
+    if ((sock = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE)) < 0) {
+        free(buf);
+        return -1;
+    }
+    if (send(sock, &req, req.nh.nlmsg_len, 0) < 0 ||
+        (len = TEMP_FAILURE_RETRY(recv(sock, buf, DUMP_BUFFER_SIZE, 0))) < 0) {
+        int savedErrno = errno;
+        close(sock);
+        free(buf);
+        errno = savedErrno;
+        return -1;
+    }
+    close(sock);
+
+    int rc = parseStatsReply(buf, len, index, stats);
+    free(buf);
+    return rc;
+}
+
+int InterfaceTable::parseStatsReply(char *buf, int len, int index, InterfaceStats *stats) {
+    struct nlmsghdr *nh = (struct nlmsghdr *) buf;
+    if (!NLMSG_OK(nh, (unsigned) len)) {
+        errno = EIO;
+        return -1;
+    }
+    if (nh->nlmsg_type == NLMSG_ERROR) {
+        errno = -((struct nlmsgerr *) NLMSG_DATA(nh))->error;
+        return -1;
+    }
+    if (nh->nlmsg_type != RTM_NEWLINK) {
+        errno = EIO;
+        return -1;
+    }
+
+    // The reply is a full link message; let it refresh the rest too
+    pthread_rwlock_wrlock(&mLock);
+    applyLocked(nh);
+    InterfaceEntry *entry = findByIndex(mEntries, index);
+    if (entry) {
+        memcpy(stats, &entry->stats, sizeof(*stats));
+    }
+    pthread_rwlock_unlock(&mLock);
+
+    if (!entry) {
+        errno = ENODEV;
+        return -1;
+    }
+    return 0;
+}
+
+int InterfaceTable::getAll(InterfaceEntry **entries) {
+    InterfaceEntryCollection::iterator it;
+    int n = 0;
+
+    pthread_rwlock_rdlock(&mLock);
+    *entries = (InterfaceEntry *) malloc((mEntries->size() + 1) * sizeof(InterfaceEntry));
+    if (!*entries) {
+        pthread_rwlock_unlock(&mLock);
+        return -1;
+    }
+    for (it = mEntries->begin(); it != mEntries->end(); ++it) {
+        memcpy(&(*entries)[n++], *it, sizeof(InterfaceEntry));
+    }
+    pthread_rwlock_unlock(&mLock);
+    return n;
+}
+
+void InterfaceTable::clear(InterfaceEntryCollection *entries) {
+    InterfaceEntryCollection::iterator it;
+
+    for (it = entries->begin(); it != entries->end(); ++it) {
+        free(*it);
+    }
+    entries->clear();
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INTERFACE_TABLE_H
+#define _INTERFACE_TABLE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <net/if.h>
+
+#include <utils/List.h>
+
+struct nlmsghdr;
+
+/* Most addresses remembered per interface; further ones are dropped */
+#define IFTABLE_MAX_ADDRS 8
+
+struct InterfaceAddress {
+    int           family;
+    int           prefixLen;
+    unsigned int  flags;         // IFA_F_*
+    unsigned char addr[16];
+};
+
+struct InterfaceStats {
+    uint64_t rxBytes;
+    uint64_t rxPackets;
+    uint64_t rxErrors;
+    uint64_t rxDropped;
+    uint64_t txBytes;
+    uint64_t txPackets;
+    uint64_t txErrors;
+    uint64_t txDropped;
+};
+
+struct InterfaceEntry {
+    int              index;
+    char             name[IFNAMSIZ];
+    unsigned int     flags;          // IFF_*, including IFF_RUNNING
+    unsigned char    hwaddr[6];
+    int              mtu;
+    int              numAddrs;
+    InterfaceAddress addrs[IFTABLE_MAX_ADDRS];
+    InterfaceStats   stats;          // As of the last link message or readStats()
+};
+
+typedef android::List<InterfaceEntry *> InterfaceEntryCollection;
+typedef android::List<struct nlmsghdr *> PendingMessageCollection;
+
+/*
+ * The kernel's interfaces, addresses and link state as last reported over
+ * rtnetlink. load() takes a full dump; after that the route netlink
+ * handler feeds every link and address event through handleMessage().
+ * Readers only ever take the read side of the lock and copy out.
+ */
+class InterfaceTable {
+    static InterfaceTable *sInstance;
+
+    pthread_rwlock_t         mLock;
+    InterfaceEntryCollection *mEntries;
+    pthread_mutex_t          mLoadLock;  // One load() at a time
+    bool                     mLoading;
+    PendingMessageCollection *mPending;  // Applied while loading, to replay
+
+public:
+    virtual ~InterfaceTable();
+
+    static InterfaceTable *Instance();
+
+    /* Replaces the table with a fresh dump from the kernel */
+    int load();
+    void handleMessage(const struct nlmsghdr *nh);
+
+    /* Copies out one interface; -1 with ENODEV if there is no such one */
+    int get(const char *name, InterfaceEntry *entry);
+
+    /* Copies out every interface in index order; caller frees *entries */
+    int getAll(InterfaceEntry **entries);
+
+    /*
+     * Asks the kernel for one interface's current counters, updating the
+     * table on the way. -1 with ENODEV if there is no such interface.
+     */
+    int readStats(const char *name, InterfaceStats *stats);
+
+    /* Refreshes the counters of every interface with one link dump */
+    int refreshStats();
+
+private:
+    InterfaceTable();
+
+    static int dumpRequest(int sock, int type, unsigned int seq,
+                           InterfaceEntryCollection *entries);
+    void applyLocked(const struct nlmsghdr *nh);
+    void clearPending();
+    int findIndex(const char *name);
+    int parseStatsReply(char *buf, int len, int index, InterfaceStats *stats);
+    static void apply(InterfaceEntryCollection *entries, const struct nlmsghdr *nh);
+    static void applyLink(InterfaceEntryCollection *entries, const struct nlmsghdr *nh);
+    static void applyAddr(InterfaceEntryCollection *entries, const struct nlmsghdr *nh);
+    static InterfaceEntry *findByIndex(InterfaceEntryCollection *entries, int index);
+    static void clear(InterfaceEntryCollection *entries);
+};
+
+#endif
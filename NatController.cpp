@@ -26,10 +26,7 @@
 #include <cutils/log.h>
 
 #include "NatController.h"
-
-extern "C" int logwrap(int argc, const char **argv, int background);
-
-static char IPTABLES_PATH[] = "/system/bin/iptables";
+#include "ExecArgs.h"
 
 NatController::NatController() {
     natCount = 0;
@@ -38,47 +35,21 @@ NatController::NatController() {
 NatController::~NatController() {
 }
 
-int NatController::runIptablesCmd(const char *cmd) {
-    char buffer[255];
-
-    strncpy(buffer, cmd, sizeof(buffer)-1);
-
-    const char *args[16];
-    char *next = buffer;
-    char *tmp;
-
-    args[0] = IPTABLES_PATH;
-    args[1] = "--verbose";
-    int i = 2;
-
-    while ((tmp = strsep(&next, " "))) {
-        args[i++] = tmp;
-        if (i == 16) {
-            LOGE("iptables argument overflow");
-            errno = E2BIG;
-            return -1;
-        }
-    }
-    args[i] = NULL;
-
-    return logwrap(i, args, 0);
-}
-
 int NatController::setDefaults() {
 
-    if (runIptablesCmd("-P INPUT ACCEPT"))
+    if (ExecArgs::runIptables("-P", "INPUT", "ACCEPT", NULL))
         return -1;
-    if (runIptablesCmd("-F INPUT"))
+    if (ExecArgs::runIptables("-F", "INPUT", NULL))
         return -1;
-    if (runIptablesCmd("-P OUTPUT ACCEPT"))
+    if (ExecArgs::runIptables("-P", "OUTPUT", "ACCEPT", NULL))
         return -1;
-    if (runIptablesCmd("-F OUTPUT"))
+    if (ExecArgs::runIptables("-F", "OUTPUT", NULL))
         return -1;
-    if (runIptablesCmd("-P FORWARD DROP"))
+    if (ExecArgs::runIptables("-P", "FORWARD", "DROP", NULL))
         return -1;
-    if (runIptablesCmd("-F FORWARD"))
+    if (ExecArgs::runIptables("-F", "FORWARD", NULL))
         return -1;
-    if (runIptablesCmd("-t nat -F"))
+    if (ExecArgs::runIptables("-t", "nat", "-F", NULL))
         return -1;
     return 0;
 }
@@ -89,7 +60,7 @@ bool NatController::interfaceExists(const char *iface) {
 }
 
 int NatController::doNatCommands(const char *intIface, const char *extIface, bool add) {
-    char cmd[255];
+    const char *op = add ? "-A" : "-D";
 
     // handle decrement to 0 case (do reset to defaults) and erroneous dec below 0
     if (add == false) {
@@ -108,29 +79,24 @@ int NatController::doNatCommands(const char *intIface, const char *extIface, boo
         return -1;
     }
 
-    snprintf(cmd, sizeof(cmd),
-             "-%s FORWARD -i %s -o %s -m state --state ESTABLISHED,RELATED -j ACCEPT",
-             (add ? "A" : "D"),
-             extIface, intIface);
-    if (runIptablesCmd(cmd)) {
+    if (ExecArgs::runIptables(op, "FORWARD", "-i", extIface, "-o", intIface, "-m", "state",
+                              "--state", "ESTABLISHED,RELATED", "-j", "ACCEPT", NULL)) {
         return -1;
     }
 
-    snprintf(cmd, sizeof(cmd), "-%s FORWARD -i %s -o %s -j ACCEPT", (add ? "A" : "D"),
-            intIface, extIface);
-    if (runIptablesCmd(cmd)) {
+    if (ExecArgs::runIptables(op, "FORWARD", "-i", intIface, "-o", extIface, "-j", "ACCEPT",
+                              NULL)) {
         // unwind what's been done, but don't care about success - what more could we do?
-        snprintf(cmd, sizeof(cmd),
-                 "-%s FORWARD -i %s -o %s -m state --state ESTABLISHED,RELATED -j ACCEPT",
-                 (!add ? "A" : "D"),
-                 extIface, intIface);
+        ExecArgs::runIptables(add ? "-D" : "-A", "FORWARD", "-i", extIface, "-o", intIface,
+                              "-m", "state", "--state", "ESTABLISHED,RELATED", "-j", "ACCEPT",
+                              NULL);
         return -1;
     }
 
     // add this if we are the first added nat
     if (add && natCount == 0) {
-        snprintf(cmd, sizeof(cmd), "-t nat -A POSTROUTING -o %s -j MASQUERADE", extIface);
-        if (runIptablesCmd(cmd)) {
+        if (ExecArgs::runIptables("-t", "nat", "-A", "POSTROUTING", "-o", extIface,
+                                  "-j", "MASQUERADE", NULL)) {
             // unwind what's been done, but don't care about success - what more could we do?
             setDefaults();;
             return -1;
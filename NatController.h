@@ -34,7 +34,6 @@ private:
     int natCount;
 
     int setDefaults();
-    int runIptablesCmd(const char *cmd);
     bool interfaceExists(const char *iface);
     int doNatCommands(const char *intIface, const char *extIface, bool add);
 };
@@ -14,8 +14,529 @@
  * limitations under the License.
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#define LOG_TAG "NetdCommand"
+#include <cutils/log.h>
+
+#include <sysutils/SocketClient.h>
+
 #include "NetdCommand.h"
+#include "ResponseCode.h"
+#include "ResponseBuilder.h"
+
+extern "C" uint64_t logwrap_get_exec_time_us(void);
+extern "C" void logwrap_reset_exec_time_us(void);
+
+pthread_mutex_t NetdCommand::sPriorityLock = PTHREAD_MUTEX_INITIALIZER;
+PriorityClientCollection *NetdCommand::sPriorityClients = new PriorityClientCollection();
+
+static pthread_key_t sContextKey;
+static pthread_once_t sContextKeyOnce = PTHREAD_ONCE_INIT;
+
+void NetdCommand::makeContextKey() {
+    pthread_key_create(&sContextKey, free);
+}
+
+NetdCommand::ThreadContext *NetdCommand::getContext() {
+    pthread_once(&sContextKeyOnce, makeContextKey);
+
+    ThreadContext *ctx = (ThreadContext *) pthread_getspecific(sContextKey);
+    if (!ctx && (ctx = (ThreadContext *) malloc(sizeof(ThreadContext)))) {
+        ctx->tag = -1;
+        ctx->lastCode = 0;
+        ctx->replyClient = NULL;
+        ctx->reply = NULL;
+        ctx->prepared = NULL;
+        pthread_setspecific(sContextKey, ctx);
+    }
+    return ctx;
+}
+
+void *NetdCommand::getPrepared() {
+    ThreadContext *ctx = getContext();
+
+    return ctx ? ctx->prepared : NULL;
+}
+
+void NetdCommand::setCurrentTag(int tag) {
+    ThreadContext *ctx = getContext();
+
+    if (ctx) {
+        ctx->tag = tag;
+    }
+}
+
+static uint64_t nowUs() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+char *NetdCommand::formatMsg(int code, const char *msg, bool addErrno, int *len) {
+    ThreadContext *ctx = getContext();
+    int tag = ctx ? ctx->tag : -1;
+
+    if (ctx) {
+        ctx->lastCode = code;
+    }
+    const char *err = addErrno ? strerror(errno) : NULL;
+    char *buf = NULL;
+
+    if (tag >= 0) {
+        *len = err ? asprintf(&buf, "%.3d %d %s (%s)", code, tag, msg, err) :
+                     asprintf(&buf, "%.3d %d %s", code, tag, msg);
+    } else {
+        *len = err ? asprintf(&buf, "%.3d %s (%s)", code, msg, err) :
+                     asprintf(&buf, "%.3d %s", code, msg);
+    }
+    return *len < 0 ? NULL : buf;
+}
+
+int NetdCommand::sendMsg(SocketClient *c, int code, const char *msg, bool addErrno) {
+    ThreadContext *ctx = getContext();
+    int len;
+
+    if (ctx && ctx->reply && ctx->replyClient == c) {
+        return ctx->reply->add(code, msg, addErrno);
+    }
+
+    // Formatted here rather than by SocketClient, whose buffer is on the stack
+    char *buf = formatMsg(code, msg, addErrno, &len);
+    if (!buf) {
+        return -1;
+    }
+    int rc = c->sendMsg(buf);
+    free(buf);
+    if (rc) {
+        EpollListener::dropClient(c);
+    }
+    return rc;
+}
+
+void NetdCommand::beginReply(SocketClient *c) {
+    ThreadContext *ctx = getContext();
+
+    if (ctx && !ctx->reply) {
+        ctx->reply = new ResponseBuilder();
+        ctx->replyClient = c;
+    }
+}
+
+int NetdCommand::endReply() {
+    ThreadContext *ctx = getContext();
+
+    if (!ctx || !ctx->reply) {
+        return 0;
+    }
+    ResponseBuilder *reply = ctx->reply;
+    SocketClient *c = ctx->replyClient;
+    ctx->reply = NULL;
+    ctx->replyClient = NULL;
+
+    int rc = reply->flush(c);
+    delete reply;
+    if (rc && errno == ENOMEM) {
+        // Better a plain failure than a listing with lines missing
+        sendMsg(c, ResponseCode::OperationFailed, "Reply too large", true);
+    } else if (rc) {
+        EpollListener::dropClient(c);
+    }
+    return rc;
+}
 
 NetdCommand::NetdCommand(const char *cmd) :
               FrameworkCommand(cmd)  {
+    mSubCmds = NULL;
+    mNumSubCmds = 0;
+    mLock = NULL;
+    mQueue = NULL;
+    mStats = NULL;
+    mNumStats = 0;
+    pthread_mutex_init(&mStatsLock, NULL);
+}
+
+NetdCommand::NetdCommand(const char *cmd, const SubCommand *subCmds, int numSubCmds,
+                         pthread_mutex_t *lock) :
+              FrameworkCommand(cmd)  {
+    mSubCmds = subCmds;
+    mNumSubCmds = numSubCmds;
+    mLock = lock;
+    mQueue = NULL;
+    if (!checkSorted(cmd, subCmds, numSubCmds)) {
+        LOGE("Subcommands of '%s' are not sorted; lookups will fail", cmd);
+    }
+
+    pthread_mutex_init(&mStatsLock, NULL);
+    mNumStats = countLeaves(subCmds, numSubCmds);
+    mStats = (SubCommandStats *) calloc(mNumStats, sizeof(SubCommandStats));
+    int n = 0;
+    addStats(cmd, subCmds, numSubCmds, &n);
+}
+
+int NetdCommand::countLeaves(const SubCommand *table, int n) {
+    int leaves = 0;
+
+    for (int i = 0; i < n; i++) {
+        leaves += table[i].subCmds ? countLeaves(table[i].subCmds, table[i].numSubCmds) : 1;
+    }
+    return leaves;
+}
+
+void NetdCommand::addStats(const char *prefix, const SubCommand *table, int n, int *next) {
+    for (int i = 0; i < n; i++) {
+        char name[sizeof(mStats[0].name)];
+
+        snprintf(name, sizeof(name), *table[i].verb ? "%s %s" : "%s", prefix, table[i].verb);
+        if (table[i].subCmds) {
+            addStats(name, table[i].subCmds, table[i].numSubCmds, next);
+        } else {
+            mStats[*next].subCmd = &table[i];
+            strcpy(mStats[*next].name, name);
+            table[i].statsIndex = *next;
+            (*next)++;
+        }
+    }
+}
+
+SubCommandStats *NetdCommand::findStats(const SubCommand *sc) {
+    int i = sc->statsIndex;
+
+    // Checked, in case the entry belongs to some other command's table
+    if (i < 0 || i >= mNumStats || mStats[i].subCmd != sc) {
+        return NULL;
+    }
+    return &mStats[i];
+}
+
+void NetdCommand::recordStats(const SubCommand *sc, uint32_t latencyUs, uint64_t execUs,
+                              bool error) {
+    SubCommandStats *st = findStats(sc);
+    int bucket = 0;
+
+    if (!st) {
+        return;
+    }
+    // Bucket i holds latencies under 2^i ms; the last one takes the rest
+    while (bucket < STATS_BUCKETS - 1 && latencyUs >= (1000U << bucket)) {
+        bucket++;
+    }
+
+    pthread_mutex_lock(&mStatsLock);
+    st->calls++;
+    if (error) {
+        st->errors++;
+    }
+    st->totalUs += latencyUs;
+    st->execUs += execUs;
+    if (latencyUs > st->maxUs) {
+        st->maxUs = latencyUs;
+    }
+    st->buckets[bucket]++;
+    pthread_mutex_unlock(&mStatsLock);
+}
+
+void NetdCommand::sendStats(SocketClient *cli) {
+    pthread_mutex_lock(&mStatsLock);
+    for (int i = 0; i < mNumStats; i++) {
+        SubCommandStats *st = &mStats[i];
+        char hist[STATS_BUCKETS * 11];
+        char *msg = NULL;
+        int len = 0;
+
+        if (!st->calls) {
+            continue;
+        }
+        for (int b = 0; b < STATS_BUCKETS; b++) {
+            len += snprintf(hist + len, sizeof(hist) - len, "%s%u", (b ? "," : ""),
+                            st->buckets[b]);
+        }
+        asprintf(&msg, "%s calls %u errors %u avg_us %llu max_us %u exec_us %llu hist %s",
+                 st->name, st->calls, st->errors,
+                 (unsigned long long) (st->totalUs / st->calls), st->maxUs,
+                 (unsigned long long) st->execUs, hist);
+        sendMsg(cli, ResponseCode::CommandStatsResult, msg, false);
+        free(msg);
+    }
+    pthread_mutex_unlock(&mStatsLock);
+}
+
+void NetdCommand::resetStats() {
+    pthread_mutex_lock(&mStatsLock);
+    for (int i = 0; i < mNumStats; i++) {
+        const SubCommand *sc = mStats[i].subCmd;
+        char name[sizeof(mStats[i].name)];
+
+        strcpy(name, mStats[i].name);
+        memset(&mStats[i], 0, sizeof(mStats[i]));
+        mStats[i].subCmd = sc;
+        strcpy(mStats[i].name, name);
+    }
+    pthread_mutex_unlock(&mStatsLock);
+}
+
+bool NetdCommand::checkSorted(const char *cmd, const SubCommand *table, int n) {
+    for (int i = 0; i < n; i++) {
+        if (i > 0 && strcmp(table[i - 1].verb, table[i].verb) >= 0) {
+            LOGE("%s: '%s' is out of order", cmd, table[i].verb);
+            return false;
+        }
+        if (table[i].subCmds &&
+            !checkSorted(table[i].verb, table[i].subCmds, table[i].numSubCmds)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int compareVerb(const void *key, const void *entry) {
+    return strcmp((const char *) key, ((const SubCommand *) entry)->verb);
+}
+
+const SubCommand *NetdCommand::findSubCommand(const SubCommand *table, int n,
+                                              const char *verb) {
+    return (const SubCommand *) bsearch(verb, table, n, sizeof(SubCommand), compareVerb);
+}
+
+bool NetdCommand::checkArgTypes(const char *types, int argc, char **argv, int first,
+                                int *badArg) {
+    struct in_addr addr;
+    char type = 's';
+
+    if (!types) {
+        return true;
+    }
+
+    for (int i = first; i < argc; i++) {
+        if (*types) {
+            type = *types++;
+        }
+
+        bool ok = true;
+        if (type == 'd') {
+            char *end;
+            strtol(argv[i], &end, 10);
+            ok = (*argv[i] != '\0' && *end == '\0');
+        } else if (type == 'a') {
+            ok = (inet_aton(argv[i], &addr) != 0);
+        } else if (type == 'i') {
+            struct in6_addr addr6;
+            ok = (inet_aton(argv[i], &addr) != 0 ||
+                  inet_pton(AF_INET6, argv[i], &addr6) > 0);
+        }
+        if (!ok) {
+            *badArg = i;
+            return false;
+        }
+    }
+    return true;
+}
+
+const SubCommand *NetdCommand::resolve(SocketClient *cli, int argc, char **argv) {
+    const SubCommand *table = mSubCmds;
+    int n = mNumSubCmds;
+    const SubCommand *sc = NULL;
+    int depth = 1;
+
+    if (n == 1 && !*table[0].verb) {
+        sc = table;
+        table = NULL;
+    }
+    for (; table; depth++) {
+        if (argc <= depth) {
+            sendMsg(cli, ResponseCode::CommandSyntaxError,
+                         (sc && sc->usage) ? sc->usage : "Missing argument", false);
+            return NULL;
+        }
+        if (!(sc = findSubCommand(table, n, argv[depth]))) {
+            char *msg = NULL;
+            asprintf(&msg, "Unknown %s cmd", argv[depth - 1]);
+            sendMsg(cli, ResponseCode::CommandSyntaxError, msg, false);
+            free(msg);
+            return NULL;
+        }
+        table = sc->subCmds;
+        n = sc->numSubCmds;
+    }
+
+    if (!sc) {
+        LOGE("No subcommands registered for '%s'", getCommand());
+        sendMsg(cli, ResponseCode::CommandSyntaxError, "Unknown cmd", false);
+        return NULL;
+    }
+
+    if (argc < sc->minArgc || (sc->maxArgc >= 0 && argc > sc->maxArgc)) {
+        sendMsg(cli, ResponseCode::CommandSyntaxError,
+                     sc->usage ? sc->usage : "Wrong number of arguments", false);
+        return NULL;
+    }
+
+    int badArg;
+    if (!checkArgTypes(sc->argTypes, argc, argv, depth, &badArg)) {
+        char *msg = NULL;
+        asprintf(&msg, "Invalid argument '%s'", argv[badArg]);
+        sendMsg(cli, ResponseCode::CommandParameterError, msg, false);
+        free(msg);
+        return NULL;
+    }
+    return sc;
+}
+
+void NetdCommand::runSubCommand(SocketClient *cli, const SubCommand *sc, int tag,
+                                void *prepared, int argc, char **argv) {
+    ThreadContext *ctx = getContext();
+    uint64_t start = nowUs();
+
+    setCurrentTag(tag);
+    if (ctx) {
+        ctx->lastCode = 0;
+        ctx->prepared = prepared;
+    }
+    logwrap_reset_exec_time_us();
+    beginReply(cli);
+    pthread_mutex_t *lock = getLock(sc);
+    if (lock) {
+        pthread_mutex_lock(lock);
+    }
+    int rc = sc->handler(cli, argc, argv);
+    int savedErrno = errno;
+    if (lock) {
+        pthread_mutex_unlock(lock);
+    }
+
+    if (sc->okMsg) {
+        if (!rc) {
+            sendMsg(cli, ResponseCode::CommandOkay, sc->okMsg, false);
+        } else {
+            errno = savedErrno;
+            sendMsg(cli, ResponseCode::OperationFailed, sc->failMsg, true);
+        }
+    }
+    endReply();
+    setCurrentTag(-1);
+    if (ctx) {
+        ctx->prepared = NULL;
+    }
+
+    // Handlers that reply themselves report failure only by the code they send
+    bool error = sc->okMsg ? (rc != 0) : (ctx && ctx->lastCode >= 400);
+    recordStats(sc, (uint32_t) (nowUs() - start), logwrap_get_exec_time_us(), error);
+}
+
+void NetdCommand::runJob(void *obj) {
+    Job *job = reinterpret_cast<Job *>(obj);
+
+    job->cmd->runSubCommand(job->client, job->subCmd, job->tag, job->prepared,
+                            job->argc, job->argv);
+    job->client->decRef();
+    for (int i = 0; i < job->argc; i++) {
+        free(job->argv[i]);
+    }
+    delete job;
+}
+
+int NetdCommand::runCommand(SocketClient *cli, int argc, char **argv) {
+    return dispatch(cli, -1, argc, argv);
+}
+
+int NetdCommand::dispatch(SocketClient *cli, int tag, int argc, char **argv) {
+    setCurrentTag(tag);
+    const SubCommand *sc = resolve(cli, argc, argv);
+    setCurrentTag(-1);
+
+    if (!sc) {
+        return 0;
+    }
+
+    void *prepared = NULL;
+    if (sc->prepare) {
+        setCurrentTag(tag);
+        prepared = sc->prepare(cli, argc, argv);
+        setCurrentTag(-1);
+        if (!prepared) {
+            return 0;
+        }
+    }
+    if (!mQueue || (sc->flags & SUBCMD_FLAG_INLINE)) {
+        runSubCommand(cli, sc, tag, prepared, argc, argv);
+        return 0;
+    }
+
+    // argv belongs to the listener's read buffer, so the job keeps a copy
+    Job *job = new Job;
+    job->cmd = this;
+    job->subCmd = sc;
+    job->client = cli;
+    job->tag = tag;
+    job->prepared = prepared;
+    job->argc = argc;
+    for (int i = 0; i < argc; i++) {
+        job->argv[i] = strdup(argv[i]);
+    }
+    job->argv[argc] = NULL;
+
+    // Acknowledge before queueing, so the ack can't follow the completion
+    setCurrentTag(tag);
+    if (tag >= 0) {
+        sendMsg(cli, ResponseCode::ActionInitiated, "Command started", false);
+    }
+
+    // Queued per connection, so one client's backlog can't hold up another.
+    // The job's reference keeps the key from being reused while it waits.
+    cli->incRef();
+    if (!mQueue->enqueue(runJob, job, cli, isPriority(cli))) {
+        cli->decRef();
+        for (int i = 0; i < argc; i++) {
+            free(job->argv[i]);
+        }
+        delete job;
+        if (prepared && sc->release) {
+            sc->release(prepared);
+        }
+        sendMsg(cli, ResponseCode::OperationFailed, "Too many commands in progress", false);
+    }
+    setCurrentTag(-1);
+    return 0;
+}
+
+void NetdCommand::setPriority(SocketClient *c, bool priority) {
+    pthread_mutex_lock(&sPriorityLock);
+    PriorityClientCollection::iterator it;
+    for (it = sPriorityClients->begin(); it != sPriorityClients->end(); ++it) {
+        if (*it == c) {
+            break;
+        }
+    }
+    if (priority && it == sPriorityClients->end()) {
+        sPriorityClients->push_back(c);
+    } else if (!priority && it != sPriorityClients->end()) {
+        sPriorityClients->erase(it);
+    }
+    pthread_mutex_unlock(&sPriorityLock);
+}
+
+bool NetdCommand::isPriority(SocketClient *c) {
+    bool found = false;
+
+    pthread_mutex_lock(&sPriorityLock);
+    PriorityClientCollection::iterator it;
+    for (it = sPriorityClients->begin(); it != sPriorityClients->end(); ++it) {
+        if (*it == c) {
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sPriorityLock);
+    return found;
+}
+
+void NetdCommand::removeClient(SocketClient *c) {
+    setPriority(c, false);
 }
@@ -17,12 +17,214 @@
 #ifndef _NETD_COMMAND_H
 #define _NETD_COMMAND_H
 
+#include <pthread.h>
+#include <stdint.h>
 #include <sysutils/FrameworkCommand.h>
+#include <utils/List.h>
 
+#include "EpollListener.h"
+#include "WorkQueue.h"
+
+class SocketClient;
+class ResponseBuilder;
+
+typedef android::List<SocketClient *> PriorityClientCollection;
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/*
+ * Handles one subcommand. When the table entry has an okMsg, the return
+ * value picks the reply (0 for okMsg, anything else for failMsg with
+ * errno); otherwise the handler sends its own replies.
+ */
+typedef int (*SubCommandHandler)(SocketClient *cli, int argc, char **argv);
+
+/*
+ * Reverts a subcommand that succeeded, so a failed batch can be rolled
+ * back. saved is what the entry's SubCommandSaver captured before the
+ * subcommand ran (NULL if it has none); it is freed by the caller.
+ */
+typedef void *(*SubCommandSaver)(int argc, char **argv);
+typedef int (*SubCommandUndo)(void *saved, int argc, char **argv);
+
+/*
+ * Runs on the listener thread before a subcommand is queued, for state
+ * that must be taken in arrival order. What it returns is handed to the
+ * handler through getPrepared(); on NULL it has sent its own reply and the
+ * subcommand is dropped. The release function frees it if the subcommand
+ * never runs.
+ */
+typedef void *(*SubCommandPreparer)(SocketClient *cli, int argc, char **argv);
+typedef void (*SubCommandRelease)(void *prepared);
+
+/* Values of SubCommand.flags */
+#define SUBCMD_FLAG_INLINE  0x1     // Run on the listener thread; must not block
+
+/*
+ * One word of a command line. A table of these, sorted by verb, describes
+ * the words that may follow the command name (or the enclosing verb, for
+ * a nested table). A table whose only entry has an empty verb stands for
+ * a command that takes no verb at all. Arity and argument types are
+ * checked before the handler runs.
+ */
+struct SubCommand {
+    const char        *verb;
+    const SubCommand  *subCmds;     // Table for the next word, or NULL
+    int               numSubCmds;
+    int               minArgc;      // Bounds on the whole command's argc;
+    int               maxArgc;      // maxArgc -1 means unbounded
+    /*
+     * One character per argument after the verb: 's' any string, 'd' a
+     * decimal integer, 'a' an IPv4 address, 'i' an IPv4 or IPv6 address.
+     * The last character applies to any further arguments. NULL skips the
+     * check.
+     */
+    const char        *argTypes;
+    SubCommandHandler handler;
+    const char        *usage;
+    const char        *okMsg;
+    const char        *failMsg;
+    SubCommandSaver   save;
+    SubCommandUndo    undo;         // NULL if the subcommand can't be undone
+    int               flags;
+    SubCommandPreparer prepare;
+    SubCommandRelease  release;
+    pthread_mutex_t   *lock;        // Held instead of the command's lock, if set
+    mutable int       statsIndex;   // Of a leaf in its command's stats; set by it
+};
+
+/* Latency buckets kept per subcommand; bucket i counts calls under 2^i ms */
+#define STATS_BUCKETS 16
+
+struct SubCommandStats {
+    const SubCommand *subCmd;
+    char             name[64];      // All the words, e.g. "tether interface add"
+    unsigned int     calls;
+    unsigned int     errors;
+    uint64_t         totalUs;
+    uint64_t         execUs;        // Spent running programs through logwrap
+    uint32_t         maxUs;
+    unsigned int     buckets[STATS_BUCKETS];
+};
+
+/*
+ * A command whose subcommands are described by a SubCommand table. Once a
+ * work queue is set, subcommands run on its threads while holding the
+ * command's lock, or their own where the table gives one, so subcommands
+ * sharing a lock (i.e. driving the same controller) are serialized and the
+ * others run in parallel. Each client
+ * connection gets its own turn on the queue, and its queued commands run
+ * one at a time in the order they arrived. Clients marked priority go ahead of
+ * all the rest.
+ */
 class NetdCommand : public FrameworkCommand {
+    const SubCommand *mSubCmds;
+    int              mNumSubCmds;
+    pthread_mutex_t  *mLock;
+    WorkQueue        *mQueue;
+    pthread_mutex_t  mStatsLock;
+    SubCommandStats  *mStats;       // One per leaf of the table
+    int              mNumStats;
+
+    static pthread_mutex_t          sPriorityLock;
+    static PriorityClientCollection *sPriorityClients;
+
+    struct ThreadContext {
+        int             tag;            // Of the command this thread is running, or -1
+        int             lastCode;       // Last response code it sent
+        SocketClient    *replyClient;   // Whose replies are being collected
+        ResponseBuilder *reply;         // Between beginReply() and endReply()
+        void            *prepared;      // From the running subcommand's preparer
+    };
+
+    struct Job {
+        NetdCommand      *cmd;
+        const SubCommand *subCmd;
+        SocketClient     *client;   // ref counted
+        int              tag;
+        void             *prepared;
+        int              argc;
+        char             *argv[EpollListener::CMD_ARGS_MAX + 1];
+    };
+
 public:
     NetdCommand(const char *cmd);
+    NetdCommand(const char *cmd, const SubCommand *subCmds, int numSubCmds,
+                pthread_mutex_t *lock);
     virtual ~NetdCommand() {}
+
+    virtual int runCommand(SocketClient *c, int argc, char **argv);
+
+    /*
+     * Runs the command for a client that tagged it (tag >= 0). Replies
+     * carry the tag, and a command that goes to the work queue is first
+     * acknowledged with ActionInitiated so the client need not wait.
+     */
+    int dispatch(SocketClient *c, int tag, int argc, char **argv);
+
+    /*
+     * Sends a reply in the usual "<code> <msg>" form, or "<code> <tag> <msg>"
+     * while running a tagged command. Commands reply only through this.
+     */
+    static int sendMsg(SocketClient *c, int code, const char *msg, bool addErrno);
+    static void setCurrentTag(int tag);
+
+    /*
+     * Between these, this thread's replies to c are collected rather than
+     * sent, and endReply() sends them all with one write. Every subcommand
+     * runs this way, so a listing and its final reply cost one syscall and
+     * nothing can be written between their lines. Not nested.
+     */
+    static void beginReply(SocketClient *c);
+    static int endReply();
+
+    /* What the running subcommand's preparer returned, or NULL */
+    static void *getPrepared();
+
+    /*
+     * Formats a reply as sendMsg() would, without sending it. Returns a
+     * malloc'd string and its length (excluding the NUL), or NULL.
+     */
+    static char *formatMsg(int code, const char *msg, bool addErrno, int *len);
+
+    /* Sends a CommandStatsResult line per subcommand that has been called */
+    void sendStats(SocketClient *c);
+    void resetStats();
+
+    /*
+     * A priority client's queued subcommands run before those of every
+     * other client, for callers whose queries must not wait behind another
+     * client's backlog. removeClient() forgets a closed client.
+     */
+    static void setPriority(SocketClient *c, bool priority);
+    static bool isPriority(SocketClient *c);
+    static void removeClient(SocketClient *c);
+
+    void setWorkQueue(WorkQueue *queue) { mQueue = queue; }
+    pthread_mutex_t *getLock(const SubCommand *sc) { return sc->lock ? sc->lock : mLock; }
+
+    /*
+     * Finds the table entry for argv and checks its arity and argument
+     * types. On failure the error reply is sent and NULL returned.
+     */
+    const SubCommand *resolve(SocketClient *c, int argc, char **argv);
+    bool hasSubCommands() { return mSubCmds != NULL; }
+
+private:
+    void runSubCommand(SocketClient *c, const SubCommand *sc, int tag, void *prepared,
+                       int argc, char **argv);
+    static ThreadContext *getContext();
+    static void makeContextKey();
+    static int countLeaves(const SubCommand *table, int n);
+    void addStats(const char *prefix, const SubCommand *table, int n, int *next);
+    SubCommandStats *findStats(const SubCommand *sc);
+    void recordStats(const SubCommand *sc, uint32_t latencyUs, uint64_t execUs, bool error);
+    static void runJob(void *obj);
+    static const SubCommand *findSubCommand(const SubCommand *table, int n,
+                                            const char *verb);
+    static bool checkArgTypes(const char *types, int argc, char **argv, int first,
+                              int *badArg);
+    static bool checkSorted(const char *cmd, const SubCommand *table, int n);
 };
 
 #endif
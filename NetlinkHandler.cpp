@@ -17,30 +17,47 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <sys/epoll.h>
 
 #define LOG_TAG "Netd"
 
 #include <cutils/log.h>
 
 #include <sysutils/NetlinkEvent.h>
+#include <sysutils/SocketClient.h>
+
 #include "NetlinkHandler.h"
 #include "NetlinkManager.h"
+#include "EpollListener.h"
+#include "EventLoop.h"
 #include "ResponseCode.h"
+#include "AddressSorter.h"
+#include "ThrottleController.h"
+#include "UsbController.h"
 
 NetlinkHandler::NetlinkHandler(NetlinkManager *nm, int listenerSocket) :
                 NetlinkListener(listenerSocket) {
     mNm = nm;
+    mSock = listenerSocket;
+    mClient = new SocketClient(listenerSocket, false);
 }
 
 NetlinkHandler::~NetlinkHandler() {
+    mClient->decRef();
 }
 
 int NetlinkHandler::start() {
-    return this->startListener();
+    return EventLoop::Instance()->addFd(mSock, EPOLLIN, NetlinkHandler::dataReady, this);
 }
 
 int NetlinkHandler::stop() {
-    return this->stopListener();
+    return EventLoop::Instance()->removeFd(mSock);
+}
+
+void NetlinkHandler::dataReady(void *obj, int fd) {
+    NetlinkHandler *me = reinterpret_cast<NetlinkHandler *>(obj);
+
+    me->onDataAvailable(me->mClient);
 }
 
 void NetlinkHandler::onEvent(NetlinkEvent *evt) {
@@ -51,17 +68,27 @@ void NetlinkHandler::onEvent(NetlinkEvent *evt) {
     }
     if (!strcmp(subsys, "net")) {
         int action = evt->getAction();
+
+        // Any link change may alter the source address the kernel picks
+        AddressSorter::Instance()->invalidate();
+
         if (action == evt->NlActionAdd) {
             const char *iface = evt->findParam("INTERFACE");
             notifyInterfaceAdded(iface);
         } else if (action == evt->NlActionRemove) {
             const char *iface = evt->findParam("INTERFACE");
+            if (iface) {
+                ThrottleController::interfaceRemoved(iface);
+            }
             notifyInterfaceRemoved(iface);
         } else if (action == evt->NlActionChange) {
             evt->dump();
             const char *iface = evt->findParam("INTERFACE");
             notifyInterfaceChanged("nana", true);
         }
+    } else if (!strcmp(subsys, "usb_composite")) {
+        // A gadget function was switched; re-read RNDIS state on next query
+        UsbController::invalidate();
     }
 }
 
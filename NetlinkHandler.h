@@ -20,8 +20,16 @@
 #include <sysutils/NetlinkListener.h>
 #include "NetlinkManager.h"
 
+class SocketClient;
+
+/*
+ * Still a NetlinkListener, for its uevent checks and decoding, but fed from
+ * the EventLoop rather than a listener thread of its own.
+ */
 class NetlinkHandler: public NetlinkListener {
     NetlinkManager *mNm;
+    int            mSock;
+    SocketClient   *mClient;    // Wraps mSock for NetlinkListener
 
 public:
     NetlinkHandler(NetlinkManager *nm, int listenerSocket);
@@ -33,6 +41,8 @@ public:
 protected:
     virtual void onEvent(NetlinkEvent *evt);
 
+    static void dataReady(void *obj, int fd);
+
     void notifyInterfaceAdded(const char *name);
     void notifyInterfaceRemoved(const char *name);
     void notifyInterfaceChanged(const char *name, bool isUp);
@@ -24,6 +24,7 @@
 #include <sys/un.h>
 
 #include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 
 #define LOG_TAG "Netd"
 
@@ -31,6 +32,10 @@
 
 #include "NetlinkManager.h"
 #include "NetlinkHandler.h"
+#include "RouteNetlinkHandler.h"
+#include "NflogHandler.h"
+#include "QuotaController.h"
+#include "InterfaceTable.h"
 
 NetlinkManager *NetlinkManager::sInstance = NULL;
 
@@ -42,6 +47,12 @@ NetlinkManager *NetlinkManager::Instance() {
 
 NetlinkManager::NetlinkManager() {
     mBroadcaster = NULL;
+    mHandler = NULL;
+    mSock = -1;
+    mRouteHandler = NULL;
+    mRouteSock = -1;
+    mNflogHandler = NULL;
+    mNflogSock = -1;
 }
 
 NetlinkManager::~NetlinkManager() {
@@ -83,6 +94,58 @@ int NetlinkManager::start() {
         LOGE("Unable to start NetlinkHandler: %s", strerror(errno));
         return -1;
     }
+
+    // Subscribe before the dump so no change falls between the two
+    memset(&nladdr, 0, sizeof(nladdr));
+    nladdr.nl_family = AF_NETLINK;
+    nladdr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+
+    if ((mRouteSock = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE)) < 0) {
+        LOGE("Unable to create rtnetlink socket: %s", strerror(errno));
+        return -1;
+    }
+
+    if (setsockopt(mRouteSock, SOL_SOCKET, SO_RCVBUFFORCE, &sz, sizeof(sz)) < 0) {
+        LOGE("Unable to set rtnetlink socket SO_RCVBUFFORCE option: %s", strerror(errno));
+        return -1;
+    }
+
+    if (bind(mRouteSock, (struct sockaddr *) &nladdr, sizeof(nladdr)) < 0) {
+        LOGE("Unable to bind rtnetlink socket: %s", strerror(errno));
+        return -1;
+    }
+
+    if (InterfaceTable::Instance()->load()) {
+        LOGE("Unable to load interface table: %s", strerror(errno));
+        return -1;
+    }
+
+    mRouteHandler = new RouteNetlinkHandler(mRouteSock);
+    if (mRouteHandler->start()) {
+        LOGE("Unable to start RouteNetlinkHandler: %s", strerror(errno));
+        return -1;
+    }
+
+    // Quota alerts need NFLOG in the kernel; everything else works without it
+    memset(&nladdr, 0, sizeof(nladdr));
+    nladdr.nl_family = AF_NETLINK;
+
+    if ((mNflogSock = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_NETFILTER)) < 0 ||
+        bind(mNflogSock, (struct sockaddr *) &nladdr, sizeof(nladdr)) < 0 ||
+        NflogHandler::bindGroup(mNflogSock, QUOTA_NFLOG_GROUP)) {
+        LOGW("Unable to listen for NFLOG quota alerts: %s", strerror(errno));
+        if (mNflogSock >= 0) {
+            close(mNflogSock);
+            mNflogSock = -1;
+        }
+        return 0;
+    }
+
+    mNflogHandler = new NflogHandler(mNflogSock);
+    if (mNflogHandler->start()) {
+        LOGE("Unable to start NflogHandler: %s", strerror(errno));
+        return -1;
+    }
     return 0;
 }
 
@@ -97,5 +160,27 @@ int NetlinkManager::stop() {
     close(mSock);
     mSock = -1;
 
+    if (mRouteHandler->stop()) {
+        LOGE("Unable to stop RouteNetlinkHandler: %s", strerror(errno));
+        return -1;
+    }
+    delete mRouteHandler;
+    mRouteHandler = NULL;
+
+    close(mRouteSock);
+    mRouteSock = -1;
+
+    if (mNflogHandler) {
+        if (mNflogHandler->stop()) {
+            LOGE("Unable to stop NflogHandler: %s", strerror(errno));
+            return -1;
+        }
+        delete mNflogHandler;
+        mNflogHandler = NULL;
+
+        close(mNflogSock);
+        mNflogSock = -1;
+    }
+
     return 0;
 }
@@ -17,19 +17,25 @@
 #ifndef _NETLINKMANAGER_H
 #define _NETLINKMANAGER_H
 
-#include <sysutils/SocketListener.h>
 #include <sysutils/NetlinkListener.h>
 
+class EpollListener;
 class NetlinkHandler;
+class RouteNetlinkHandler;
+class NflogHandler;
 
 class NetlinkManager {
 private:
     static NetlinkManager *sInstance;
 
 private:
-    SocketListener       *mBroadcaster;
+    EpollListener        *mBroadcaster;
     NetlinkHandler       *mHandler;
     int                  mSock;
+    RouteNetlinkHandler  *mRouteHandler;
+    int                  mRouteSock;
+    NflogHandler         *mNflogHandler;
+    int                  mNflogSock;
 
 public:
     virtual ~NetlinkManager();
@@ -37,8 +43,8 @@ public:
     int start();
     int stop();
 
-    void setBroadcaster(SocketListener *sl) { mBroadcaster = sl; }
-    SocketListener *getBroadcaster() { return mBroadcaster; }
+    void setBroadcaster(EpollListener *el) { mBroadcaster = el; }
+    EpollListener *getBroadcaster() { return mBroadcaster; }
 
     static NetlinkManager *Instance();
 
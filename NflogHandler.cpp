@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_log.h>
+
+#define LOG_TAG "Netd"
+
+#include <cutils/log.h>
+
+#include "NflogHandler.h"
+#include "EventLoop.h"
+#include "QuotaController.h"
+
+#ifndef NLA_TYPE_MASK
+#define NLA_TYPE_MASK 0x3fff
+#endif
+
+NflogHandler::NflogHandler(int listenerSocket) {
+    mSock = listenerSocket;
+}
+
+NflogHandler::~NflogHandler() {
+}
+
+int NflogHandler::start() {
+    return EventLoop::Instance()->addFd(mSock, EPOLLIN, NflogHandler::dataReady, this);
+}
+
+int NflogHandler::stop() {
+    return EventLoop::Instance()->removeFd(mSock);
+}
+
+void NflogHandler::dataReady(void *obj, int fd) {
+    reinterpret_cast<NflogHandler *>(obj)->onDataAvailable();
+}
+
+int NflogHandler::sendConfig(int sock, int group, int type, const void *data, int len) {
+    struct {
+        struct nlmsghdr nh;
+        struct nfgenmsg nfg;
+        char            attr[RTA_SPACE(8)];
+    } req;
+    struct rtattr *rta = (struct rtattr *) req.attr;
+    struct sockaddr_nl kernel;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.nfg) + RTA_SPACE(len));
+    req.nh.nlmsg_type = (NFNL_SUBSYS_ULOG << 8) | NFULNL_MSG_CONFIG;
+    req.nh.nlmsg_flags = NLM_F_REQUEST;
+    req.nfg.nfgen_family = AF_INET;
+    req.nfg.version = NFNETLINK_V0;
+    req.nfg.res_id = htons(group);
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+    if (sendto(sock, &req, req.nh.nlmsg_len, 0, (struct sockaddr *) &kernel,
+               sizeof(kernel)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int NflogHandler::bindGroup(int sock, int group) {
+    struct nfulnl_msg_config_cmd cmd;
+    struct nfulnl_msg_config_mode mode;
+
+    cmd.command = NFULNL_CFG_CMD_BIND;
+    if (sendConfig(sock, group, NFULA_CFG_CMD, &cmd, sizeof(cmd))) {
+        return -1;
+    }
+
+    // The prefix is all we need; don't copy packet contents up
+    memset(&mode, 0, sizeof(mode));
+    mode.copy_mode = NFULNL_COPY_META;
+    return sendConfig(sock, group, NFULA_CFG_MODE, &mode, sizeof(mode));
+}
+
+void NflogHandler::onDataAvailable() {
+    char buf[4096];
+    struct sockaddr_nl from;
+    socklen_t fromLen = sizeof(from);
+    int len;
+
+    len = TEMP_FAILURE_RETRY(recvfrom(mSock, buf, sizeof(buf), 0,
+                                      (struct sockaddr *) &from, &fromLen));
+    if (len < 0) {
+        if (errno == ENOBUFS) {
+            // A dropped alert is repeated by the rule's rate limit
+            return;
+        }
+        LOGE("nflog read failed (%s)", strerror(errno));
+        return;
+    }
+    if (from.nl_pid != 0) {
+        return;
+    }
+
+    struct nlmsghdr *nh = (struct nlmsghdr *) buf;
+    for (; NLMSG_OK(nh, (unsigned) len); nh = NLMSG_NEXT(nh, len)) {
+        if (nh->nlmsg_type != ((NFNL_SUBSYS_ULOG << 8) | NFULNL_MSG_PACKET) ||
+            nh->nlmsg_len < NLMSG_LENGTH(sizeof(struct nfgenmsg))) {
+            continue;
+        }
+
+        // Netfilter attributes are laid out like rtnetlink ones
+        struct rtattr *rta = (struct rtattr *) ((char *) NLMSG_DATA(nh) +
+                                                NLMSG_ALIGN(sizeof(struct nfgenmsg)));
+        int attrLen = nh->nlmsg_len - NLMSG_SPACE(sizeof(struct nfgenmsg));
+        for (; RTA_OK(rta, attrLen); rta = RTA_NEXT(rta, attrLen)) {
+            if ((rta->rta_type & NLA_TYPE_MASK) == NFULA_PREFIX && RTA_PAYLOAD(rta) > 0) {
+                char prefix[64];
+                int n = RTA_PAYLOAD(rta) < sizeof(prefix) ? RTA_PAYLOAD(rta) : sizeof(prefix);
+                memcpy(prefix, RTA_DATA(rta), n);
+                prefix[n - 1] = '\0';
+                QuotaController::Instance()->handleAlert(prefix);
+            }
+        }
+    }
+}
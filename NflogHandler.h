@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NFLOG_HANDLER_H
+#define _NFLOG_HANDLER_H
+
+/*
+ * Receives the packets the quota rules log to QUOTA_NFLOG_GROUP and hands
+ * their prefixes to the QuotaController.
+ */
+class NflogHandler {
+    int mSock;
+
+public:
+    NflogHandler(int listenerSocket);
+    virtual ~NflogHandler();
+
+    int start(void);
+    int stop(void);
+
+    /* Binds a NETLINK_NETFILTER socket to an NFLOG group, metadata only */
+    static int bindGroup(int sock, int group);
+
+private:
+    static void dataReady(void *obj, int fd);
+    void onDataAvailable();
+    static int sendConfig(int sock, int group, int type, const void *data, int len);
+};
+#endif
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#define LOG_TAG "QuotaController"
+#include <cutils/log.h>
+
+#include "QuotaController.h"
+#include "ExecArgs.h"
+#include "EpollListener.h"
+#include "NetlinkManager.h"
+#include "ResponseCode.h"
+
+/* Chains are named this plus the interface, which fits iptables' 28 chars */
+#define QUOTA_CHAIN_PREFIX "netd_quota_"
+
+QuotaController *QuotaController::sInstance = NULL;
+
+QuotaController *QuotaController::Instance() {
+    if (!sInstance)
+        sInstance = new QuotaController();
+    return sInstance;
+}
+
+QuotaController::QuotaController() {
+    pthread_mutex_init(&mLock, NULL);
+    pthread_mutex_init(&mRulesLock, NULL);
+    mQuotas = new InterfaceQuotaCollection();
+}
+
+QuotaController::~QuotaController() {
+    InterfaceQuotaCollection::iterator it;
+
+    for (it = mQuotas->begin(); it != mQuotas->end(); ++it) {
+        free(*it);
+    }
+    delete mQuotas;
+    pthread_mutex_destroy(&mLock);
+    pthread_mutex_destroy(&mRulesLock);
+}
+
+InterfaceQuota *QuotaController::findLocked(const char *iface) {
+    InterfaceQuotaCollection::iterator it;
+
+    for (it = mQuotas->begin(); it != mQuotas->end(); ++it) {
+        if (!strcmp((*it)->iface, iface)) {
+            return *it;
+        }
+    }
+    return NULL;
+}
+
+int QuotaController::addRules(const char *iface, uint64_t bytes) {
+    char chain[32], quota[24], group[8];
+
+    snprintf(chain, sizeof(chain), QUOTA_CHAIN_PREFIX "%s", iface);
+    snprintf(quota, sizeof(quota), "%llu", (unsigned long long) bytes);
+    snprintf(group, sizeof(group), "%d", QUOTA_NFLOG_GROUP);
+
+    if (ExecArgs::runIptables("-t", "mangle", "-N", chain, NULL)) {
+        return -1;
+    }
+
+    // The limit only keeps a saturated link from flooding the log
+    if (ExecArgs::runIptables("-t", "mangle", "-A", chain, "-m", "quota", "--quota", quota,
+                              "-j", "RETURN", NULL)) {
+        goto fail;
+    }
+    if (ExecArgs::runIptables("-t", "mangle", "-A", chain, "-m", "limit", "--limit", "1/min",
+                              "-j", "NFLOG", "--nflog-group", group, "--nflog-prefix", iface,
+                              NULL)) {
+        goto fail;
+    }
+
+    if (ExecArgs::runIptables("-t", "mangle", "-A", "PREROUTING", "-i", iface, "-j", chain, NULL)) {
+        goto fail;
+    }
+    if (ExecArgs::runIptables("-t", "mangle", "-A", "POSTROUTING", "-o", iface, "-j", chain, NULL)) {
+        goto fail;
+    }
+    return 0;
+
+fail:
+    int savedErrno = errno;
+    removeRules(iface);
+    errno = savedErrno;
+    return -1;
+}
+
+/* Takes down whatever part of the rules exists, so it can't fail halfway */
+int QuotaController::removeRules(const char *iface) {
+    char chain[32];
+    int rc = 0;
+
+    snprintf(chain, sizeof(chain), QUOTA_CHAIN_PREFIX "%s", iface);
+    ExecArgs::runIptables("-t", "mangle", "-D", "PREROUTING", "-i", iface, "-j", chain, NULL);
+    ExecArgs::runIptables("-t", "mangle", "-D", "POSTROUTING", "-o", iface, "-j", chain, NULL);
+    ExecArgs::runIptables("-t", "mangle", "-F", chain, NULL);
+    if (ExecArgs::runIptables("-t", "mangle", "-X", chain, NULL)) {
+        rc = -1;
+    }
+    return rc;
+}
+
+/* Returns whether there was a quota to drop */
+bool QuotaController::forgetLocked(const char *iface) {
+    InterfaceQuotaCollection::iterator it;
+
+    for (it = mQuotas->begin(); it != mQuotas->end(); ++it) {
+        if (!strcmp((*it)->iface, iface)) {
+            free(*it);
+            mQuotas->erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * iptables runs under mRulesLock alone. mLock is only held to look at or
+ * update the list, as handleAlert() takes it on the event loop's thread.
+ */
+int QuotaController::setQuota(const char *iface, uint64_t bytes) {
+    InterfaceQuota *quota;
+
+    if (!bytes || strlen(iface) >= IFNAMSIZ || strchr(iface, ' ')) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&mRulesLock);
+    pthread_mutex_lock(&mLock);
+    bool existed = (findLocked(iface) != NULL);
+    pthread_mutex_unlock(&mLock);
+
+    if (existed) {
+        removeRules(iface);
+    }
+    if (addRules(iface, bytes)) {
+        // The old rules are gone as well, so the quota goes with them
+        int savedErrno = errno;
+        pthread_mutex_lock(&mLock);
+        forgetLocked(iface);
+        pthread_mutex_unlock(&mLock);
+        pthread_mutex_unlock(&mRulesLock);
+        errno = savedErrno;
+        return -1;
+    }
+
+    pthread_mutex_lock(&mLock);
+    if (!(quota = findLocked(iface))) {
+        if (!(quota = (InterfaceQuota *) calloc(1, sizeof(InterfaceQuota)))) {
+            pthread_mutex_unlock(&mLock);
+            removeRules(iface);
+            pthread_mutex_unlock(&mRulesLock);
+            errno = ENOMEM;
+            return -1;
+        }
+        strlcpy(quota->iface, iface, sizeof(quota->iface));
+        mQuotas->push_back(quota);
+    }
+    quota->bytes = bytes;
+    quota->alerted = false;
+    pthread_mutex_unlock(&mLock);
+    pthread_mutex_unlock(&mRulesLock);
+    return 0;
+}
+
+int QuotaController::removeQuota(const char *iface) {
+    pthread_mutex_lock(&mRulesLock);
+    pthread_mutex_lock(&mLock);
+    bool existed = forgetLocked(iface);
+    pthread_mutex_unlock(&mLock);
+
+    if (!existed) {
+        pthread_mutex_unlock(&mRulesLock);
+        errno = ENOENT;
+        return -1;
+    }
+    int rc = removeRules(iface);
+    pthread_mutex_unlock(&mRulesLock);
+    return rc;
+}
+
+InterfaceQuotaCollection *QuotaController::getQuotas() {
+    InterfaceQuotaCollection *quotas = new InterfaceQuotaCollection();
+    InterfaceQuotaCollection::iterator it;
+
+    pthread_mutex_lock(&mLock);
+    for (it = mQuotas->begin(); it != mQuotas->end(); ++it) {
+        InterfaceQuota *copy = (InterfaceQuota *) malloc(sizeof(InterfaceQuota));
+        if (copy) {
+            memcpy(copy, *it, sizeof(*copy));
+            quotas->push_back(copy);
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+    return quotas;
+}
+
+void QuotaController::handleAlert(const char *prefix) {
+    bool send = false;
+
+    pthread_mutex_lock(&mLock);
+    InterfaceQuota *quota = findLocked(prefix);
+    if (quota && !quota->alerted) {
+        quota->alerted = true;
+        send = true;
+    }
+    pthread_mutex_unlock(&mLock);
+
+    if (send) {
+        char msg[255];
+        EpollListener *broadcaster = NetlinkManager::Instance()->getBroadcaster();
+
+        LOGI("Quota reached on %s", prefix);
+        snprintf(msg, sizeof(msg), "Iface quota reached %s", prefix);
+        if (broadcaster) {
+            broadcaster->sendBroadcast(ResponseCode::QuotaLimitReached, msg, false);
+        }
+    }
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _QUOTA_CONTROLLER_H
+#define _QUOTA_CONTROLLER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <net/if.h>
+
+#include <utils/List.h>
+
+/* NFLOG group the quota rules log to once a quota is used up */
+#define QUOTA_NFLOG_GROUP 1
+
+struct InterfaceQuota {
+    char     iface[IFNAMSIZ];
+    uint64_t bytes;
+    bool     alerted;
+};
+
+typedef android::List<InterfaceQuota *> InterfaceQuotaCollection;
+
+/*
+ * Per-interface data quotas counted by the kernel. Each quota is an
+ * iptables chain in the mangle table, reached from PREROUTING and
+ * POSTROUTING for its interface, that returns while a quota match still
+ * has bytes left and NFLOGs packets after that. The first NFLOG'd packet
+ * becomes a QuotaLimitReached broadcast. The mangle table keeps the rules
+ * out of the way of the filter and nat flushes NatController does.
+ */
+class QuotaController {
+    static QuotaController *sInstance;
+
+    pthread_mutex_t          mLock;         // Guards mQuotas; held only briefly
+    pthread_mutex_t          mRulesLock;    // Serializes changes to the rules
+    InterfaceQuotaCollection *mQuotas;
+
+public:
+    virtual ~QuotaController();
+
+    static QuotaController *Instance();
+
+    /* Replaces any quota on the interface, starting the count over */
+    int setQuota(const char *iface, uint64_t bytes);
+    int removeQuota(const char *iface);
+
+    /* Copies of the current quotas; caller frees */
+    InterfaceQuotaCollection *getQuotas();
+
+    /* Called with the prefix of each packet logged to QUOTA_NFLOG_GROUP */
+    void handleAlert(const char *prefix);
+
+private:
+    QuotaController();
+
+    InterfaceQuota *findLocked(const char *iface);
+    bool forgetLocked(const char *iface);
+    int addRules(const char *iface, uint64_t bytes);
+    int removeRules(const char *iface);
+};
+
+#endif
@@ -14,6 +14,18 @@
  * limitations under the License.
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
 #define LOG_TAG "ResolverController"
 #define DBG 0
 
@@ -23,6 +35,56 @@
 #include <resolv.h>
 
 #include "ResolverController.h"
+#include "AddressSorter.h"
+#include "WorkQueue.h"
+
+/* A failed lookup this slow means the first nameserver timed out */
+#define BREAKER_TIMEOUT_MS      2000
+/* Timeouts in a row before a nameserver is taken out of use */
+#define BREAKER_MAX_TIMEOUTS    3
+/* Timeouts further apart than this are not "in a row" */
+#define BREAKER_WINDOW_SECS     60
+/* How often open nameservers are probed */
+#define PROBE_INTERVAL_SECS     30
+#define PROBE_TIMEOUT_MS        2000
+
+#define WARMUP_LIST_DIR         "/data/misc/netd"
+#define WARMUP_LIST_PATH        WARMUP_LIST_DIR "/dns_warmup"
+#define WARMUP_MAX_HOSTS        16
+/* Warm-up lookups run this many at a time */
+#define WARMUP_THREADS          4
+
+ResolverController::ResolverController() {
+    pthread_mutex_init(&mLock, NULL);
+    memset(mDefaultIface, 0, sizeof(mDefaultIface));
+    mConfigs = new InterfaceDnsConfigCollection();
+    mProbing = false;
+    mWarmupHosts = new HostnameCollection();
+    mWarmupPending = false;
+    mWarmupInFlight = 0;
+    mWarmupAgain = false;
+    mWarmupQueue = new WorkQueue("warmup", WARMUP_THREADS, WARMUP_MAX_HOSTS);
+    if (mWarmupQueue->start()) {
+        LOGE("Unable to start DNS warm-up threads");
+    }
+    loadWarmupHosts();
+    mQueryLog = new DnsQueryLog();
+    mPrimaryServer = DNS_QUERY_SERVER_NONE;
+}
+
+ResolverController::~ResolverController() {
+    InterfaceDnsConfigCollection::iterator it;
+
+    for (it = mConfigs->begin(); it != mConfigs->end(); ++it) {
+        delete *it;
+    }
+    mConfigs->clear();
+    delete mConfigs;
+    clearWarmupHostsLocked();
+    delete mWarmupHosts;
+    delete mQueryLog;
+    pthread_mutex_destroy(&mLock);
+}
 
 int ResolverController::setDefaultInterface(const char* iface) {
     if (DBG) {
@@ -30,6 +92,19 @@ int ResolverController::setDefaultInterface(const char* iface) {
     }
 
     _resolv_set_default_iface(iface);
+    AddressSorter::Instance()->setDefaultInterface(iface);
+
+    pthread_mutex_lock(&mLock);
+    bool changed = strcmp(mDefaultIface, iface);
+    strncpy(mDefaultIface, iface, sizeof(mDefaultIface) - 1);
+    updatePrimaryServerLocked();
+    // Servers set earlier came with the interface address already bound
+    InterfaceDnsConfig *cfg = findConfigLocked(iface);
+    if (changed && cfg && cfg->numServers) {
+        mWarmupPending = false;
+        warmUpLocked();
+    }
+    pthread_mutex_unlock(&mLock);
 
     return 0;
 }
@@ -39,7 +114,40 @@ int ResolverController::setInterfaceDnsServers(const char* iface, char** servers
         LOGD("setInterfaceDnsServers iface = %s\n", iface);
     }
 
-    _resolv_set_nameservers_for_iface(iface, servers, numservers);
+    if (numservers > RESOLVER_MAX_SERVERS) {
+        LOGW("Ignoring all but the first %d of %d nameservers for %s",
+             RESOLVER_MAX_SERVERS, numservers, iface);
+        numservers = RESOLVER_MAX_SERVERS;
+    }
+
+    pthread_mutex_lock(&mLock);
+    InterfaceDnsConfig *cfg = findConfigLocked(iface);
+    if (!cfg) {
+        cfg = new InterfaceDnsConfig;
+        memset(cfg, 0, sizeof(*cfg));
+        strncpy(cfg->iface, iface, sizeof(cfg->iface) - 1);
+        mConfigs->push_back(cfg);
+    }
+
+    // The framework re-sends unchanged servers on every connectivity
+    // change; keep the breaker state of servers we already know.
+    bool same = (cfg->numServers == numservers);
+    for (int i = 0; same && i < numservers; i++) {
+        same = !strcmp(cfg->servers[i].addr, servers[i]);
+    }
+    if (!same) {
+        memset(cfg->servers, 0, sizeof(cfg->servers));
+        for (int i = 0; i < numservers; i++) {
+            strncpy(cfg->servers[i].addr, servers[i], sizeof(cfg->servers[i].addr) - 1);
+        }
+        cfg->numServers = numservers;
+    }
+    pushServersLocked(cfg);
+    // Lookups can't go out until setInterfaceAddress() binds the interface
+    if (!same && !strcmp(iface, mDefaultIface)) {
+        mWarmupPending = true;
+    }
+    pthread_mutex_unlock(&mLock);
 
     return 0;
 }
@@ -50,6 +158,14 @@ int ResolverController::setInterfaceAddress(const char* iface, struct in_addr* a
     }
 
     _resolv_set_addr_of_iface(iface, addr);
+    AddressSorter::Instance()->invalidate();
+
+    pthread_mutex_lock(&mLock);
+    if (mWarmupPending && !strcmp(iface, mDefaultIface)) {
+        mWarmupPending = false;
+        warmUpLocked();
+    }
+    pthread_mutex_unlock(&mLock);
 
     return 0;
 }
@@ -73,3 +189,460 @@ int ResolverController::flushInterfaceDnsCache(const char* iface) {
 
     return 0;
 }
+
+InterfaceDnsConfig *ResolverController::findConfigLocked(const char *iface) {
+    InterfaceDnsConfigCollection::iterator it;
+
+    for (it = mConfigs->begin(); it != mConfigs->end(); ++it) {
+        if (!strcmp((*it)->iface, iface)) {
+            return *it;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Hands the resolver the servers whose breaker is closed, in configured
+ * order. When every server is open the full list is kept so the resolver
+ * is never left without servers; isDefaultInterfaceDark() lets the proxy
+ * fail those lookups fast instead.
+ */
+void ResolverController::pushServersLocked(InterfaceDnsConfig *cfg) {
+    char *active[RESOLVER_MAX_SERVERS];
+    int count = 0;
+    int i;
+
+    for (i = 0; i < cfg->numServers; i++) {
+        if (!cfg->servers[i].open) {
+            active[count++] = cfg->servers[i].addr;
+        }
+    }
+    if (!count) {
+        for (i = 0; i < cfg->numServers; i++) {
+            active[count++] = cfg->servers[i].addr;
+        }
+    }
+
+    _resolv_set_nameservers_for_iface(cfg->iface, active, count);
+    updatePrimaryServerLocked();
+}
+
+void ResolverController::updatePrimaryServerLocked() {
+    InterfaceDnsConfig *cfg = findConfigLocked(mDefaultIface);
+    int primary = DNS_QUERY_SERVER_NONE;
+
+    for (int i = 0; cfg && i < cfg->numServers; i++) {
+        if (!cfg->servers[i].open) {
+            primary = i;
+            break;
+        }
+    }
+    // With every server open the resolver still starts with the first
+    if (cfg && cfg->numServers && primary == DNS_QUERY_SERVER_NONE) {
+        primary = 0;
+    }
+    mPrimaryServer = primary;
+}
+
+/*
+ * Only a lookup that got no answer and took the full timeout counts
+ * against a server. Any answer, however slow, shows the server is alive
+ * and clears its run of timeouts.
+ */
+void ResolverController::reportLookup(int latencyMs, bool answered) {
+    if (!answered && latencyMs < BREAKER_TIMEOUT_MS) {
+        return;
+    }
+
+    pthread_mutex_lock(&mLock);
+    InterfaceDnsConfig *cfg = findConfigLocked(mDefaultIface);
+    NameserverState *ns = NULL;
+
+    // The resolver always starts with the first server still in use
+    for (int i = 0; cfg && i < cfg->numServers; i++) {
+        if (!cfg->servers[i].open) {
+            ns = &cfg->servers[i];
+            break;
+        }
+    }
+    if (!ns) {
+        pthread_mutex_unlock(&mLock);
+        return;
+    }
+    if (answered) {
+        ns->consecutiveTimeouts = 0;
+        pthread_mutex_unlock(&mLock);
+        return;
+    }
+
+    time_t now = time(NULL);
+    if (now - ns->lastTimeout > BREAKER_WINDOW_SECS) {
+        ns->consecutiveTimeouts = 0;
+    }
+    ns->consecutiveTimeouts++;
+    ns->totalTimeouts++;
+    ns->lastTimeout = now;
+
+    if (ns->consecutiveTimeouts >= BREAKER_MAX_TIMEOUTS) {
+        LOGW("Nameserver %s on %s timed out %d times in a row; taking it out of use",
+             ns->addr, cfg->iface, ns->consecutiveTimeouts);
+        ns->open = true;
+        pushServersLocked(cfg);
+        startProbingLocked();
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+bool ResolverController::isDefaultInterfaceDark() {
+    bool dark = false;
+
+    pthread_mutex_lock(&mLock);
+    InterfaceDnsConfig *cfg = findConfigLocked(mDefaultIface);
+    if (cfg && cfg->numServers) {
+        dark = true;
+        for (int i = 0; i < cfg->numServers; i++) {
+            if (!cfg->servers[i].open) {
+                dark = false;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+    return dark;
+}
+
+InterfaceDnsConfigCollection *ResolverController::getBreakerStatus() {
+    InterfaceDnsConfigCollection *status = new InterfaceDnsConfigCollection();
+    InterfaceDnsConfigCollection::iterator it;
+
+    pthread_mutex_lock(&mLock);
+    for (it = mConfigs->begin(); it != mConfigs->end(); ++it) {
+        InterfaceDnsConfig *copy = new InterfaceDnsConfig;
+        memcpy(copy, *it, sizeof(*copy));
+        status->push_back(copy);
+    }
+    pthread_mutex_unlock(&mLock);
+    return status;
+}
+
+void ResolverController::startProbingLocked() {
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    if (mProbing) {
+        return;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, ResolverController::probeThreadStart, this)) {
+        LOGE("Failed to start nameserver probe thread (%s)", strerror(errno));
+    } else {
+        mProbing = true;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+void *ResolverController::probeThreadStart(void *obj) {
+    ResolverController *me = reinterpret_cast<ResolverController *>(obj);
+
+    me->runProbes();
+    pthread_exit(NULL);
+    return NULL;
+}
+
+void ResolverController::runProbes() {
+    while (1) {
+        sleep(PROBE_INTERVAL_SECS);
+
+        // Probe from a snapshot so lookups aren't blocked behind the network
+        InterfaceDnsConfigCollection *snapshot = getBreakerStatus();
+        InterfaceDnsConfigCollection::iterator it;
+        bool answered[RESOLVER_MAX_SERVERS];
+        bool anyOpen = false;
+
+        for (it = snapshot->begin(); it != snapshot->end(); ++it) {
+            InterfaceDnsConfig *probed = *it;
+            bool changed = false;
+
+            for (int i = 0; i < probed->numServers; i++) {
+                answered[i] = probed->servers[i].open && probeServer(probed->servers[i].addr);
+            }
+
+            pthread_mutex_lock(&mLock);
+            InterfaceDnsConfig *cfg = findConfigLocked(probed->iface);
+            for (int i = 0; cfg && i < cfg->numServers; i++) {
+                NameserverState *ns = &cfg->servers[i];
+                if (i < probed->numServers && answered[i] &&
+                    !strcmp(ns->addr, probed->servers[i].addr)) {
+                    LOGI("Nameserver %s on %s answered a probe; back in use",
+                         ns->addr, cfg->iface);
+                    ns->open = false;
+                    ns->consecutiveTimeouts = 0;
+                    changed = true;
+                }
+                anyOpen = anyOpen || ns->open;
+            }
+            if (changed) {
+                pushServersLocked(cfg);
+            }
+            pthread_mutex_unlock(&mLock);
+            delete probed;
+        }
+        delete snapshot;
+
+        pthread_mutex_lock(&mLock);
+        if (!anyOpen) {
+            mProbing = false;
+            pthread_mutex_unlock(&mLock);
+            break;
+        }
+        pthread_mutex_unlock(&mLock);
+    }
+}
+
+/*
+ * Sends a single query for the root NS records and waits briefly for any
+ * reply with a matching id. Even an error reply proves the server is up.
+ */
+bool ResolverController::probeServer(const char *addr) {
+    struct addrinfo hints, *res = NULL;
+    unsigned char query[17];
+    unsigned char reply[512];
+    uint16_t id = (uint16_t) (random() & 0xffff);
+    bool alive = false;
+    int s;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_NUMERICHOST;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(addr, "53", &hints, &res)) {
+        LOGW("Cannot parse nameserver address '%s'", addr);
+        return false;
+    }
+
+    memset(query, 0, sizeof(query));
+    query[0] = id >> 8;
+    query[1] = id & 0xff;
+    query[2] = 0x01;    // RD
+    query[5] = 1;       // QDCOUNT
+    // QNAME is the root label (query[12] = 0)
+    query[14] = 2;      // QTYPE NS
+    query[16] = 1;      // QCLASS IN
+
+    s = socket(res->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (s < 0) {
+        LOGE("Failed to create probe socket (%s)", strerror(errno));
+        freeaddrinfo(res);
+        return false;
+    }
+
+    if (sendto(s, query, sizeof(query), 0, res->ai_addr, res->ai_addrlen) < 0) {
+        if (DBG) {
+            LOGD("Probe of %s failed (%s)", addr, strerror(errno));
+        }
+    } else {
+        struct pollfd pfd;
+        pfd.fd = s;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, PROBE_TIMEOUT_MS) > 0) {
+            int len = recv(s, reply, sizeof(reply), 0);
+            alive = (len >= 12 && reply[0] == query[0] && reply[1] == query[1] &&
+                     (reply[2] & 0x80));
+        }
+    }
+
+    close(s);
+    freeaddrinfo(res);
+    return alive;
+}
+
+void ResolverController::clearWarmupHostsLocked() {
+    HostnameCollection::iterator it;
+
+    for (it = mWarmupHosts->begin(); it != mWarmupHosts->end(); ++it) {
+        free(*it);
+    }
+    mWarmupHosts->clear();
+}
+
+/* Labels of 1-63 letters, digits, '-' or '_', dot separated, 253 chars in all */
+bool ResolverController::isValidHostname(const char *host) {
+    size_t len = strlen(host);
+    size_t label = 0;
+
+    if (len == 0 || len > 253) {
+        return false;
+    }
+    for (const char *p = host; *p; p++) {
+        if (*p == '.') {
+            if (label == 0) {
+                return false;
+            }
+            label = 0;
+        } else if (isalnum((unsigned char) *p) || *p == '-' || *p == '_') {
+            if (++label > 63) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int ResolverController::setWarmupHosts(char **hosts, int numHosts) {
+    if (numHosts > WARMUP_MAX_HOSTS) {
+        LOGE("Too many warm-up hosts (%d, max %d)", numHosts, WARMUP_MAX_HOSTS);
+        errno = E2BIG;
+        return -1;
+    }
+    for (int i = 0; i < numHosts; i++) {
+        if (!isValidHostname(hosts[i])) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&mLock);
+    clearWarmupHostsLocked();
+    for (int i = 0; i < numHosts; i++) {
+        mWarmupHosts->push_back(strdup(hosts[i]));
+    }
+    int rc = saveWarmupHostsLocked();
+    pthread_mutex_unlock(&mLock);
+    return rc;
+}
+
+HostnameCollection *ResolverController::getWarmupHosts() {
+    HostnameCollection *hosts = new HostnameCollection();
+    HostnameCollection::iterator it;
+
+    pthread_mutex_lock(&mLock);
+    for (it = mWarmupHosts->begin(); it != mWarmupHosts->end(); ++it) {
+        hosts->push_back(strdup(*it));
+    }
+    pthread_mutex_unlock(&mLock);
+    return hosts;
+}
+
+void ResolverController::loadWarmupHosts() {
+    FILE *fp = fopen(WARMUP_LIST_PATH, "r");
+    if (!fp) {
+        if (errno != ENOENT) {
+            LOGE("Failed to open %s (%s)", WARMUP_LIST_PATH, strerror(errno));
+        }
+        return;
+    }
+
+    char buffer[256];
+    while (fgets(buffer, sizeof(buffer), fp) && mWarmupHosts->size() < WARMUP_MAX_HOSTS) {
+        buffer[strcspn(buffer, "\r\n")] = '\0';
+        if (buffer[0] == '\0')
+            continue;
+        if (!isValidHostname(buffer)) {
+            LOGW("Ignoring bad warm-up host \"%s\" in %s", buffer, WARMUP_LIST_PATH);
+            continue;
+        }
+        mWarmupHosts->push_back(strdup(buffer));
+    }
+    fclose(fp);
+}
+
+int ResolverController::saveWarmupHostsLocked() {
+    char tmpPath[] = WARMUP_LIST_PATH ".tmp";
+    HostnameCollection::iterator it;
+
+    if (mkdir(WARMUP_LIST_DIR, 0700) && errno != EEXIST) {
+        LOGE("Failed to create %s (%s)", WARMUP_LIST_DIR, strerror(errno));
+        return -1;
+    }
+
+    FILE *fp = fopen(tmpPath, "w");
+    if (!fp) {
+        LOGE("Failed to open %s (%s)", tmpPath, strerror(errno));
+        return -1;
+    }
+    for (it = mWarmupHosts->begin(); it != mWarmupHosts->end(); ++it) {
+        fprintf(fp, "%s\n", *it);
+    }
+    if (fclose(fp)) {
+        LOGE("Failed to write %s (%s)", tmpPath, strerror(errno));
+        unlink(tmpPath);
+        return -1;
+    }
+
+    // Replace the old list atomically so a crash never leaves half a file
+    if (rename(tmpPath, WARMUP_LIST_PATH)) {
+        LOGE("Failed to rename %s (%s)", tmpPath, strerror(errno));
+        unlink(tmpPath);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Resolves the warm-up hosts in parallel on a small pool, through the
+ * default interface cache. A request while a round is still in flight
+ * starts another once the last lookup of this one is done, rather than
+ * piling up duplicate lookups.
+ */
+void ResolverController::warmUpLocked() {
+    if (mWarmupHosts->empty()) {
+        return;
+    }
+    if (mWarmupInFlight) {
+        mWarmupAgain = true;
+        return;
+    }
+    startWarmupLocked();
+}
+
+void ResolverController::startWarmupLocked() {
+    HostnameCollection::iterator it;
+
+    mWarmupAgain = false;
+    for (it = mWarmupHosts->begin(); it != mWarmupHosts->end(); ++it) {
+        WarmupJob *job = (WarmupJob *) malloc(sizeof(WarmupJob));
+
+        if (!job || !(job->host = strdup(*it))) {
+            free(job);
+            continue;
+        }
+        job->ctrl = this;
+        if (!mWarmupQueue->enqueue(ResolverController::warmUpHost, job)) {
+            LOGW("Skipping warm-up of %s; the queue is full", job->host);
+            free(job->host);
+            free(job);
+            continue;
+        }
+        mWarmupInFlight++;
+    }
+}
+
+void ResolverController::warmUpHost(void *arg) {
+    WarmupJob *job = reinterpret_cast<WarmupJob *>(arg);
+    ResolverController *me = job->ctrl;
+    struct addrinfo hints;
+    struct addrinfo *res = NULL;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int rv = getaddrinfo(job->host, NULL, &hints, &res);
+    if (DBG) {
+        LOGD("Warm-up of %s: %s", job->host, rv ? gai_strerror(rv) : "ok");
+    }
+    if (res) {
+        freeaddrinfo(res);
+    }
+    free(job->host);
+    free(job);
+
+    pthread_mutex_lock(&me->mLock);
+    if (!--me->mWarmupInFlight && me->mWarmupAgain) {
+        me->startWarmupLocked();
+    }
+    pthread_mutex_unlock(&me->mLock);
+}
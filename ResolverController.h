@@ -17,19 +17,111 @@
 #ifndef _RESOLVER_CONTROLLER_H_
 #define _RESOLVER_CONTROLLER_H_
 
+#include <pthread.h>
+#include <time.h>
 #include <netinet/in.h>
 #include <linux/in.h>
+#include <net/if.h>
+
+#include <utils/List.h>
+
+#include "DnsQueryLog.h"
+
+class WorkQueue;
+
+/* Most nameservers the resolver will use for one interface */
+#define RESOLVER_MAX_SERVERS 4
+
+/*
+ * Per-nameserver circuit breaker state. A server that times out
+ * BREAKER_MAX_TIMEOUTS times in a row is "open": it is withheld from the
+ * resolver until a probe query gets an answer from it again.
+ */
+struct NameserverState {
+    char         addr[INET6_ADDRSTRLEN];
+    bool         open;
+    int          consecutiveTimeouts;
+    unsigned int totalTimeouts;
+    time_t       lastTimeout;
+};
+
+struct InterfaceDnsConfig {
+    char            iface[IFNAMSIZ];
+    int             numServers;
+    NameserverState servers[RESOLVER_MAX_SERVERS];
+};
+
+typedef android::List<InterfaceDnsConfig *> InterfaceDnsConfigCollection;
+typedef android::List<char *> HostnameCollection;
 
 class ResolverController {
+    struct WarmupJob {
+        ResolverController *ctrl;
+        char               *host;
+    };
+
+    pthread_mutex_t              mLock;
+    char                         mDefaultIface[IFNAMSIZ];
+    InterfaceDnsConfigCollection *mConfigs;
+    bool                         mProbing;
+    HostnameCollection           *mWarmupHosts;
+    bool                         mWarmupPending;  // Waiting for the interface address
+    WorkQueue                    *mWarmupQueue;
+    int                          mWarmupInFlight; // Lookups queued or running
+    bool                         mWarmupAgain;    // Requested while some were in flight
+    DnsQueryLog                  *mQueryLog;
+    volatile int32_t             mPrimaryServer;
+
 public:
-    ResolverController() {};
-    virtual ~ResolverController() {};
+    ResolverController();
+    virtual ~ResolverController();
 
     int setDefaultInterface(const char* iface);
     int setInterfaceDnsServers(const char* iface, char** servers, int numservers);
     int setInterfaceAddress(const char* iface, struct in_addr* addr);
     int flushDefaultDnsCache();
     int flushInterfaceDnsCache(const char* iface);
+
+    /*
+     * Called by the DNS proxy after each lookup on the default interface.
+     * A lookup that failed after the per-server resolver timeout means the
+     * first server in use did not answer; one that was answered at all
+     * ends that server's run of timeouts.
+     */
+    void reportLookup(int latencyMs, bool answered);
+    bool isDefaultInterfaceDark();
+
+    /* Index of the nameserver the resolver tries first, without locking */
+    int getPrimaryServerIndex() { return mPrimaryServer; }
+    DnsQueryLog *getQueryLog() { return mQueryLog; }
+
+    /* Fills in a copy of every configured interface; caller frees */
+    InterfaceDnsConfigCollection *getBreakerStatus();
+
+    /*
+     * Hostnames resolved in the background whenever the default interface
+     * or its nameservers change, so the first real lookups hit the cache.
+     * Each must pass isValidHostname(); -1 with EINVAL otherwise.
+     */
+    int setWarmupHosts(char **hosts, int numHosts);
+    static bool isValidHostname(const char *host);
+    HostnameCollection *getWarmupHosts();
+
+private:
+    InterfaceDnsConfig *findConfigLocked(const char *iface);
+    void clearWarmupHostsLocked();
+    void loadWarmupHosts();
+    int saveWarmupHostsLocked();
+    void warmUpLocked();
+    void startWarmupLocked();
+    static void warmUpHost(void *arg);
+    void pushServersLocked(InterfaceDnsConfig *cfg);
+    void updatePrimaryServerLocked();
+    void startProbingLocked();
+
+    static void *probeThreadStart(void *obj);
+    void runProbes();
+    static bool probeServer(const char *addr);
 };
 
 #endif /* _RESOLVER_CONTROLLER_H_ */
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sysutils/SocketClient.h>
+
+#include "ResponseBuilder.h"
+#include "NetdCommand.h"
+
+/* Room for a typical listing without growing */
+#define INITIAL_CAPACITY 1024
+
+ResponseBuilder::ResponseBuilder() {
+    mBuf = NULL;
+    mLen = 0;
+    mCap = 0;
+    mFailed = false;
+}
+
+ResponseBuilder::~ResponseBuilder() {
+    free(mBuf);
+}
+
+int ResponseBuilder::reserve(int len) {
+    if (mLen + len <= mCap) {
+        return 0;
+    }
+
+    int cap = mCap ? mCap : INITIAL_CAPACITY;
+    while (cap < mLen + len) {
+        cap *= 2;
+    }
+    char *buf = (char *) realloc(mBuf, cap);
+    if (!buf) {
+        mFailed = true;
+        errno = ENOMEM;
+        return -1;
+    }
+    mBuf = buf;
+    mCap = cap;
+    return 0;
+}
+
+int ResponseBuilder::add(int code, const char *msg, bool addErrno) {
+    int len;
+    char *line = NetdCommand::formatMsg(code, msg, addErrno, &len);
+
+    if (!line) {
+        mFailed = true;
+        return -1;
+    }
+    // Each reply goes out with its NUL, as SocketClient::sendMsg() sends it
+    if (reserve(len + 1)) {
+        free(line);
+        return -1;
+    }
+    memcpy(mBuf + mLen, line, len + 1);
+    mLen += len + 1;
+    free(line);
+    return 0;
+}
+
+int ResponseBuilder::flush(SocketClient *c) {
+    int rc = 0;
+
+    if (mFailed) {
+        errno = ENOMEM;
+        rc = -1;
+    } else if (mLen) {
+        rc = c->sendData(mBuf, mLen);
+    }
+    mLen = 0;
+    mFailed = false;
+    return rc;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _RESPONSE_BUILDER_H
+#define _RESPONSE_BUILDER_H
+
+class SocketClient;
+
+/*
+ * Collects the lines of a multi-line reply, formatted as
+ * NetdCommand::sendMsg() would send them, and sends them all with one
+ * write. Nothing can interleave with the reply, and a long listing costs
+ * one syscall instead of one per line.
+ */
+class ResponseBuilder {
+    char *mBuf;
+    int  mLen;
+    int  mCap;
+    bool mFailed;   // An append ran out of memory
+
+public:
+    ResponseBuilder();
+    virtual ~ResponseBuilder();
+
+    int add(int code, const char *msg, bool addErrno);
+
+    /* Sends everything added so far; -1 with ENOMEM if an append failed */
+    int flush(SocketClient *c);
+
+private:
+    int reserve(int len);
+};
+
+#endif
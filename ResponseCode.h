@@ -26,6 +26,12 @@ public:
     static const int TetherInterfaceListResult = 111;
     static const int TetherDnsFwdTgtListResult = 112;
     static const int TtyListResult             = 113;
+    static const int ResolverBreakerListResult = 114;
+    static const int ResolverWarmupListResult  = 115;
+    static const int CommandStatsResult        = 116;
+    static const int InterfaceGetCfgListResult = 117;
+    static const int QuotaListResult           = 118;
+    static const int TrafficUidStatsResult     = 119;
 
 
     // 200 series - Requested action has been successfully completed
@@ -40,6 +46,10 @@ public:
     static const int InterfaceTxCounterResult  = 217;
     static const int InterfaceRxThrottleResult = 218;
     static const int InterfaceTxThrottleResult = 219;
+    static const int ResolverQueryLogResult    = 220;
+    static const int ResolverProxyStatsResult  = 221;
+    static const int InterfaceCountersResult   = 222;
+    static const int InterfaceRatesResult      = 223;
 
     // 400 series - The command was accepted but the requested action
     // did not take place.
@@ -52,5 +62,9 @@ public:
 
     // 600 series - Unsolicited broadcasts
     static const int InterfaceChange        = 600;
+    static const int InterfaceCounterUpdate = 610;
+    static const int InterfaceBytesLimit    = 611;
+    static const int InterfaceRateLimit     = 612;
+    static const int QuotaLimitReached      = 613;
 };
 #endif
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#define LOG_TAG "Netd"
+
+#include <cutils/log.h>
+
+#include "RouteNetlinkHandler.h"
+#include "EventLoop.h"
+#include "InterfaceTable.h"
+#include "AddressSorter.h"
+
+RouteNetlinkHandler::RouteNetlinkHandler(int listenerSocket) {
+    mSock = listenerSocket;
+}
+
+RouteNetlinkHandler::~RouteNetlinkHandler() {
+}
+
+int RouteNetlinkHandler::start() {
+    return EventLoop::Instance()->addFd(mSock, EPOLLIN, RouteNetlinkHandler::dataReady, this);
+}
+
+int RouteNetlinkHandler::stop() {
+    return EventLoop::Instance()->removeFd(mSock);
+}
+
+void RouteNetlinkHandler::dataReady(void *obj, int fd) {
+    reinterpret_cast<RouteNetlinkHandler *>(obj)->onDataAvailable();
+}
+
+void RouteNetlinkHandler::onDataAvailable() {
+    char buf[8192];
+    struct sockaddr_nl from;
+    socklen_t fromLen = sizeof(from);
+    int len;
+
+    len = TEMP_FAILURE_RETRY(recvfrom(mSock, buf, sizeof(buf), 0,
+                                      (struct sockaddr *) &from, &fromLen));
+    if (len < 0) {
+        if (errno == ENOBUFS) {
+            // We missed events; only a fresh dump can tell us what changed
+            LOGW("rtnetlink socket overrun; reloading interface table");
+            InterfaceTable::Instance()->load();
+            return;
+        }
+        LOGE("rtnetlink read failed (%s)", strerror(errno));
+        return;
+    }
+    if (from.nl_pid != 0) {
+        // Only the kernel gets to tell us about interfaces
+        return;
+    }
+
+    struct nlmsghdr *nh = (struct nlmsghdr *) buf;
+    for (; NLMSG_OK(nh, (unsigned) len); nh = NLMSG_NEXT(nh, len)) {
+        if (nh->nlmsg_type == RTM_NEWADDR || nh->nlmsg_type == RTM_DELADDR) {
+            AddressSorter::Instance()->invalidate();
+        }
+        InterfaceTable::Instance()->handleMessage(nh);
+    }
+}
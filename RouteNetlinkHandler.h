@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _ROUTE_NETLINK_HANDLER_H
+#define _ROUTE_NETLINK_HANDLER_H
+
+/*
+ * Listens on an rtnetlink socket subscribed to link and address groups,
+ * and keeps the InterfaceTable current from what arrives.
+ */
+class RouteNetlinkHandler {
+    int mSock;
+
+public:
+    RouteNetlinkHandler(int listenerSocket);
+    virtual ~RouteNetlinkHandler();
+
+    int start(void);
+    int stop(void);
+
+private:
+    static void dataReady(void *obj, int fd);
+    void onDataAvailable();
+};
+#endif
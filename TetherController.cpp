@@ -31,12 +31,15 @@
 
 
 #include "TetherController.h"
+#include "EventLoop.h"
 
 TetherController::TetherController() {
     mInterfaces = new InterfaceCollection();
     mDnsForwarders = new NetAddressCollection();
+    pthread_mutex_init(&mDaemonLock, NULL);
     mDaemonFd = -1;
     mDaemonPid = 0;
+    mIpFwdState = -1;
 }
 
 TetherController::~TetherController() {
@@ -48,6 +51,7 @@ TetherController::~TetherController() {
     mInterfaces->clear();
 
     mDnsForwarders->clear();
+    pthread_mutex_destroy(&mDaemonLock);
 }
 
 int TetherController::setIpFwdEnabled(bool enable) {
@@ -62,13 +66,19 @@ int TetherController::setIpFwdEnabled(bool enable) {
     if (write(fd, (enable ? "1" : "0"), 1) != 1) {
         LOGE("Failed to write ip_forward (%s)", strerror(errno));
         close(fd);
+        mIpFwdState = -1;
         return -1;
     }
     close(fd);
+    mIpFwdState = (enable ? 1 : 0);
     return 0;
 }
 
 bool TetherController::getIpFwdEnabled() {
+    if (mIpFwdState != -1) {
+        return (mIpFwdState == 1);
+    }
+
     int fd = open("/proc/sys/net/ipv4/ip_forward", O_RDONLY);
 
     if (fd < 0) {
@@ -80,15 +90,16 @@ bool TetherController::getIpFwdEnabled() {
     if (read(fd, &enabled, 1) != 1) {
         LOGE("Failed to read ip_forward (%s)", strerror(errno));
         close(fd);
-        return -1;
+        return false;
     }
 
     close(fd);
-    return (enabled  == '1' ? true : false);
+    mIpFwdState = (enabled == '1' ? 1 : 0);
+    return (mIpFwdState == 1);
 }
 
 int TetherController::startTethering(int num_addrs, struct in_addr* addrs) {
-    if (mDaemonPid != 0) {
+    if (isTetheringStarted()) {
         LOGE("Tethering already started");
         errno = EBUSY;
         return -1;
@@ -105,8 +116,8 @@ int TetherController::startTethering(int num_addrs, struct in_addr* addrs) {
     }
 
     /*
-     * TODO: Create a monitoring thread to handle and restart
-     * the daemon if it exits prematurely
+     * TODO: Restart the daemon if it exits prematurely; for now the
+     * event loop only reports it
      */
     if ((pid = fork()) < 0) {
         LOGE("fork failed (%s)", strerror(errno));
@@ -148,8 +159,11 @@ int TetherController::startTethering(int num_addrs, struct in_addr* addrs) {
         return 0;
     } else {
         close(pipefd[0]);
+        pthread_mutex_lock(&mDaemonLock);
         mDaemonPid = pid;
         mDaemonFd = pipefd[1];
+        pthread_mutex_unlock(&mDaemonLock);
+        EventLoop::Instance()->watchChild(pid, TetherController::daemonExited, this);
         LOGD("Tethering services running");
     }
 
@@ -158,24 +172,52 @@ int TetherController::startTethering(int num_addrs, struct in_addr* addrs) {
 
 int TetherController::stopTethering() {
 
+    pthread_mutex_lock(&mDaemonLock);
     if (mDaemonPid == 0) {
+        pthread_mutex_unlock(&mDaemonLock);
         LOGE("Tethering already stopped");
         return 0;
     }
 
     LOGD("Stopping tethering services");
 
-    kill(mDaemonPid, SIGTERM);
-    waitpid(mDaemonPid, NULL, 0);
+    // Once reaped, the pid may already belong to someone else
+    if (!EventLoop::Instance()->unwatchChild(mDaemonPid)) {
+        kill(mDaemonPid, SIGTERM);
+        waitpid(mDaemonPid, NULL, 0);
+    }
     mDaemonPid = 0;
     close(mDaemonFd);
     mDaemonFd = -1;
+    pthread_mutex_unlock(&mDaemonLock);
     LOGD("Tethering services stopped");
     return 0;
 }
 
+void TetherController::daemonExited(void *obj, pid_t pid, int status) {
+    TetherController *me = reinterpret_cast<TetherController *>(obj);
+
+    if (WIFSIGNALED(status)) {
+        LOGE("dnsmasq (pid %d) killed by signal %d", pid, WTERMSIG(status));
+    } else {
+        LOGE("dnsmasq (pid %d) exited with status %d", pid, WEXITSTATUS(status));
+    }
+
+    // Unless stopTethering() got here first, or a new daemon has started
+    pthread_mutex_lock(&me->mDaemonLock);
+    if (me->mDaemonPid == pid) {
+        me->mDaemonPid = 0;
+        close(me->mDaemonFd);
+        me->mDaemonFd = -1;
+    }
+    pthread_mutex_unlock(&me->mDaemonLock);
+}
+
 bool TetherController::isTetheringStarted() {
-    return (mDaemonPid == 0 ? false : true);
+    pthread_mutex_lock(&mDaemonLock);
+    bool started = (mDaemonPid != 0);
+    pthread_mutex_unlock(&mDaemonLock);
+    return started;
 }
 
 #define MAX_CMD_SIZE 1024
@@ -210,14 +252,17 @@ int TetherController::setDnsForwarders(char **servers, int numServers) {
         mDnsForwarders->push_back(a);
     }
 
+    pthread_mutex_lock(&mDaemonLock);
     if (mDaemonFd != -1) {
         LOGD("Sending update msg to dnsmasq [%s]", daemonCmd);
         if (write(mDaemonFd, daemonCmd, strlen(daemonCmd) +1) < 0) {
             LOGE("Failed to send update command to dnsmasq (%s)", strerror(errno));
+            pthread_mutex_unlock(&mDaemonLock);
             mDnsForwarders->clear();
             return -1;
         }
     }
+    pthread_mutex_unlock(&mDaemonLock);
     return 0;
 }
 
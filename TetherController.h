@@ -17,6 +17,7 @@
 #ifndef _TETHER_CONTROLLER_H
 #define _TETHER_CONTROLLER_H
 
+#include <pthread.h>
 #include <linux/in.h>
 
 #include <utils/List.h>
@@ -27,8 +28,10 @@ typedef android::List<struct in_addr> NetAddressCollection;
 class TetherController {
     InterfaceCollection  *mInterfaces;
     NetAddressCollection *mDnsForwarders;
+    pthread_mutex_t       mDaemonLock;    // Guards the two below against the event loop
     pid_t                 mDaemonPid;
     int                   mDaemonFd;
+    int                   mIpFwdState;    // Last ip_forward value, -1 until known
 
 public:
     TetherController();
@@ -48,6 +51,9 @@ public:
     int tetherInterface(const char *interface);
     int untetherInterface(const char *interface);
     InterfaceCollection *getTetheredInterfaceList();
+
+private:
+    static void daemonExited(void *obj, pid_t pid, int status);
 };
 
 #endif
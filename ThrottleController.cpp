@@ -15,6 +15,8 @@
  */
 
 #include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
 #include <errno.h>
 #include <fcntl.h>
 
@@ -32,42 +34,31 @@
 
 
 #include "ThrottleController.h"
+#include "ExecArgs.h"
 
 static char TC_PATH[] = "/system/bin/tc";
 
-extern "C" int logwrap(int argc, const char **argv, int background);
+pthread_mutex_t ThrottleController::sLock = PTHREAD_MUTEX_INITIALIZER;
+ThrottleController::ThrottleEntry ThrottleController::sEntries[MAX_THROTTLED];
+int ThrottleController::sNumEntries = 0;
+
 extern "C" int ifc_init(void);
 extern "C" int ifc_up(const char *name);
 extern "C" int ifc_down(const char *name);
 
-int ThrottleController::runTcCmd(const char *cmd) {
-    char buffer[255];
-
-    strncpy(buffer, cmd, sizeof(buffer)-1);
-
-    const char *args[32];
-    char *next = buffer;
-    char *tmp;
+int ThrottleController::runTcCmd(const char *arg, ...) {
+    ExecArgs args(TC_PATH);
+    va_list ap;
 
-    args[0] = TC_PATH;
-    int i = 1;
-
-    while ((tmp = strsep(&next, " "))) {
-        args[i++] = tmp;
-        if (i == 32) {
-            LOGE("tc argument overflow");
-            errno = E2BIG;
-            return -1;
-        }
-    }
-    args[i] = NULL;
-
-    return logwrap(i, args, 0);
+    va_start(ap, arg);
+    args.addv(arg, ap);
+    va_end(ap);
+    return args.run();
 }
 
 int ThrottleController::setInterfaceThrottle(const char *iface, int rxKbps, int txKbps) {
-    char cmd[512];
     char ifn[65];
+    char rate[16];
     int rc;
 
     memset(ifn, 0, sizeof(ifn));
@@ -87,8 +78,8 @@ int ThrottleController::setInterfaceThrottle(const char *iface, int rxKbps, int
     /*
      * Add root qdisc for the interface
      */
-    sprintf(cmd, "qdisc add dev %s root handle 1: htb default 1 r2q 1000", ifn);
-    if (runTcCmd(cmd)) {
+    if (runTcCmd("qdisc", "add", "dev", ifn, "root", "handle", "1:", "htb", "default", "1",
+                 "r2q", "1000", NULL)) {
         LOGE("Failed to add root qdisc (%s)", strerror(errno));
         goto fail;
     }
@@ -96,8 +87,9 @@ int ThrottleController::setInterfaceThrottle(const char *iface, int rxKbps, int
     /*
      * Add our egress throttling class
      */
-    sprintf(cmd, "class add dev %s parent 1: classid 1:1 htb rate %dkbit", ifn, txKbps);
-    if (runTcCmd(cmd)) {
+    snprintf(rate, sizeof(rate), "%dkbit", txKbps);
+    if (runTcCmd("class", "add", "dev", ifn, "parent", "1:", "classid", "1:1", "htb",
+                 "rate", rate, NULL)) {
         LOGE("Failed to add egress throttling class (%s)", strerror(errno));
         goto fail;
     }
@@ -114,8 +106,8 @@ int ThrottleController::setInterfaceThrottle(const char *iface, int rxKbps, int
     /*
      * Add root qdisc for IFD
      */
-    sprintf(cmd, "qdisc add dev ifb0 root handle 1: htb default 1 r2q 1000");
-    if (runTcCmd(cmd)) {
+    if (runTcCmd("qdisc", "add", "dev", "ifb0", "root", "handle", "1:", "htb", "default", "1",
+                 "r2q", "1000", NULL)) {
         LOGE("Failed to add root ifb qdisc (%s)", strerror(errno));
         goto fail;
     }
@@ -123,8 +115,9 @@ int ThrottleController::setInterfaceThrottle(const char *iface, int rxKbps, int
     /*
      * Add our ingress throttling class
      */
-    sprintf(cmd, "class add dev ifb0 parent 1: classid 1:1 htb rate %dkbit", rxKbps);
-    if (runTcCmd(cmd)) {
+    snprintf(rate, sizeof(rate), "%dkbit", rxKbps);
+    if (runTcCmd("class", "add", "dev", "ifb0", "parent", "1:", "classid", "1:1", "htb",
+                 "rate", rate, NULL)) {
         LOGE("Failed to add ingress throttling class (%s)", strerror(errno));
         goto fail;
     }
@@ -132,8 +125,7 @@ int ThrottleController::setInterfaceThrottle(const char *iface, int rxKbps, int
     /*
      * Add ingress qdisc for pkt redirection
      */
-    sprintf(cmd, "qdisc add dev %s ingress", ifn);
-    if (runTcCmd(cmd)) {
+    if (runTcCmd("qdisc", "add", "dev", ifn, "ingress", NULL)) {
         LOGE("Failed to add ingress qdisc (%s)", strerror(errno));
         goto fail;
     }
@@ -141,13 +133,14 @@ int ThrottleController::setInterfaceThrottle(const char *iface, int rxKbps, int
     /*
      * Add filter to link <ifn> -> ifb0
      */
-    sprintf(cmd, "filter add dev %s parent ffff: protocol ip prio 10 u32 match "
-            "u32 0 0 flowid 1:1 action mirred egress redirect dev ifb0", ifn);
-    if (runTcCmd(cmd)) {
+    if (runTcCmd("filter", "add", "dev", ifn, "parent", "ffff:", "protocol", "ip", "prio", "10",
+                 "u32", "match", "u32", "0", "0", "flowid", "1:1", "action", "mirred",
+                 "egress", "redirect", "dev", "ifb0", NULL)) {
         LOGE("Failed to add ifb filter (%s)", strerror(errno));
         goto fail;
     }
 
+    remember(ifn, rxKbps, txKbps);
     return 0;
 fail:
     reset(ifn);
@@ -155,22 +148,64 @@ fail:
 }
 
 void ThrottleController::reset(const char *iface) {
-    char cmd[128];
-
-    sprintf(cmd, "qdisc del dev %s root", iface);
-    runTcCmd(cmd);
-    sprintf(cmd, "qdisc del dev %s ingress", iface);
-    runTcCmd(cmd);
-
-    runTcCmd("qdisc del dev ifb0 root");
+    runTcCmd("qdisc", "del", "dev", iface, "root", NULL);
+    runTcCmd("qdisc", "del", "dev", iface, "ingress", NULL);
+    runTcCmd("qdisc", "del", "dev", "ifb0", "root", NULL);
+    forget(iface);
 }
 
 int ThrottleController::getInterfaceRxThrottle(const char *iface, int *rx) {
-    *rx = 0;
+    pthread_mutex_lock(&sLock);
+    ThrottleEntry *e = find(iface);
+    *rx = (e ? e->rxKbps : 0);
+    pthread_mutex_unlock(&sLock);
     return 0;
 }
 
 int ThrottleController::getInterfaceTxThrottle(const char *iface, int *tx) {
-    *tx = 0;
+    pthread_mutex_lock(&sLock);
+    ThrottleEntry *e = find(iface);
+    *tx = (e ? e->txKbps : 0);
+    pthread_mutex_unlock(&sLock);
     return 0;
 }
+
+void ThrottleController::interfaceRemoved(const char *iface) {
+    forget(iface);
+}
+
+void ThrottleController::remember(const char *iface, int rxKbps, int txKbps) {
+    pthread_mutex_lock(&sLock);
+    ThrottleEntry *e = find(iface);
+    if (!e) {
+        if (sNumEntries == MAX_THROTTLED) {
+            LOGW("Too many throttled interfaces; not remembering %s", iface);
+            pthread_mutex_unlock(&sLock);
+            return;
+        }
+        e = &sEntries[sNumEntries++];
+        strlcpy(e->iface, iface, sizeof(e->iface));
+    }
+    e->rxKbps = rxKbps;
+    e->txKbps = txKbps;
+    pthread_mutex_unlock(&sLock);
+}
+
+void ThrottleController::forget(const char *iface) {
+    pthread_mutex_lock(&sLock);
+    ThrottleEntry *e = find(iface);
+    if (e) {
+        *e = sEntries[--sNumEntries];
+    }
+    pthread_mutex_unlock(&sLock);
+}
+
+/* Called with sLock held */
+ThrottleController::ThrottleEntry *ThrottleController::find(const char *iface) {
+    for (int i = 0; i < sNumEntries; i++) {
+        if (!strcmp(sEntries[i].iface, iface)) {
+            return &sEntries[i];
+        }
+    }
+    return NULL;
+}
@@ -17,15 +17,41 @@
 #ifndef _THROTTLE_CONTROLLER_H
 #define _THROTTLE_CONTROLLER_H
 
+#include <pthread.h>
+#include <net/if.h>
+
+/*
+ * The rates last applied to each throttled interface are kept here, so
+ * the getters never have to ask tc. An interface going away takes its
+ * qdiscs with it; interfaceRemoved() forgets its rates to match.
+ */
 class ThrottleController {
 public:
+    /* Most interfaces throttled at once */
+    static const int MAX_THROTTLED = 8;
+
     static int setInterfaceThrottle(const char *iface, int rxKbps, int txKbps);
     static int getInterfaceRxThrottle(const char *iface, int *rx);
     static int getInterfaceTxThrottle(const char *iface, int *tx);
 
+    static void interfaceRemoved(const char *iface);
+
 private:
-    static int runTcCmd(const char *cmd);
+    struct ThrottleEntry {
+        char iface[IFNAMSIZ];
+        int  rxKbps;
+        int  txKbps;
+    };
+
+    static pthread_mutex_t sLock;
+    static ThrottleEntry   sEntries[MAX_THROTTLED];
+    static int             sNumEntries;
+
+    static int runTcCmd(const char *arg, ...) __attribute__((sentinel));
     static void reset(const char *iface);
+    static void remember(const char *iface, int rxKbps, int txKbps);
+    static void forget(const char *iface);
+    static ThrottleEntry *find(const char *iface);
 };
 
 #endif
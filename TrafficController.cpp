@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#define LOG_TAG "TrafficController"
+#include <cutils/log.h>
+
+#include "TrafficController.h"
+#include "ExecArgs.h"
+
+static const char QTAGUID_STATS_PATH[] = "/proc/net/xt_qtaguid/stats";
+
+/*
+ * Ours alone, and in the mangle table, whose INPUT and OUTPUT chains
+ * NatController never flushes the way it does the filter table's.
+ */
+#define TRAFFIC_CHAIN "netd_traffic"
+
+/* Room for this many (interface, uid) pairs before growing */
+#define INITIAL_UID_STATS 64
+
+TrafficController::TrafficController() {
+    mEnabled = false;
+}
+
+TrafficController::~TrafficController() {
+}
+
+int TrafficController::enable() {
+    if (mEnabled) {
+        return 0;
+    }
+
+    // Left behind by an earlier netd, the chain is reused
+    ExecArgs::runIptables("-t", "mangle", "-N", TRAFFIC_CHAIN, NULL);
+    if (ExecArgs::runIptables("-t", "mangle", "-F", TRAFFIC_CHAIN, NULL)) {
+        return -1;
+    }
+
+    // xt_qtaguid provides the owner match; this rule exists to run it
+    if (ExecArgs::runIptables("-t", "mangle", "-A", TRAFFIC_CHAIN, "-m", "owner",
+                              "--socket-exists", NULL)) {
+        goto fail;
+    }
+    if (ExecArgs::runIptables("-t", "mangle", "-I", "INPUT", "-j", TRAFFIC_CHAIN, NULL)) {
+        goto fail;
+    }
+    if (ExecArgs::runIptables("-t", "mangle", "-I", "OUTPUT", "-j", TRAFFIC_CHAIN, NULL)) {
+        ExecArgs::runIptables("-t", "mangle", "-D", "INPUT", "-j", TRAFFIC_CHAIN, NULL);
+        goto fail;
+    }
+    mEnabled = true;
+    return 0;
+
+fail:
+    ExecArgs::runIptables("-t", "mangle", "-F", TRAFFIC_CHAIN, NULL);
+    ExecArgs::runIptables("-t", "mangle", "-X", TRAFFIC_CHAIN, NULL);
+    return -1;
+}
+
+int TrafficController::disable() {
+    if (!mEnabled) {
+        return 0;
+    }
+    int rc = 0;
+    if (ExecArgs::runIptables("-t", "mangle", "-D", "INPUT", "-j", TRAFFIC_CHAIN, NULL)) {
+        rc = -1;
+    }
+    if (ExecArgs::runIptables("-t", "mangle", "-D", "OUTPUT", "-j", TRAFFIC_CHAIN, NULL)) {
+        rc = -1;
+    }
+    ExecArgs::runIptables("-t", "mangle", "-F", TRAFFIC_CHAIN, NULL);
+    if (ExecArgs::runIptables("-t", "mangle", "-X", TRAFFIC_CHAIN, NULL)) {
+        rc = -1;
+    }
+    mEnabled = false;
+    return rc;
+}
+
+int TrafficController::getUidStats(const char *iface, UidStats **stats) {
+    FILE *fp = fopen(QTAGUID_STATS_PATH, "r");
+    int count = 0, cap = INITIAL_UID_STATS;
+    char buffer[512];
+
+    if (!fp) {
+        LOGE("Failed to open %s (%s)", QTAGUID_STATS_PATH, strerror(errno));
+        return -1;
+    }
+    if (!(*stats = (UidStats *) malloc(cap * sizeof(UidStats)))) {
+        fclose(fp);
+        return -1;
+    }
+
+    fgets(buffer, sizeof(buffer), fp); // Header
+    while (fgets(buffer, sizeof(buffer), fp)) {
+        char name[IFNAMSIZ];
+        unsigned long long tag, rxBytes, rxPackets, txBytes, txPackets;
+        unsigned int uid, set;
+
+        // idx iface acct_tag_hex uid_tag_int cnt_set rx_bytes rx_packets tx_bytes tx_packets ...
+        if (sscanf(buffer, "%*d %15s %llx %u %u %llu %llu %llu %llu", name, &tag, &uid,
+                   &set, &rxBytes, &rxPackets, &txBytes, &txPackets) != 8) {
+            continue;
+        }
+        // Tagged lines break a uid's traffic down further; its untagged line has it all
+        if ((tag >> 32) || (iface && strcmp(name, iface))) {
+            continue;
+        }
+
+        // The counter sets of one uid come one after the other
+        UidStats *s = NULL;
+        for (int i = count - 1; i >= 0; i--) {
+            if ((*stats)[i].uid == uid && !strcmp((*stats)[i].iface, name)) {
+                s = &(*stats)[i];
+                break;
+            }
+        }
+        if (!s) {
+            if (count == cap) {
+                UidStats *grown = (UidStats *) realloc(*stats, cap * 2 * sizeof(UidStats));
+                if (!grown) {
+                    free(*stats);
+                    fclose(fp);
+                    return -1;
+                }
+                *stats = grown;
+                cap *= 2;
+            }
+            s = &(*stats)[count++];
+            memset(s, 0, sizeof(*s));
+            strlcpy(s->iface, name, sizeof(s->iface));
+            s->uid = uid;
+        }
+        s->rxBytes += rxBytes;
+        s->rxPackets += rxPackets;
+        s->txBytes += txBytes;
+        s->txPackets += txPackets;
+    }
+    fclose(fp);
+    return count;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _TRAFFIC_CONTROLLER_H
+#define _TRAFFIC_CONTROLLER_H
+
+#include <stdint.h>
+#include <net/if.h>
+
+struct UidStats {
+    char     iface[IFNAMSIZ];
+    uint32_t uid;
+    uint64_t rxBytes;
+    uint64_t rxPackets;
+    uint64_t txBytes;
+    uint64_t txPackets;
+};
+
+/*
+ * Per-uid traffic accounting by the kernel's xt_qtaguid module, which
+ * counts every socket's traffic against its owner once an owner match
+ * sees its packets. enable() installs those tracking rules, in a chain
+ * of netd's own; the counts are then read in a single pass over the
+ * module's stats file.
+ */
+class TrafficController {
+    bool mEnabled;
+
+public:
+    TrafficController();
+    virtual ~TrafficController();
+
+    int enable();
+    int disable();
+    bool isEnabled() { return mEnabled; }
+
+    /*
+     * Fills *stats with one entry per (interface, uid), summed over
+     * counter sets and leaving out per-tag detail. If iface is non-NULL
+     * only that interface is reported. Returns the count; caller frees.
+     */
+    int getUidStats(const char *iface, UidStats **stats);
+};
+
+#endif
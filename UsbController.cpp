@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 
 #include <netinet/in.h>
@@ -27,6 +28,9 @@
 
 #include "UsbController.h"
 
+pthread_mutex_t UsbController::sStateLock = PTHREAD_MUTEX_INITIALIZER;
+int UsbController::sRndisState = -1;
+unsigned int UsbController::sGeneration = 0;
 
 UsbController::UsbController() {
 }
@@ -44,8 +48,28 @@ int UsbController::stopRNDIS() {
     return enableRNDIS(false);
 }
 
+/*
+ * Caches what was read or written at generation gen. The sysfs access is
+ * done without the lock, so if invalidate() ran meanwhile the value may
+ * predate the change it reported and is dropped.
+ */
+void UsbController::setState(int state, unsigned int gen) {
+    pthread_mutex_lock(&sStateLock);
+    if (gen == sGeneration) {
+        sRndisState = state;
+    }
+    pthread_mutex_unlock(&sStateLock);
+}
+
 int UsbController::enableRNDIS(bool enable) {
     char value[20];
+    unsigned int gen;
+
+    pthread_mutex_lock(&sStateLock);
+    gen = ++sGeneration;
+    sRndisState = -1;
+    pthread_mutex_unlock(&sStateLock);
+
 #ifdef USE_HTC_USB_FUNCTION_SWITCH
     int fd = open("/sys/devices/platform/msm_hsusb/usb_function_switch", O_RDWR);
     int count = snprintf(value, sizeof(value), "%d\n", (enable ? 4 : 3));
@@ -53,23 +77,48 @@ int UsbController::enableRNDIS(bool enable) {
     int fd = open("/sys/class/usb_composite/rndis/enable", O_RDWR);
     int count = snprintf(value, sizeof(value), "%d\n", (enable ? 1 : 0));
 #endif
-    write(fd, value, count);
+    if (write(fd, value, count) == count) {
+        setState(enable ? 1 : 0, gen);
+    }
     close(fd);
     return 0;
 }
 
 bool UsbController::isRNDISStarted() {
+    int state;
+    unsigned int gen;
+
+    pthread_mutex_lock(&sStateLock);
+    state = sRndisState;
+    gen = sGeneration;
+    pthread_mutex_unlock(&sStateLock);
+    if (state != -1) {
+        return (state == 1);
+    }
+
     char value=0;
 #ifdef USE_HTC_USB_FUNCTION_SWITCH
     int fd = open("/sys/devices/platform/msm_hsusb/usb_function_switch", O_RDWR);
 #else
     int fd = open("/sys/class/usb_composite/rndis/enable", O_RDWR);
 #endif
-    read(fd, &value, 1);
+    if (read(fd, &value, 1) != 1) {
+        close(fd);
+        return false;
+    }
     close(fd);
 #ifdef USE_HTC_USB_FUNCTION_SWITCH
-    return (value == '4' ? true : false);
+    state = (value == '4' ? 1 : 0);
 #else
-    return (value == '1' ? true : false);
+    state = (value == '1' ? 1 : 0);
 #endif
+    setState(state, gen);
+    return (state == 1);
+}
+
+void UsbController::invalidate() {
+    pthread_mutex_lock(&sStateLock);
+    sGeneration++;
+    sRndisState = -1;
+    pthread_mutex_unlock(&sStateLock);
 }
@@ -17,10 +17,21 @@
 #ifndef _USB_CONTROLLER_H
 #define _USB_CONTROLLER_H
 
+#include <pthread.h>
 #include <linux/in.h>
 
 
+/*
+ * The RNDIS state is remembered once read or written, so polling it costs
+ * nothing; invalidate() drops it when a usb_composite uevent says the
+ * gadget may have changed underneath us. It is read and set from the
+ * worker threads and dropped from the event loop, so all three go through
+ * sStateLock.
+ */
 class UsbController {
+    static pthread_mutex_t sStateLock;
+    static int sRndisState;         // 1 started, 0 stopped, -1 until known
+    static unsigned int sGeneration; // Bumped by every invalidate() and write
 
 public:
     UsbController();
@@ -30,8 +41,11 @@ public:
     int stopRNDIS();
     bool isRNDISStarted();
 
+    static void invalidate();
+
 private:
     int enableRNDIS(bool enable);
+    static void setState(int state, unsigned int gen);
 };
 
 #endif
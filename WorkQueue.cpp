@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define LOG_TAG "WorkQueue"
+#include <cutils/log.h>
+
+#include "WorkQueue.h"
+
+static uint64_t nowUs() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+WorkQueue::WorkQueue(const char *name, int numThreads, int maxQueued) {
+    init(name, numThreads, maxQueued, maxQueued);
+}
+
+WorkQueue::WorkQueue(const char *name, int numThreads, int maxQueued, int maxPerKey) {
+    init(name, numThreads, maxQueued, maxPerKey);
+}
+
+void WorkQueue::init(const char *name, int numThreads, int maxQueued, int maxPerKey) {
+    mName = name;
+    mNumThreads = numThreads;
+    mMaxQueued = maxQueued;
+    mMaxPerKey = maxPerKey;
+
+    // A key holds a queued or a running item, so there are never more keys
+    mNumKeys = maxQueued + numThreads;
+    mItems = new WorkItem[maxQueued];
+    mKeys = new WorkKey[mNumKeys];
+    mFreeItems = NULL;
+    mFreeKeys = NULL;
+    for (int i = maxQueued - 1; i >= 0; i--) {
+        mItems[i].next = mFreeItems;
+        mFreeItems = &mItems[i];
+    }
+    for (int i = mNumKeys - 1; i >= 0; i--) {
+        mKeys[i].inUse = false;
+        mKeys[i].next = mFreeKeys;
+        mFreeKeys = &mKeys[i];
+    }
+    memset(mRings, 0, sizeof(mRings));
+    memset(&mStats, 0, sizeof(mStats));
+    pthread_mutex_init(&mLock, NULL);
+    pthread_cond_init(&mCond, NULL);
+}
+
+WorkQueue::~WorkQueue() {
+    delete[] mItems;
+    delete[] mKeys;
+    pthread_cond_destroy(&mCond);
+    pthread_mutex_destroy(&mLock);
+}
+
+int WorkQueue::start() {
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (int i = 0; i < mNumThreads; i++) {
+        pthread_t thread;
+
+        if (pthread_create(&thread, &attr, WorkQueue::threadStart, this)) {
+            LOGE("Failed to start %s worker %d (%s)", mName, i, strerror(errno));
+            pthread_attr_destroy(&attr);
+            return -1;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    return 0;
+}
+
+bool WorkQueue::enqueue(WorkFunc func, void *arg) {
+    pthread_mutex_lock(&mLock);
+    bool queued = enqueueLocked(func, arg, NULL, false, false);
+    pthread_mutex_unlock(&mLock);
+    return queued;
+}
+
+bool WorkQueue::enqueue(WorkFunc func, void *arg, const void *key, bool priority) {
+    pthread_mutex_lock(&mLock);
+    bool queued = enqueueLocked(func, arg, key, priority, true);
+    pthread_mutex_unlock(&mLock);
+    return queued;
+}
+
+bool WorkQueue::enqueueLocked(WorkFunc func, void *arg, const void *key, bool priority,
+                              bool serial) {
+    WorkKey *k = findKeyLocked(key);
+    if (mStats.queued == mMaxQueued || (k && k->numQueued == mMaxPerKey)) {
+        mStats.rejected++;
+        return false;
+    }
+
+    // Priority belongs to the key, so its items stay in one line either way
+    if (k && k->priority != priority) {
+        bool queued = inRingLocked(k);
+        if (queued) {
+            removeFromRingLocked(k);
+        }
+        k->priority = priority;
+        if (queued) {
+            addToRingLocked(k);
+        }
+    }
+
+    if (!k) {
+        k = mFreeKeys;
+        mFreeKeys = k->next;
+        k->key = key;
+        k->priority = priority;
+        k->serial = serial;
+        k->inUse = true;
+        k->numQueued = 0;
+        k->numRunning = 0;
+        k->head = k->tail = NULL;
+        k->next = NULL;
+    }
+
+    WorkItem *item = mFreeItems;
+    mFreeItems = item->next;
+    item->func = func;
+    item->arg = arg;
+    item->enqueuedUs = nowUs();
+    item->next = NULL;
+    if (k->tail) {
+        k->tail->next = item;
+    } else {
+        k->head = item;
+    }
+    k->tail = item;
+    if (k->numQueued++ == 0 && !(k->serial && k->numRunning)) {
+        addToRingLocked(k);
+    }
+
+    mStats.queued++;
+    if (mStats.queued > mStats.peakQueued) {
+        mStats.peakQueued = mStats.queued;
+    }
+    if (priority) {
+        mStats.prioritized++;
+    }
+    pthread_cond_signal(&mCond);
+    return true;
+}
+
+WorkQueue::WorkKey *WorkQueue::findKeyLocked(const void *key) {
+    for (int i = 0; i < mNumKeys; i++) {
+        WorkKey *k = &mKeys[i];
+
+        if (k->inUse && k->key == key) {
+            return k;
+        }
+    }
+    return NULL;
+}
+
+/* Whether k is waiting in its ring, per the rules in dequeueLocked() */
+bool WorkQueue::inRingLocked(WorkKey *k) {
+    return k->numQueued && !(k->serial && k->numRunning);
+}
+
+void WorkQueue::removeFromRingLocked(WorkKey *k) {
+    WorkRing *ring = &mRings[k->priority ? 0 : 1];
+    WorkKey *prev = NULL;
+
+    for (WorkKey *cur = ring->head; cur; prev = cur, cur = cur->next) {
+        if (cur == k) {
+            if (prev) {
+                prev->next = k->next;
+            } else {
+                ring->head = k->next;
+            }
+            if (ring->tail == k) {
+                ring->tail = prev;
+            }
+            k->next = NULL;
+            return;
+        }
+    }
+}
+
+void WorkQueue::addToRingLocked(WorkKey *k) {
+    WorkRing *ring = &mRings[k->priority ? 0 : 1];
+
+    k->next = NULL;
+    if (ring->tail) {
+        ring->tail->next = k;
+    } else {
+        ring->head = k;
+    }
+    ring->tail = k;
+}
+
+/*
+ * Takes the first item of the key at the head of the first non-empty
+ * ring. A serial key leaves its ring until the item is done; any other
+ * goes to the back of its ring if it has more to run.
+ */
+WorkQueue::WorkKey *WorkQueue::dequeueLocked(WorkItem *item) {
+    WorkRing *ring = mRings[0].head ? &mRings[0] : &mRings[1];
+    WorkKey *k = ring->head;
+
+    if (!k) {
+        return NULL;
+    }
+
+    WorkItem *first = k->head;
+    *item = *first;
+    k->head = first->next;
+    if (!k->head) {
+        k->tail = NULL;
+    }
+    k->numQueued--;
+    k->numRunning++;
+    first->next = mFreeItems;
+    mFreeItems = first;
+
+    ring->head = k->next;
+    if (!ring->head) {
+        ring->tail = NULL;
+    }
+    if (k->numQueued && !k->serial) {
+        addToRingLocked(k);
+    }
+    return k;
+}
+
+/* Called when an item taken from k has run */
+void WorkQueue::finishLocked(WorkKey *k) {
+    k->numRunning--;
+    if (k->serial && k->numQueued) {
+        addToRingLocked(k);
+        pthread_cond_signal(&mCond);
+    } else if (!k->numQueued && !k->numRunning) {
+        k->inUse = false;
+        k->next = mFreeKeys;
+        mFreeKeys = k;
+    }
+}
+
+void WorkQueue::getStats(WorkQueueStats *stats) {
+    pthread_mutex_lock(&mLock);
+    *stats = mStats;
+    pthread_mutex_unlock(&mLock);
+}
+
+void *WorkQueue::threadStart(void *obj) {
+    WorkQueue *me = reinterpret_cast<WorkQueue *>(obj);
+
+    me->run();
+    pthread_exit(NULL);
+    return NULL;
+}
+
+void WorkQueue::run() {
+    pthread_mutex_lock(&mLock);
+    while (1) {
+        WorkItem item;
+        WorkKey *k;
+
+        while (!(k = dequeueLocked(&item))) {
+            pthread_cond_wait(&mCond, &mLock);
+        }
+        mStats.queued--;
+        mStats.active++;
+
+        uint32_t waitUs = (uint32_t) (nowUs() - item.enqueuedUs);
+        mStats.totalWaitUs += waitUs;
+        if (waitUs > mStats.maxWaitUs) {
+            mStats.maxWaitUs = waitUs;
+        }
+        pthread_mutex_unlock(&mLock);
+
+        item.func(item.arg);
+
+        pthread_mutex_lock(&mLock);
+        finishLocked(k);
+        mStats.active--;
+        mStats.completed++;
+    }
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _WORK_QUEUE_H
+#define _WORK_QUEUE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+struct WorkQueueStats {
+    int          queued;        // Waiting for a thread right now
+    int          active;        // Being run right now
+    int          peakQueued;
+    unsigned int completed;
+    unsigned int rejected;      // Turned away because a queue was full
+    unsigned int prioritized;   // Accepted as priority work
+    uint64_t     totalWaitUs;   // Summed over completed items
+    uint32_t     maxWaitUs;
+};
+
+/*
+ * A fixed pool of threads fed from bounded queues. Work is queued under a
+ * key (a client connection), and the threads take one item from each key
+ * in turn, so a key with a long backlog only delays the others by one
+ * item. A key's items run one at a time and in order, so a client's
+ * pipelined commands can't overtake each other and one client never
+ * holds more than one thread. Keys queued as priority are all served
+ * before any other; the priority given with a key's latest item applies
+ * to all it has waiting. enqueue() never blocks: once maxQueued items are
+ * waiting, or maxPerKey for the one key, new work is refused so the caller
+ * can fail it fast instead of letting latency grow without limit.
+ */
+class WorkQueue {
+public:
+    typedef void (*WorkFunc)(void *arg);
+
+private:
+    struct WorkItem {
+        WorkFunc func;
+        void     *arg;
+        uint64_t enqueuedUs;
+        WorkItem *next;
+    };
+
+    /*
+     * The items waiting under one key. A key is kept while it has items
+     * queued or running, and sits in its ring only while it has one that
+     * may start.
+     */
+    struct WorkKey {
+        const void *key;
+        bool     priority;
+        bool     serial;    // Items run one at a time
+        bool     inUse;
+        int      numQueued;
+        int      numRunning;
+        WorkItem *head;
+        WorkItem *tail;
+        WorkKey  *next;     // In its round-robin ring, or the free list
+    };
+
+    struct WorkRing {
+        WorkKey *head;
+        WorkKey *tail;
+    };
+
+    const char      *mName;
+    int             mNumThreads;
+    int             mMaxQueued;
+    int             mMaxPerKey;
+    WorkItem        *mItems;
+    WorkItem        *mFreeItems;
+    WorkKey         *mKeys;
+    int             mNumKeys;
+    WorkKey         *mFreeKeys;
+    WorkRing        mRings[2];  // Priority keys, then the rest
+    pthread_mutex_t mLock;
+    pthread_cond_t  mCond;
+    WorkQueueStats  mStats;
+
+public:
+    WorkQueue(const char *name, int numThreads, int maxQueued);
+    WorkQueue(const char *name, int numThreads, int maxQueued, int maxPerKey);
+    virtual ~WorkQueue();
+
+    int start();
+
+    /* Queues under one shared key, in FIFO order but run in parallel */
+    bool enqueue(WorkFunc func, void *arg);
+    bool enqueue(WorkFunc func, void *arg, const void *key, bool priority);
+    void getStats(WorkQueueStats *stats);
+
+private:
+    void init(const char *name, int numThreads, int maxQueued, int maxPerKey);
+    bool enqueueLocked(WorkFunc func, void *arg, const void *key, bool priority, bool serial);
+    WorkKey *findKeyLocked(const void *key);
+    bool inRingLocked(WorkKey *k);
+    void addToRingLocked(WorkKey *k);
+    void removeFromRingLocked(WorkKey *k);
+    WorkKey *dequeueLocked(WorkItem *item);
+    void finishLocked(WorkKey *k);
+    static void *threadStart(void *obj);
+    void run();
+};
+
+#endif
@@ -18,15 +18,57 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "private/android_filesystem_config.h"
 #include "cutils/log.h"
 
-int parent(const char *tag, int parent_read) {
+/*
+ * Time each thread has spent in logwrap() fork/exec/wait, so callers can
+ * tell how much of a command went to the programs it ran.
+ */
+static pthread_key_t exec_time_key;
+static pthread_once_t exec_time_once = PTHREAD_ONCE_INIT;
+
+static void make_exec_time_key(void) {
+    pthread_key_create(&exec_time_key, free);
+}
+
+static uint64_t *thread_exec_time(void) {
+    uint64_t *us;
+
+    pthread_once(&exec_time_once, make_exec_time_key);
+    us = pthread_getspecific(exec_time_key);
+    if (!us && (us = calloc(1, sizeof(*us))))
+        pthread_setspecific(exec_time_key, us);
+    return us;
+}
+
+uint64_t logwrap_get_exec_time_us(void) {
+    uint64_t *us = thread_exec_time();
+    return us ? *us : 0;
+}
+
+void logwrap_reset_exec_time_us(void) {
+    uint64_t *us = thread_exec_time();
+    if (us)
+        *us = 0;
+}
+
+static uint64_t now_us(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+int parent(const char *tag, int parent_read, pid_t pid) {
     int status;
     char buffer[4096];
 
@@ -70,7 +112,8 @@ int parent(const char *tag, int parent_read) {
         LOG(LOG_INFO, tag, "%s", &buffer[a]);
     }
     status = 0xAAAA;
-    if (wait(&status) != -1) {  // Wait for child
+    // Only our own child: other threads may be waiting for theirs
+    if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) != -1) {
         if (WIFEXITED(status)) {
             if (WEXITSTATUS(status) != 0) {
                 LOG(LOG_INFO, "logwrapper", "%s terminated by exit(%d)", tag,
@@ -110,6 +153,7 @@ int logwrap(int argc, const char* argv[], int background)
     int parent_ptty;
     int child_ptty;
     char child_devname[64];  // same size as libc/unistd/ptsname_r.c
+    uint64_t start = now_us();
 
     /* Use ptty instead of socketpair so that STDOUT is not buffered */
     parent_ptty = open("/dev/ptmx", O_RDWR);
@@ -168,8 +212,11 @@ int logwrap(int argc, const char* argv[], int background)
         /*
          * Parent
          */
-        int rc = parent(argv[0], parent_ptty);
+        int rc = parent(argv[0], parent_ptty, pid);
+        uint64_t *us = thread_exec_time();
         close(parent_ptty);
+        if (us)
+            *us += now_us() - start;
         return rc;
     }
 
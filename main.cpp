@@ -33,19 +33,22 @@
 #include "CommandListener.h"
 #include "NetlinkManager.h"
 #include "DnsProxyListener.h"
+#include "EventLoop.h"
 
 static void coldboot(const char *path);
-static void sigchld_handler(int sig);
 
 int main() {
 
     CommandListener *cl;
     NetlinkManager *nm;
     DnsProxyListener *dpl;
+    EventLoop *loop;
 
     LOGI("Netd 1.0 starting");
 
-//    signal(SIGCHLD, sigchld_handler);
+    // Everything below registers with the loop; it also takes over SIGCHLD,
+    // which is why it comes before any other thread is started
+    loop = EventLoop::Instance();
 
     if (!(nm = NetlinkManager::Instance())) {
         LOGE("Unable to create NetlinkManager");
@@ -54,7 +57,7 @@ int main() {
 
 
     cl = new CommandListener();
-    nm->setBroadcaster((SocketListener *) cl);
+    nm->setBroadcaster(cl);
 
     if (nm->start()) {
         LOGE("Unable to start NetlinkManager (%s)", strerror(errno));
@@ -64,7 +67,8 @@ int main() {
     // Set local DNS mode, to prevent bionic from proxying
     // back to this service, recursively.
     setenv("ANDROID_DNS_MODE", "local", 1);
-    dpl = new DnsProxyListener();
+    dpl = new DnsProxyListener(cl->getResolverController());
+    cl->setDnsProxyListener(dpl);
     if (dpl->startListener()) {
         LOGE("Unable to start DnsProxyListener (%s)", strerror(errno));
         exit(1);
@@ -78,10 +82,8 @@ int main() {
         exit(1);
     }
 
-    // Eventually we'll become the monitoring thread
-    while(1) {
-        sleep(1000);
-    }
+    // Netlink, both sockets, the sampler and child exits are all served here
+    loop->run();
 
     LOGI("Netd exiting");
     exit(0);
@@ -131,8 +133,3 @@ static void coldboot(const char *path)
         closedir(d);
     }
 }
-
-static void sigchld_handler(int sig) {
-    pid_t pid = wait(NULL);
-    LOGD("Child process %d exited", pid);
-}
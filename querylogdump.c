@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Decodes the output of "ndc resolver querylog" into one line per query:
+ *
+ *   adb shell ndc resolver querylog | querylogdump
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "DnsQueryRecord.h"
+
+static const char *OUTCOMES[] = { "local", "hit", "miss", "failfast", "rejected" };
+
+static int hexval(int c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static uint64_t le(const unsigned char *p, int len) {
+    uint64_t v = 0;
+    int i;
+
+    for (i = len - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+int main(int argc, char **argv) {
+    size_t cap = 64 * 1024, len = 0;
+    unsigned char *buf = malloc(cap);
+    int c, hi = -1;
+
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+
+    // Skip the response code, then collect hex digits up to the first gap
+    while ((c = getchar()) != EOF && c != ' ')
+        ;
+    while ((c = getchar()) != EOF) {
+        int v = hexval(c);
+        if (v < 0)
+            break;
+        if (hi < 0) {
+            hi = v;
+            continue;
+        }
+        if (len == cap) {
+            cap *= 2;
+            buf = realloc(buf, cap);
+            if (!buf) {
+                perror("realloc");
+                return 1;
+            }
+        }
+        buf[len++] = (hi << 4) | v;
+        hi = -1;
+    }
+
+    if (len < sizeof(struct DnsQueryLogHeader) ||
+        le(buf, 4) != DNS_QUERY_LOG_MAGIC) {
+        fprintf(stderr, "Not a query log dump\n");
+        return 1;
+    }
+
+    unsigned recordSize = le(buf + 4, 2);
+    unsigned numRecords = le(buf + 6, 2);
+    uint64_t nowMono = le(buf + 8, 8);
+    uint64_t nowReal = le(buf + 16, 8);
+    const unsigned char *p = buf + sizeof(struct DnsQueryLogHeader);
+
+    if (recordSize < sizeof(struct DnsQueryRecord) ||
+        len < sizeof(struct DnsQueryLogHeader) + (size_t) numRecords * recordSize) {
+        fprintf(stderr, "Truncated query log dump\n");
+        return 1;
+    }
+
+    printf("%-23s %6s %-8s %5s %-8s %6s %10s %6s\n",
+           "time", "uid", "name", "qtype", "cache", "server", "latency_us", "result");
+
+    unsigned i;
+    for (i = 0; i < numRecords; i++, p += recordSize) {
+        uint64_t ts = le(p + 8, 8);
+        uint64_t real = nowReal - (nowMono - ts);
+        time_t secs = real / 1000;
+        struct tm tm;
+        char when[32];
+        unsigned outcome = p[22];
+        unsigned server = p[23];
+        char serverStr[8];
+
+        localtime_r(&secs, &tm);
+        strftime(when, sizeof(when), "%m-%d %H:%M:%S", &tm);
+        if (server == DNS_QUERY_SERVER_NONE)
+            strcpy(serverStr, "-");
+        else
+            snprintf(serverStr, sizeof(serverStr), "%u", server);
+
+        printf("%s.%03u %6u %08x %5u %-8s %6s %10u %6d\n",
+               when, (unsigned) (real % 1000),
+               (unsigned) le(p + 4, 4),
+               (unsigned) le(p + 16, 4),
+               (unsigned) le(p + 20, 2),
+               outcome < sizeof(OUTCOMES) / sizeof(OUTCOMES[0]) ? OUTCOMES[outcome] : "?",
+               serverStr,
+               (unsigned) le(p + 24, 4),
+               (int) (int32_t) le(p + 28, 4));
+    }
+
+    free(buf);
+    return 0;
+}